@@ -21,6 +21,8 @@ local oo            = require("loop.simple")
 local math          = require("math")
 local debug         = require("jive.utils.debug")
 local string        = require("jive.utils.string")
+local Framework     = require("jive.ui.Framework")
+local Surface       = require("jive.ui.Surface")
 local Textarea      = require("jive.ui.Textarea")
 local Window        = require("jive.ui.Window")
 local Icon          = require("jive.ui.Icon")
@@ -145,6 +147,51 @@ function getImage(self)
 	return self.image
 end
 
+-- decode the image data in the background, sink is called with the image or
+-- nil on error. a pending decode is cancelled. if the decoder is busy the
+-- image is loaded now.
+function decodeImage(self, chunk, sink)
+	self:cancelDecode()
+
+	local w, h = self:_decodeSize()
+
+	self.decodeId = Framework:decodeImage(chunk, w, h,
+		function(image)
+			self.decodeId = nil
+			sink(image)
+		end)
+
+	if not self.decodeId then
+		sink(Surface:loadImageData(chunk, #chunk, w, h))
+	end
+end
+
+-- the size to decode images to, large jpegs are scaled while decoding. the
+-- applet scales the image to the screen, so when the image may be rotated
+-- or fill the screen the final size depends on the image.
+function _decodeSize(self)
+	local settings = self.applet:getSettings()
+
+	if settings["fullscreen"] or not self:useAutoZoom() then
+		return 0, 0
+	end
+
+	local w, h = Framework:getScreenSize()
+	if settings["rotation"] then
+		w = math.max(w, h)
+		h = w
+	end
+
+	return w, h
+end
+
+function cancelDecode(self)
+	if self.decodeId then
+		Framework:cancelDecode(self.decodeId)
+		self.decodeId = nil
+	end
+end
+
 function getText(self)
 	return self.imgFiles[self.currentImage]
 end
@@ -166,6 +213,7 @@ function getErrorMessage(self)
 end
 
 function free(self)
+	self:cancelDecode()
 end
 
 
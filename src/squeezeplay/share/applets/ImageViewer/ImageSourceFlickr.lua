@@ -155,13 +155,15 @@ function requestImage(self)
 	local http = SocketHttp(jnt, host, port, "ImageSourceHttp")
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
-				local image = Surface:loadImageData(chunk, #chunk)
-				self.image = image
-				log:debug("image ready")
+				self:decodeImage(chunk, function(image)
+					self.image = image
+					log:debug("image ready")
+					self.imgReady = true
+				end)
 			elseif err then
 				log:warn("error loading picture")
+				self.imgReady = true
 			end
-			self.imgReady = true
 		end,
 		'GET', path)
 	http:fetch(req)
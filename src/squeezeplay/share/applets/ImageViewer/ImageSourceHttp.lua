@@ -124,14 +124,16 @@ function requestImage(self)
 	local http = SocketHttp(jnt, parsed.host, parsed.port, "ImageSourceHttp")
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
-				local image = Surface:loadImageData(chunk, #chunk)
-				self.image = image
-				log:debug("image ready")
+				self:decodeImage(chunk, function(image)
+					self.image = image
+					log:debug("image ready")
+					self.imgReady = true
+				end)
 			elseif err then
 				self.image = nil
 				log:warn("error loading picture")
+				self.imgReady = true
 			end
-			self.imgReady = true
 		end,
 		'GET', urlString)
 	http:fetch(req)
@@ -253,17 +253,19 @@ function requestImage(self, imageData)
 	local http = SocketHttp(jnt, parsed.host, parsed.port, "ImageSourceServer")
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
-				local image = Surface:loadImageData(chunk, #chunk)
-				self.image = image
-				log:debug("image ready")
-				self.error = nil
-				self:_updateImageDataHistory(imageData)
+				self:decodeImage(chunk, function(image)
+					self.image = image
+					log:debug("image ready")
+					self.error = nil
+					self:_updateImageDataHistory(imageData)
+					self.imgReady = true
+				end)
 			elseif err then
 				self.image = nil
 				self.error = self.applet:string("IMAGE_VIEWER_HTTP_ERROR_IMAGE") 
 				log:warn("error loading picture")
+				self.imgReady = true
 			end
-			self.imgReady = true
 		end,
 		'GET', urlString)
 	http:fetch(req)
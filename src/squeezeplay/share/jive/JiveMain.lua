@@ -378,7 +378,7 @@ function JiveMain:__init()
 	jiveMain:reload()
 
 	-- debug: set event warning thresholds (0 = off)
-	--Framework:perfwarn({ screen = 50, layout = 1, draw = 0, event = 50, queue = 5, garbage = 10 })
+	--Framework:perfwarn({ screen = 50, layout = 1, draw = 0, event = 50, queue = 5, garbage = 10, pixels = 0 })
 	--jive.perfhook(50)
 
 	-- show splash screen for five seconds, or until key/scroll events
@@ -294,6 +294,11 @@ function _timerCallback(self)
 	end
 
 
+	-- collect the stream reader thread progress
+	if self.streamThreaded then
+		self:_streamReaderPoll()
+	end
+
 	-- enable stream reads when decode buffer is not full
 	if status.decodeFull < status.decodeSize and self.stream then
 		self:_proxyAndStream(true)
@@ -512,6 +517,11 @@ function _streamConnect(self, serverIp, serverPort, reader, writer, slaves)
 		-- use standard stream methods
 		m.read  = m._streamRead
 		m.write = m._streamWrite
+
+		-- the native reader cannot feed proxy clients
+		if not slaves or slaves == 0 then
+			self.stream:useReaderThread()
+		end
 	end 
 	
 	self:_proxyInit(slaves, self.stream)
@@ -731,7 +741,7 @@ function _proxyAndStream(self, canRead)
 		end
 	end
 
-	if canRead then
+	if canRead and not self.streamThreaded then
 		self.jnt:t_addRead(self.stream, self.rtask, STREAM_READ_TIMEOUT)
 	end
 end
@@ -755,6 +765,7 @@ function _streamDisconnect(self, reason, flush)
 
 	self.stream:disconnect()
 	self.stream = nil
+	self.streamThreaded = nil
 	
 	if self.proxy then
 		if reason and not reason == TCP_CLOSE_FIN then
@@ -808,6 +819,14 @@ function _streamRead(self, networkErr)
 
 	local n = self.stream:read(self)
 	while n do
+		-- the reader thread has taken over the socket, it is
+		-- polled from the status timer
+		if self.stream:isThreaded() then
+			self.streamThreaded = true
+			self.jnt:t_removeRead(self.stream)
+			return
+		end
+
 		-- stop reading if the decoder is running. the socket will
 		-- be added again by the status timer. this prevents the 
 		-- streambuf starving the cpu
@@ -822,6 +841,18 @@ function _streamRead(self, networkErr)
 end
 
 
+function _streamReaderPoll(self)
+	local n, err = self.stream:read(self)
+
+	if not n then
+		if err then
+			log:warn("read error: ", err)
+		end
+		self:_streamDisconnect((n == false) and TCP_CLOSE_FIN or TCP_CLOSE_REMOTE_RST)
+	end
+end
+
+
 function _streamHttpHeaders(self, headers)
 	-- send stream http headers to SqueezeCenter
 	self.slimproto:send({
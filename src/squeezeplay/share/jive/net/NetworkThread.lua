@@ -33,7 +33,7 @@ local _assert, next, tostring, table, ipairs, pairs, pcall, select, setmetatable
 
 local io                = require("io")
 local os                = require("os")
-local socket            = require("socket")
+local reactor           = require("jive.reactor")
 local string            = require("jive.utils.string")
 local table             = require("jive.utils.table")
 local debug             = require("jive.utils.debug")
@@ -63,45 +63,81 @@ module(..., oo.class)
 local squeezenetworkHostname = "www.squeezenetwork.com"
 
 
+-- _remove
+-- removes a socket from the read or write list
+local function _remove(self, sock, sockList, write)
+	if not sock then 
+		return 
+	end
+
+	-- remove the socket from the sockList
+	local entry = sockList[sock]
+	if entry then
+		entry.task:removeTask()
+		sockList[sock] = nil
+
+		if self.t_fds[entry.fd] == sock then
+			if write then
+				self.t_reactor:removeWrite(entry.fd)
+			else
+				self.t_reactor:removeRead(entry.fd)
+			end
+		end
+
+		if not self.t_readSocks[sock] and not self.t_writeSocks[sock] then
+			if self.t_fds[entry.fd] == sock then
+				self.t_fds[entry.fd] = nil
+			end
+			self.t_dirtySocks[sock] = nil
+		end
+	end
+end
+
+
 -- _add
 -- adds a socket to the read or write list
 -- timeout == 0 => no time out!
-local function _add(sock, task, sockList, timeout)
+local function _add(self, sock, task, sockList, timeout, write)
 	if not sock then 
 		return
 	end
 
-	if not sockList[sock] then
+	local entry = sockList[sock]
+	if not entry then
 		-- add us if we're not already in there
-		table.insert(sockList, sock)
+		local fd = sock:getfd()
+
+		if fd >= 0 then
+			-- a socket closed without being removed, its fd has been reused
+			local stale = self.t_fds[fd]
+			if stale and stale ~= sock then
+				_remove(self, stale, self.t_readSocks, false)
+				_remove(self, stale, self.t_writeSocks, true)
+			end
+			self.t_fds[fd] = sock
+		end
 
-		sockList[sock] = {
-			lastSeen = Framework:getTicks()
+		entry = {
+			fd = fd
 		}
-	elseif sockList[sock].task and sockList[sock].task ~= task then
+		sockList[sock] = entry
+
+	elseif entry.task ~= task then
 		-- else remove previous task if different
-		sockList[sock].task:removeTask()
+		entry.task:removeTask()
 	end	
 
-	-- remember the pump, the time and the desired timeout
-	sockList[sock].task = task
-	sockList[sock].timeout = (timeout or 60) * 1000
-end
-
+	-- remember the pump and the desired timeout
+	entry.task = task
 
--- _remove
--- removes a socket from the read or write list
-local function _remove(sock, sockList)
-	if not sock then 
-		return 
+	local ok, err
+	if write then
+		ok, err = self.t_reactor:addWrite(entry.fd, (timeout or 60) * 1000)
+	else
+		ok, err = self.t_reactor:addRead(entry.fd, (timeout or 60) * 1000)
 	end
-
-	-- remove the socket from the sockList
-	if sockList[sock] then
-		sockList[sock].task:removeTask()
-		
-		sockList[sock] = nil
-		table.delete(sockList, sock)
+	if not ok then
+		log:error("can't add socket: ", err)
 	end
 end
 
@@ -111,81 +147,96 @@ end
 function t_addRead(self, sock, task, timeout)
 --	log:warn("NetworkThread:t_addRead()", sock)
 
-	_add(sock, task, self.t_readSocks, timeout)
+	_add(self, sock, task, self.t_readSocks, timeout, false)
 end
 
 function t_removeRead(self, sock)
 --	log:warn("NetworkThread:t_removeRead()", sock)
 	
-	_remove(sock, self.t_readSocks)
+	_remove(self, sock, self.t_readSocks, false)
 end
 
 function t_addWrite(self, sock, task, timeout)
 --	log:warn("NetworkThread:t_addWrite()", sock)
 	
-	_add(sock, task, self.t_writeSocks, timeout)
+	_add(self, sock, task, self.t_writeSocks, timeout, true)
 end
 
 function t_removeWrite(self, sock)
 --	log:warn("NetworkThread:t_removeWrite()", sock)
 	
-	_remove(sock, self.t_writeSocks)
+	_remove(self, sock, self.t_writeSocks, true)
 end
 
 
--- _timeout
--- manages the timeout of our sockets
-local function _timeout(now, sockList)
---	log:debug("NetworkThread:_timeout()")
+-- _ready
+-- runs the pump for a ready socket
+local function _ready(self, sock, sockList, write)
+	local entry = sockList[sock]
 
-	for v, t in pairs(sockList) do
-		-- the sockList contains both sockList[i] = sock and sockList[sock] = {pumpIt=,lastSeem=}
-		-- we want the second case, the sock is a userdata (implemented by LuaSocket)
-		-- we also want the timeout to exist and have expired
-		if type(v) == "userdata" and t.timeout > 0 and now - t.lastSeen > t.timeout then
-			log:warn("network thread timeout for ", t.task)
-			t.task:addTask("inactivity timeout")
-		end
+	-- the socket may have been removed by an earlier pump
+	if entry and not entry.task:addTask() then
+		_remove(self, sock, sockList, write)
 	end
 end
 
 
 -- _t_select
--- runs our sockets through select
+-- waits for our sockets using the reactor
 local function _t_select(self, timeout)
---	log:debug("_t_select(r", #self.t_readSocks, " w", #self.t_writeSocks, ")")
+	-- luasocket buffers data, a socket read since the last wait may
+	-- be readable without the fd being ready
+	local dirty = {}
+	for sock in pairs(self.t_dirtySocks) do
+		if self.t_readSocks[sock] and sock:dirty() then
+			dirty[#dirty + 1] = sock
+		else
+			self.t_dirtySocks[sock] = nil
+		end
+	end
 
-	local r,w,e = socket.select(self.t_readSocks, self.t_writeSocks, timeout)
+	if #dirty > 0 then
+		timeout = 0
+	end
+
+	local r, w, rt, wt = self.t_reactor:wait(timeout)
 
-	local now = Framework:getTicks()
-		
-	if e then
-		-- timeout is a normal error for select if there's nothing to do!
-		if e ~= 'timeout' then
-			log:error(e)
+	-- call the write pumps
+	if w then
+		for i,fd in ipairs(w) do
+			_ready(self, self.t_fds[fd], self.t_writeSocks, true)
 		end
+	end
 
-	else
-		-- call the write pumps
-		for i,v in ipairs(w) do
-			self.t_writeSocks[v].lastSeen = now
-			if not self.t_writeSocks[v].task:addTask() then
-				_remove(v, self.t_writeSocks)
+	-- call the read pumps
+	if r then
+		for i,fd in ipairs(r) do
+			local sock = self.t_fds[fd]
+			if sock and not self.t_dirtySocks[sock] then
+				dirty[#dirty + 1] = sock
 			end
 		end
-		
-		-- call the read pumps
-		for i,v in ipairs(r) do
-			self.t_readSocks[v].lastSeen = now
-			if not self.t_readSocks[v].task:addTask() then
-				_remove(v, self.t_readSocks)
-			end
+	end
+
+	for i,sock in ipairs(dirty) do
+		if sock.dirty then
+			self.t_dirtySocks[sock] = true
 		end
+		_ready(self, sock, self.t_readSocks, false)
 	end
 
 	-- manage timeouts
-	_timeout(now, self.t_readSocks)
-	_timeout(now, self.t_writeSocks)
+	for i,list in ipairs({ { rt, self.t_readSocks }, { wt, self.t_writeSocks } }) do
+		if list[1] then
+			for j,fd in ipairs(list[1]) do
+				local entry = list[2][self.t_fds[fd]]
+				if entry then
+					log:warn("network thread timeout for ", entry.task)
+					entry.task:addTask("inactivity timeout")
+				end
+			end
+		end
+	end
 end
 
 
@@ -197,12 +248,7 @@ local function _run(self, timeout)
 	log:debug("NetworkThread starting...")
 
 	while true do
-		local timeoutSecs = timeout / 1000
-		if timeoutSecs < 0 then
-			timeoutSecs = 0
-		end
-
-		ok, err = pcall(_t_select, self, timeoutSecs)
+		ok, err = pcall(_t_select, self, timeout)
 		if not ok then
 			log:error("error in _t_select: " .. err)
 		end
@@ -454,10 +500,18 @@ function __init(self)
 --	log:debug("NetworkThread:__init()")
 
 	local obj = oo.rawnew(self, {
-		-- list of sockets for select
+		-- sockets waiting to read and write, by socket
 		t_readSocks = {},
 		t_writeSocks = {},
 
+		-- sockets by file descriptor
+		t_fds = {},
+
+		-- sockets that may have buffered data
+		t_dirtySocks = {},
+
+		t_reactor = reactor.open(),
+
 		-- list of objects for notify
 		subscribers = {},
 
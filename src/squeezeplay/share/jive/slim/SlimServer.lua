@@ -475,6 +475,9 @@ function __init(self, jnt, id, name, version)
 
 		-- loaded images
 		imageCache = {},
+
+		-- artwork being decoded in the background, by cache key
+		artworkDecode = {},
 	})
 
 	obj.state.version = version
@@ -873,8 +876,15 @@ end
 
 -- convert artwork to a resized image
 local function _loadArtworkImage(self, cacheKey, chunk, size)
-	-- create a surface
-	local image = Surface:loadImageData(chunk, #chunk)
+	-- parse size specification for width and height if in format <W>x<H>
+	local sizeW = tonumber(string.match(size, "(%d+)x%d+") or size) or 0
+	local sizeH = tonumber(string.match(size, "%d+x(%d+)") or size) or 0
+
+	-- create a surface, resized to fit while decoding
+	-- Note this allows for artwork to be resized to a larger
+	-- size than the original.  This is intentional so smaller cover
+	-- art will still fill the space properly on the Now Playing screen
+	local image = Surface:loadImageData(chunk, #chunk, sizeW, sizeH)
 
 	local w, h = image:getSize()
 
@@ -884,28 +894,61 @@ local function _loadArtworkImage(self, cacheKey, chunk, size)
 		return nil
 	end
 
-	-- parse size specification for width and height if in format <W>x<H>
-	local sizeW = tonumber(string.match(size, "(%d+)x%d+") or size)
-	local sizeH = tonumber(string.match(size, "%d+x(%d+)") or size)
+	-- cache image
+	self.imageCache[cacheKey] = image
 
-	-- Resize image
-	-- Note this allows for artwork to be resized to a larger
-	-- size than the original.  This is intentional so smaller cover
-	-- art will still fill the space properly on the Now Playing screen
-	if w ~= sizeW and h ~= sizeH then
-		local tmp = image:rotozoom(0, sizeW / w, 1)
-		image:release()
-		image = tmp
-		if logcache:isDebug() then
-			local wnew, hnew = image:getSize()
-			logcache:debug("Resized artwork from ", w, "x", h, " to ", wnew, "x", hnew)
+	return image
+end
+
+
+-- set the artwork to all icons waiting for it
+local function _setArtworkIcons(self, cacheKey, image)
+	local icons = self.artworkThumbIcons
+	for icon, key in pairs(icons) do
+		if key == cacheKey then
+			icon:setValue(image)
+			icons[icon] = nil
 		end
 	end
+end
 
-	-- cache image
-	self.imageCache[cacheKey] = image
 
-	return image
+-- decode artwork in the background, the icons waiting for the artwork are
+-- set when it is ready. if the decoder is busy the artwork is loaded now.
+local function _decodeArtworkImage(self, cacheKey, chunk, size)
+	if self.artworkDecode[cacheKey] then
+		-- already decoding
+		return
+	end
+
+	-- parse size specification for width and height if in format <W>x<H>
+	local sizeW = tonumber(string.match(size, "(%d+)x%d+") or size) or 0
+	local sizeH = tonumber(string.match(size, "%d+x(%d+)") or size) or 0
+
+	local id = Framework:decodeImage(chunk, sizeW, sizeH,
+		function(image)
+			self.artworkDecode[cacheKey] = nil
+
+			-- don't display empty artwork
+			if image then
+				local w, h = image:getSize()
+				if w == 0 or h == 0 then
+					image = nil
+				end
+			end
+
+			self.imageCache[cacheKey] = image or true
+			_setArtworkIcons(self, cacheKey, image)
+		end)
+
+	if id then
+		-- mark as requested until the image is decoded
+		self.artworkDecode[cacheKey] = id
+		self.imageCache[cacheKey] = true
+		return
+	end
+
+	_setArtworkIcons(self, cacheKey, _loadArtworkImage(self, cacheKey, chunk, size))
 end
 
 
@@ -934,16 +977,7 @@ local function _getArtworkThumbSink(self, cacheKey, size, url)
 			-- store the compressed artwork in the cache
 			self.artworkCache:set(cacheKey, chunk)
 
-			local image = _loadArtworkImage(self, cacheKey, chunk, size)
-
-			-- set it to all icons waiting for it
-			local icons = self.artworkThumbIcons
-			for icon, key in pairs(icons) do
-				if key == cacheKey then
-					icon:setValue(image)
-					icons[icon] = nil
-				end
-			end
+			_decodeArtworkImage(self, cacheKey, chunk, size)
 		end
 	end
 end
@@ -1026,7 +1060,23 @@ function cancelArtwork(self, icon)
 			--only set nil if not already nil
 			icon:setValue(nil)
 		end
+
+		local cacheKey = self.artworkThumbIcons[icon]
 		self.artworkThumbIcons[icon] = nil
+
+		-- stop decoding if no other icon is waiting for the artwork
+		local id = cacheKey and self.artworkDecode[cacheKey]
+		if id then
+			for _, key in pairs(self.artworkThumbIcons) do
+				if key == cacheKey then
+					return
+				end
+			end
+
+			Framework:cancelDecode(id)
+			self.artworkDecode[cacheKey] = nil
+			self.imageCache[cacheKey] = nil
+		end
 	end
 end
 
@@ -1113,9 +1163,10 @@ function fetchArtwork(self, iconId, icon, size, imgFormat)
 		else
 			logcache:debug("..artwork in cache")
 			if icon then
-				image = _loadArtworkImage(self, cacheKey, artwork, size)
-				icon:setValue(image)
-				self.artworkThumbIcons[icon] = nil
+				-- the icon keeps its image until the artwork is
+				-- decoded, or is set now if it is decoded here
+				self.artworkThumbIcons[icon] = cacheKey
+				_decodeArtworkImage(self, cacheKey, artwork, size)
 			end
 			return
 		end
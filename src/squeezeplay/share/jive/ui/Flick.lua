@@ -236,6 +236,10 @@ function flick(self, initialSpeed, direction, noMinimum)
 		self.flickInitialSpeed = initialSpeed
 		self.flickDirection = direction
 		self.snapToItemInProgress = false
+
+		-- step once per frame, the flick position is computed from the
+		-- elapsed time so the speed does not depend on the frame rate
+		self.flickTimer:setInterval(math.floor(1000 / Framework:getFrameRate()))
 		self.flickTimer:start()
 
 		if not self.flickInitialScrollT then
@@ -47,6 +47,13 @@ local jnt           = jnt
 
 local LONG_HOLD_TIME  = 3500
 
+-- when nothing is animating the event loop sleeps until the next timer,
+-- but wakes at this interval (ms) to poll for input
+local IDLE_INTERVAL = 100
+
+-- maximum time (ms) for garbage collection after an idle frame
+local GC_IDLE_BUDGET = 20
+
 -- our class
 module(..., oo.class)
 
@@ -93,6 +100,8 @@ widgets = {} -- global widgets
 globalListeners = {} -- global listeners
 unusedListeners = {} -- unused listeners
 animations = {} -- active widget animations
+frameRate = FRAME_RATE -- frames per second, set per platform
+frameStats = { wakeups = 0, ticks = 0, frames = 0 } -- event loop counters for the last second
 sound = {} -- sounds
 soundEnabled = {} -- sound enabled state
 
@@ -157,6 +166,26 @@ Sets the background image I<image>.
 
 Indicates the style parameters have changed, this clears any caching of the style values used.
 
+=head2 jive.ui.Framework:textCache(maxBytes)
+
+Returns a table of the rendered text cache statistics: I<hits>, I<misses>, I<evictions>, I<entries>, I<bytes> and I<maxBytes>. If I<maxBytes> is given the cache limit is set first, 0 disables the cache.
+
+=head2 jive.ui.Framework:imageCache(maxBytes)
+
+Returns a table of the image cache statistics: I<hits>, I<loads>, I<evictions>, I<images>, I<bytes> and I<maxBytes>. If I<maxBytes> is given the limit on the decoded image bytes is set first. Tile:prefetch() loads the images of a tile before it is drawn; a window prefetches its background and mask tiles before a transition.
+
+=head2 jive.ui.Framework:updateScreen()
+
+Draws the dirty regions of the screen, and transitions and animations. Returns true if the screen was updated.
+
+=head2 jive.ui.Framework:decodeImage(data, maxW, maxH, callback)
+
+Decodes the compressed image I<data> on a background thread, scaled to fit I<maxW> x I<maxH> unless these are 0, and converted to the screen format. I<callback> is called from the event loop with the L<jive.ui.Surface>, or nil if the image could not be decoded. Returns a request id, or nil if the decode queue is full in which case the caller should use Surface:loadImageData().
+
+=head2 jive.ui.Framework:cancelDecode(id)
+
+Cancels a request made with decodeImage(), the callback is not called.
+
 =cut
 --]]
 
@@ -273,6 +302,51 @@ function init(self)
 end
 
 
+--[[
+
+=head2 jive.ui.Framework:setFrameRate(fps)
+
+Sets the frame rate in frames per second, the default is I<jive.ui.FRAME_RATE>. Platforms with faster hardware can use a higher frame rate for smoother scrolling. Animations and transitions are stepped by time, so their speed does not depend on the frame rate.
+
+=cut
+--]]
+function setFrameRate(self, fps)
+	_assert(type(fps) == "number" and fps > 0, "Invalid frame rate")
+
+	frameRate = fps
+end
+
+
+--[[
+
+=head2 jive.ui.Framework:getFrameRate()
+
+Returns the frame rate in frames per second.
+
+=cut
+--]]
+function getFrameRate(self)
+	return frameRate
+end
+
+
+--[[
+
+=head2 jive.ui.Framework:getFrameStats()
+
+Returns a table of event loop counters for the last second: I<wakeups> is the number of times the loop woke up, I<ticks> the number of frames processed and I<frames> the number of frames drawn. When nothing is animating the loop sleeps until the next timer is due or I<IDLE_INTERVAL> ms for input, so an idle ui should have few ticks and no frames.
+
+=cut
+--]]
+function getFrameStats(self)
+	return {
+		wakeups = frameStats.wakeups,
+		ticks = frameStats.ticks,
+		frames = frameStats.frames,
+	}
+end
+
+
 --[[
 
 =head2 jive.ui.Framework:eventLoop(netTask)
@@ -297,16 +371,23 @@ function eventLoop(self, netTask)
 
 
 	-- frame rate in milliseconds
-	local framerate = math.floor(1000 / FRAME_RATE)
+	local framerate = math.floor(1000 / frameRate)
 
-	-- time for a vertical refesh. in the future this may need adjusting
-	-- per squeezeplay platform
+	-- time for a vertical refesh
 	local framerefresh = framerate >> 2
 
 	-- next frame due
 	local now = self:getTicks()
 	local framedue = now + framerate
 
+	-- idle when nothing is animating, then frames are only processed
+	-- for timers and input
+	local idle = false
+
+	-- counters, rolled into frameStats every second
+	local wakeups, ticks, frames = 0, 0, 0
+	local statsdue = now + 1000
+
 	local running = true
 	while running do
 		-- process tasks: 
@@ -333,30 +414,83 @@ function eventLoop(self, netTask)
 			netTask:setArgs(framedue - now)
 		end
 		netTask:resume()
+		wakeups = wakeups + 1
 
-		-- draw frame and process ui event queue
 		now = self:getTicks()
+
+		-- a task or network callback may have changed the screen while
+		-- idle, return to the frame rate
+		if idle and self:_needsFrame() then
+			idle = false
+			framedue = now
+		end
+
+		-- draw frame and process ui event queue
 		if framedue <= now then
 			logTask:debug("--------")
+			ticks = ticks + 1
 
 			-- draw screen
-			self:updateScreen()
-
-			-- keep on top of the garbage
-			collectgarbage("step")
+			if self:updateScreen() then
+				frames = frames + 1
+			end
 
 			-- process ui event once per frame
 			Timer:_runTimer(now)
 			running = eventTask:resume()
 
-			-- when is the next frame due?
-			framedue = framedue + framerate
+			-- the frame rate may have been changed
+			framerate = math.floor(1000 / frameRate)
+			framerefresh = framerate >> 2
 
+			-- when is the next frame due?
 			now = self:getTicks()
-			if now > framedue - framerefresh then
-				logTask:debug("Dropped frame. delay=", now-framedue, "ms")
-				framedue = now + framerefresh
+
+			local busy, holddue = self:_needsFrame()
+			if busy then
+				idle = false
+				framedue = framedue + framerate
+
+				if now > framedue - framerefresh then
+					logTask:debug("Dropped frame. delay=", now-framedue, "ms")
+					framedue = now + framerefresh
+				end
+			else
+				-- sleep until the next timer, but poll for input
+				idle = true
+				framedue = now + IDLE_INTERVAL
+
+				local expires = Timer:_nextExpiry()
+				if expires and expires < framedue then
+					framedue = expires
+				end
+				if holddue and holddue < framedue then
+					framedue = holddue
+				end
+				if framedue < now + framerefresh then
+					framedue = now + framerefresh
+				end
 			end
+
+			-- keep on top of the garbage in the time left before the
+			-- next frame. when animating up to half a frame is used,
+			-- leaving time for other tasks, and none if the frame is
+			-- late
+			local budget = framedue - now - framerefresh
+			if idle then
+				budget = math.min(budget, GC_IDLE_BUDGET)
+			else
+				budget = math.min(budget, framerate >> 1)
+			end
+			self:_gcStep(budget)
+		end
+
+		if now >= statsdue then
+			frameStats.wakeups = wakeups
+			frameStats.ticks = ticks
+			frameStats.frames = frames
+			wakeups, ticks, frames = 0, 0, 0
+			statsdue = now + 1000
 		end
 	end
 
@@ -33,9 +33,9 @@ Constructs a new RGBA surface of width and height I<w> and I<h>. The surface is
 
 Load an image from I<path>. If I<path> is relative the lua path is searched for the image. Returns the loaded image.
 
-=head2 loadImageData(data, len)
+=head2 loadImageData(data, len, maxW, maxH)
 
-Load an image from I<data> using I<len> bytes. Returns the loaded image.
+Load an image from I<data> using I<len> bytes. If I<maxW> and I<maxH> are given the image is scaled to fit, jpeg images are scaled by 1/2, 1/4 or 1/8 while they are decoded which is faster and uses less memory. Returns the loaded image.
 
 =head2 drawText(font, color, str)
 
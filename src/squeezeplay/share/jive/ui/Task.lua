@@ -23,8 +23,10 @@ PRIORITY_LOW = 3
 
 -- the task list is modified while iterating over the entries,
 -- we use a linked list to make the iteration easier
--- three queues: streaming, high and low
+-- three queues: streaming, high and low. tasks are linked in both
+-- directions so they can be added and removed without walking the list
 local taskHead = { nil, nil, nil }
+local taskTail = { nil, nil, nil }
 
 -- the task that is active, or nil for the main thread
 local taskRunning = nil
@@ -106,20 +108,14 @@ function addTask(self, ...)
 	self.args = { ... }
 	self.state = "active"
 	self.next = nil
+	self.prev = taskTail[self.priority]
 
-	if taskHead[self.priority] == nil then
-		taskHead[self.priority] = self
+	if self.prev then
+		self.prev.next = self
 	else
-		local entry = taskHead[self.priority]
-		while entry do
-			if not entry.next then
-				entry.next = self
-				break
-			end
-
-			entry = entry.next
-		end
+		taskHead[self.priority] = self
 	end
+	taskTail[self.priority] = self
 
 	return true
 end
@@ -129,31 +125,29 @@ end
 function removeTask(self)
 	log:debug("removeTask ", self.name)
 
-	self.state = "suspended"
-
-	-- unlink from linked list
-	if not taskHead then
+	-- not in the task list
+	if self.state ~= "active" then
+		self.state = "suspended"
 		return
 	end
 
-	if taskHead[self.priority] == self then
-		if taskHead[self.priority].next then
-			taskHead[self.priority] = self.next
-		else
-			taskHead[self.priority] = nil
-		end
-		return
-	end
+	self.state = "suspended"
 
-	local entry = taskHead[self.priority]
-	while entry do
-		if entry.next == self then
-			entry.next = self.next
-			return
-		end
+	-- unlink from linked list. self.next is kept so an iterator
+	-- positioned on this task can continue
+	if self.prev then
+		self.prev.next = self.next
+	else
+		taskHead[self.priority] = self.next
+	end
 
-		entry = entry.next
+	if self.next then
+		self.next.prev = self.prev
+	else
+		taskTail[self.priority] = self.prev
 	end
+
+	self.prev = nil
 end
 
 
@@ -29,7 +29,6 @@ A timer object.
 local _assert, ipairs, pcall, string, tostring, type = _assert, ipairs, pcall, string, tostring, type
 
 local oo	= require("loop.base")
-local table	= require("jive.utils.table")
 
 local Framework = require("jive.ui.Framework")
 
@@ -41,8 +40,8 @@ local log       = require("jive.utils.log").logger("squeezeplay.timer")
 module(..., oo.class)
 
 
--- sorted list of running timers
-local timers = {}
+-- running timers are kept in a native queue ordered by expiry time,
+-- see _queueInsert, _queueRemove, _queuePop and _queueNext
 
 
 --[[
@@ -92,7 +91,7 @@ Stops the timer.
 --]]
 
 function stop(self)
-	 table.delete(timers, self)
+	 self:_queueRemove()
 	 self.expires = nil
 end
 
@@ -150,32 +149,26 @@ function isRunning(self)
 end
 
 
--- insert the timer into timer queue
+-- insert the timer into timer queue, or move it if already queued
 function _insertTimer(self, expires)
-	if self.expires then
-		table.delete(timers, self)
-	end
 	self.expires = expires
+	self:_queueInsert(expires)
+end
 
-	for i, timer in ipairs(timers) do
-		if self.expires < timer.expires then
-	 		table.insert(timers, i, self)
-			return
-		end
-	end
-	table.insert(timers, self)
+
+-- returns when the next timer expires, or nil if no timers are running
+function _nextExpiry(self)
+	return self:_queueNext()
 end
 
 
 -- process timer queue
 function _runTimer(self, now)
-	if timers[1] and not timers[1].expires then
-		log:error("stopped timer in timer list")
-		debug.dump(timers)
-	end
-
-	while timers[1] and timers[1].expires <= now do
-		local timer = table.remove(timers, 1)
+	while true do
+		local timer = self:_queuePop(now)
+		if not timer then
+			break
+		end
 
 		-- call back may modify the timer so update it first
 		if not timer.once then
@@ -68,6 +68,7 @@ Widgets in  the Content On Stage layer are only animated when moving on stage. T
 local _assert, assert, ipairs, require, tostring, type = _assert, assert, ipairs, require, tostring, type
 
 local oo            = require("loop.base")
+local math          = require("math")
 local string        = require("string")
 local table         = require("jive.utils.table")
 local Event         = require("jive.ui.Event")
@@ -76,7 +77,6 @@ local Timer         = require("jive.ui.Timer")
 local debug         = require("jive.utils.debug")
 local log           = require("jive.utils.log").logger("squeezeplay.ui")
 
-local FRAME_RATE    = jive.ui.FRAME_RATE
 local EVENT_SHOW    = jive.ui.EVENT_SHOW
 local EVENT_HIDE    = jive.ui.EVENT_HIDE
 local EVENT_UPDATE  = jive.ui.EVENT_UPDATE
@@ -477,7 +477,7 @@ end
 
 =head2 jive.ui.Widget:addAnimation(animation, frameRate)
 
-Add an animation function I<animation> to the widget. This function will be called before the frame is drawn at the requested I<frameRate>. Returns a I<handle> to use in removeAnimation().
+Add an animation function I<animation> to the widget. This function will be called before the frame is drawn at the requested I<frameRate>, or at the framework frame rate if that is lower. Animations are stepped by time, so they run at the same speed at any framework frame rate. Returns a I<handle> to use in removeAnimation().
 
 =cut
 --]]
@@ -485,9 +485,9 @@ function addAnimation(self, animation, frameRate)
 	_assert(type(animation) == "function", "Invalid animation function")
 	_assert(type(frameRate) == "number", "Invalid frame rate")
 
-	frameRate = FRAME_RATE / frameRate
-
-	local handle = { animation, frameRate, frameRate }
+	-- animation, interval in ms and when it is next due (0 until the
+	-- first frame)
+	local handle = { animation, math.floor(1000 / frameRate), 0 }
 	self.animations[#self.animations + 1] = handle
 
 	if self.visible then
@@ -87,7 +87,6 @@ local KEY_BACK                = jive.ui.KEY_BACK
 local KEY_GO                  = jive.ui.KEY_GO
 local KEY_RIGHT               = jive.ui.KEY_RIGHT
 
-local FRAME_RATE              = jive.ui.FRAME_RATE
 local LAYER_ALL               = jive.ui.LAYER_ALL
 local LAYER_CONTENT           = jive.ui.LAYER_CONTENT
 local LAYER_CONTENT_OFF_STAGE = jive.ui.LAYER_CONTENT_OFF_STAGE
@@ -106,6 +105,8 @@ local LAYOUT_NONE             = jive.ui.LAYOUT_NONE
 local appletManager           = require("jive.AppletManager")
 
 local HORIZONTAL_PUSH_TRANSITION_DURATION = 500
+local POPUP_TRANSITION_DURATION = 180
+local BUMP_TRANSITION_DURATION = 140
 
 -- our class
 module(...)
@@ -1237,6 +1238,9 @@ function _newTransition(transition, oldwindow, newwindow)
 		return f
 	end
 
+	-- load the window images now, not in the first frame
+	newwindow:prefetch()
+
 	local idx = 1
 	local windows = {}
 
@@ -1278,26 +1282,26 @@ end
 --with animation in both directions
 function transitionBumpDown(self)
 
-	local frames = 1
-	local screenWidth = Framework:getScreenSize()
-	local inReturn = false
+	local startT
+	local transitionDuration = BUMP_TRANSITION_DURATION
 	return function(widget, surface)
-			local y = frames * 3
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local elapsed = Framework:getTicks() - startT
+
+			-- out to 3 pixels and back
+			local y = 3 - math.abs(3 - (6 * elapsed / transitionDuration))
+			if y < 0 then
+				y = 0
+			end
 
 			self:draw(surface, LAYER_FRAME | LAYER_LOWER)
-			surface:setOffset(0, y / 2)
+			surface:setOffset(0, math.floor(y + 0.5))
 			self:draw(surface, LAYER_CONTENT | LAYER_CONTENT_OFF_STAGE | LAYER_CONTENT_ON_STAGE | LAYER_TITLE)
 			surface:setOffset(0, 0)
 
-			if not inReturn and frames < 2 then
-				frames = frames + 1
-
-			else
-				inReturn = true
-				frames = frames - 1
-			end
-
-			if frames == 0 then
+			if elapsed >= transitionDuration then
 				Framework:_killTransition()
 			end
 		end
@@ -1306,26 +1310,26 @@ end
 --with animation in both directions
 function transitionBumpUp(self)
 
-	local frames = 1
-	local screenWidth = Framework:getScreenSize()
-	local inReturn = false
+	local startT
+	local transitionDuration = BUMP_TRANSITION_DURATION
 	return function(widget, surface)
-			local y = frames * 3
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local elapsed = Framework:getTicks() - startT
+
+			-- out to 3 pixels and back
+			local y = 3 - math.abs(3 - (6 * elapsed / transitionDuration))
+			if y < 0 then
+				y = 0
+			end
 
 			self:draw(surface, LAYER_FRAME | LAYER_LOWER)
-			surface:setOffset(0, -y / 2)
+			surface:setOffset(0, -math.floor(y + 0.5))
 			self:draw(surface, LAYER_CONTENT | LAYER_CONTENT_OFF_STAGE | LAYER_CONTENT_ON_STAGE | LAYER_TITLE)
 			surface:setOffset(0, 0)
 
-			if not inReturn and frames < 2 then
-				frames = frames + 1
-
-			else
-				inReturn = true
-				frames = frames - 1
-			end
-
-			if frames == 0 then
+			if elapsed >= transitionDuration then
 				Framework:_killTransition()
 			end
 		end
@@ -1341,11 +1345,19 @@ Returns a bump left window transition.
 --]]
 function transitionBumpLeft(self)
 
-	local frames = 2
-	local screenWidth = Framework:getScreenSize()
-
+	local startT
+	local transitionDuration = BUMP_TRANSITION_DURATION
 	return function(widget, surface)
-			local x = frames * 3
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local remaining = transitionDuration - (Framework:getTicks() - startT)
+
+			-- back from 6 pixels
+			local x = 0
+			if remaining > 0 then
+				x = math.ceil(6 * remaining / transitionDuration)
+			end
 
 			if widget._bg then
 				widget._bg:blit(surface, 0, 0)
@@ -1356,8 +1368,7 @@ function transitionBumpLeft(self)
 			surface:setOffset(0, 0)
 			self:draw(surface, LAYER_FRAME)
 
-			frames = frames - 1
-			if frames == 0 then
+			if remaining <= 0 then
 				Framework:_killTransition()
 			end
 		end
@@ -1374,11 +1385,19 @@ Returns a bump right window transition.
 --]]
 function transitionBumpRight(self)
 
-	local frames = 2
-	local screenWidth = Framework:getScreenSize()
-
+	local startT
+	local transitionDuration = BUMP_TRANSITION_DURATION
 	return function(widget, surface)
-			local x = frames * 3
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local remaining = transitionDuration - (Framework:getTicks() - startT)
+
+			-- back from 6 pixels
+			local x = 0
+			if remaining > 0 then
+				x = math.ceil(6 * remaining / transitionDuration)
+			end
 
 			if widget._bg then
 				widget._bg:blit(surface, 0, 0)
@@ -1389,8 +1408,7 @@ function transitionBumpRight(self)
 			surface:setOffset(0, 0)
 			self:draw(surface, LAYER_FRAME)
 
-			frames = frames - 1
-			if frames == 0 then
+			if remaining <= 0 then
 				Framework:_killTransition()
 			end
 		end
@@ -1619,14 +1637,17 @@ function transitionPushPopupUp(oldWindow, newWindow)
 	_assert(oo.instanceof(oldWindow, Widget))
 	_assert(oo.instanceof(newWindow, Widget))
 
-	local _, screenHeight = Framework:getScreenSize()
-
-	local frames = math.ceil(FRAME_RATE / 6)
+	local startT
+	local transitionDuration = POPUP_TRANSITION_DURATION
+	local remaining = transitionDuration
 	local _,_,_,windowHeight = newWindow:getBounds()
-	local scale = (frames * frames * frames) / windowHeight
+	local scale = (transitionDuration * transitionDuration * transitionDuration) / windowHeight
 
 	return function(widget, surface)
-			local y = ((frames * frames * frames) / scale)
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local y = math.floor((remaining * remaining * remaining) / scale)
 
 			surface:setOffset(0, 0)
 			oldWindow:draw(surface, LAYER_ALL)
@@ -1636,8 +1657,8 @@ function transitionPushPopupUp(oldWindow, newWindow)
 
 			surface:setOffset(0, 0)
 
-			frames = frames - 1
-			if frames == 0 then
+			remaining = transitionDuration - (Framework:getTicks() - startT)
+			if remaining <= 0 then
 				Framework:_killTransition()
 			end
 		end
@@ -1656,14 +1677,17 @@ function transitionPushPopupDown(oldWindow, newWindow)
 	_assert(oo.instanceof(oldWindow, Widget))
 	_assert(oo.instanceof(newWindow, Widget))
 
-	local _, screenHeight = Framework:getScreenSize()
-
-	local frames = math.ceil(FRAME_RATE / 6)
+	local startT
+	local transitionDuration = POPUP_TRANSITION_DURATION
+	local remaining = transitionDuration
 	local _,_,_,windowHeight = oldWindow:getBounds()
-	local scale = (frames * frames * frames) / windowHeight
+	local scale = (transitionDuration * transitionDuration * transitionDuration) / windowHeight
 
 	return function(widget, surface)
-			local y = ((frames * frames * frames) / scale)
+			if not startT then
+				startT = Framework:getTicks()
+			end
+			local y = math.floor((remaining * remaining * remaining) / scale)
 
 			surface:setOffset(0, 0)
 			newWindow:draw(surface, LAYER_ALL)
@@ -1673,8 +1697,8 @@ function transitionPushPopupDown(oldWindow, newWindow)
 
 			surface:setOffset(0, 0)
 
-			frames = frames - 1
-			if frames == 0 then
+			remaining = transitionDuration - (Framework:getTicks() - startT)
+			if remaining <= 0 then
 				Framework:_killTransition()
 			end
 		end
@@ -11,17 +11,281 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
 
 
-void decode_init_buffers(void *buf, bool_t prio_inherit) {
+void decode_init_buffers(void *buf, size_t fifo_capacity, bool_t prio_inherit) {
 	decode_audio = buf;
-	decode_fifo_buf = ((u8_t *)decode_audio) + sizeof(struct decode_audio);
-	effect_fifo_buf = ((u8_t *)decode_fifo_buf) + DECODE_FIFO_SIZE;
+	effect_fifo_buf = ((u8_t *)decode_audio) + sizeof(struct decode_audio);
+	decode_fifo_buf = ((u8_t *)effect_fifo_buf) + EFFECT_FIFO_SIZE;
 
 	memset(decode_audio, 0, sizeof(struct decode_audio));
 	decode_audio->set_sample_rate = 44100;
-	fifo_init(&decode_audio->fifo, DECODE_FIFO_SIZE, prio_inherit);
+	decode_audio->fifo_capacity = fifo_capacity;
+	decode_audio->fifo_time = DECODE_FIFO_TIME;
+	fifo_init(&decode_audio->fifo, fifo_capacity, prio_inherit);
 	fifo_init(&decode_audio->effect_fifo, EFFECT_FIFO_SIZE, prio_inherit);
+	decode_audio->fifo_bits = 32;
+
+	sample_convert_init();
+}
+
+
+/* Switch the fifo format once the output has read up to a pending
+ * format change.
+ */
+static void decode_fifo_update_bits(void) {
+	if (decode_audio->fifo_bits_pending
+	    && decode_audio->fifo.rptr == decode_audio->fifo_bits_ptr) {
+		decode_audio->fifo_bits = decode_audio->fifo_next_bits;
+		decode_audio->fifo_bits_pending = false;
+	}
+}
+
+
+/* Frames in the decode fifo, including both sides of a pending format
+ * change. Call with the fifo locked.
+ */
+size_t decode_fifo_frames_used(void) {
+	size_t bytes_used, bytes_before;
+
+	ASSERT_AUDIO_LOCKED();
+
+	decode_fifo_update_bits();
+
+	bytes_used = fifo_bytes_used(&decode_audio->fifo);
+	if (!decode_audio->fifo_bits_pending) {
+		return FIFO_BYTES_TO_FRAMES(bytes_used);
+	}
+
+	bytes_before = decode_fifo_distance(decode_audio->fifo.rptr, decode_audio->fifo_bits_ptr);
+	if (bytes_before > bytes_used) {
+		bytes_before = bytes_used;
+	}
+
+	return FIFO_BYTES_TO_FRAMES(bytes_before)
+		+ (bytes_used - bytes_before) / FIFO_FRAME_BYTES(decode_audio->fifo_next_bits);
+}
+
+
+/* Returns the bytes that can be read from pos, a position between rptr
+ * and wptr, without wrapping or crossing a format change. The samples
+ * have *bits per sample. Call with the fifo locked.
+ */
+size_t decode_fifo_run(size_t pos, u32_t *bits) {
+	size_t n, until;
+
+	ASSERT_AUDIO_LOCKED();
+
+	decode_fifo_update_bits();
+
+	/* wptr is published by the decoder without the lock, the samples
+	 * must not be read before it
+	 */
+	n = decode_fifo_distance(pos, decode_audio->fifo.wptr);
+	fifo_barrier();
+
+	if (n > decode_audio->fifo.size - pos) {
+		n = decode_audio->fifo.size - pos;
+	}
+
+	*bits = decode_audio->fifo_bits;
+	if (decode_audio->fifo_bits_pending) {
+		until = decode_fifo_distance(pos, decode_audio->fifo_bits_ptr);
+
+		if (decode_fifo_distance(decode_audio->fifo.rptr, pos) >= decode_fifo_distance(decode_audio->fifo.rptr, decode_audio->fifo_bits_ptr)) {
+			*bits = decode_audio->fifo_next_bits;
+		}
+		else if (until < n) {
+			n = until;
+		}
+	}
+
+	return n - (n % FIFO_FRAME_BYTES(*bits));
+}
+
+
+/* Release frames read at rptr. Call with the fifo locked. */
+void decode_fifo_consume(size_t frames, u32_t bits) {
+	ASSERT_AUDIO_LOCKED();
+
+	fifo_spsc_rptr_incby(&decode_audio->fifo, frames * FIFO_FRAME_BYTES(bits));
+	decode_audio->elapsed_samples += frames;
+
+	decode_fifo_update_bits();
+}
+
+
+void decode_fade_save(struct decode_fade *fade) {
+	ASSERT_AUDIO_LOCKED();
+
+	fade->samples_until_fade = decode_audio->samples_until_fade;
+	fade->transition_gain = decode_audio->transition_gain;
+	fade->transition_gain_step = decode_audio->transition_gain_step;
+	fade->transition_sample_step = decode_audio->transition_sample_step;
+	fade->transition_samples_in_step = decode_audio->transition_samples_in_step;
+}
+
+
+/* Release the chunks converted by the output while the fifo was unlocked.
+ * If the decoder reset the fifo meanwhile (generation changed) the chunks
+ * are stale: nothing is released, the fade state goes back to before the
+ * chunks were planned, unless the decoder has changed it too, and FALSE
+ * is returned so the output plays silence instead. Call with the fifo
+ * locked.
+ */
+bool_t decode_fifo_commit(struct decode_chunk *chunks, int num_chunks, u32_t generation, struct decode_fade *before, struct decode_fade *after) {
+	struct decode_fade now;
+	int i;
+
+	ASSERT_AUDIO_LOCKED();
+
+	if (generation == decode_audio->fifo_generation) {
+		for (i = 0; i < num_chunks; i++) {
+			if (chunks[i].frames * FIFO_FRAME_BYTES(chunks[i].decode_bits) > fifo_bytes_used(&decode_audio->fifo)) {
+				break;
+			}
+
+			decode_fifo_consume(chunks[i].frames, chunks[i].decode_bits);
+		}
+
+		return TRUE;
+	}
+
+	decode_fade_save(&now);
+	if (memcmp(&now, after, sizeof(now)) == 0) {
+		decode_audio->samples_until_fade = before->samples_until_fade;
+		decode_audio->transition_gain = before->transition_gain;
+		decode_audio->transition_gain_step = before->transition_gain_step;
+		decode_audio->transition_sample_step = before->transition_sample_step;
+		decode_audio->transition_samples_in_step = before->transition_samples_in_step;
+	}
+
+	return FALSE;
+}
+
+
+/* Copy frames sent to the output into the visualizer tap. delay is the
+ * number of frames the device will play before the first of them. Only
+ * called from the output thread, the fifo does not need to be locked.
+ */
+void decode_tap_write(u8_t *src, size_t frames, u32_t bits, u32_t delay, u32_t sample_rate) {
+	u32_t wptr, now;
+
+	wptr = decode_audio->tap_wptr;
+	now = jive_jiffies();
+
+	while (frames) {
+		s16_t *dst;
+		size_t n, pos, i;
+
+		pos = wptr & (DECODE_TAP_FRAMES - 1);
+
+		n = frames;
+		if (n > DECODE_TAP_CHUNK) {
+			n = DECODE_TAP_CHUNK;
+		}
+		if (n > DECODE_TAP_FRAMES - pos) {
+			n = DECODE_TAP_FRAMES - pos;
+		}
+
+		dst = decode_audio->tap_buf + (pos * 2);
+		if (bits == 32) {
+			sample_t *ptr = (sample_t *)(void *)src;
+
+			for (i = 0; i < n * 2; i++) {
+				dst[i] = ptr[i] >> 16;
+			}
+		}
+		else {
+			memcpy(dst, src, n * 2 * sizeof(s16_t));
+		}
+
+		src += n * FIFO_FRAME_BYTES(bits);
+		frames -= n;
+		wptr += n;
+		delay += n;
+
+		/* the samples must be written before they are published */
+		decode_audio->tap_seq++;
+		fifo_barrier();
+
+		decode_audio->tap_wptr = wptr;
+		decode_audio->tap_delay = delay;
+		decode_audio->tap_jiffies = now;
+		decode_audio->tap_sample_rate = sample_rate;
+
+		fifo_barrier();
+		decode_audio->tap_seq++;
+	}
+}
+
+
+/* Copy the frames now being played from the visualizer tap, without
+ * locking the fifo. Returns the number of frames copied, which is less
+ * than asked for when the tap has not been filled yet or is being
+ * overwritten.
+ */
+size_t decode_tap_read(s16_t *buf, size_t frames) {
+	u32_t seq, wptr, delay, jiffies, sample_rate, elapsed, lag, start, pos;
+	size_t n;
+	int tries;
+
+	if (frames > DECODE_TAP_FRAMES - DECODE_TAP_CHUNK) {
+		frames = DECODE_TAP_FRAMES - DECODE_TAP_CHUNK;
+	}
+
+	for (tries = 0; tries < 4; tries++) {
+		seq = decode_audio->tap_seq;
+		fifo_barrier();
+
+		wptr = decode_audio->tap_wptr;
+		delay = decode_audio->tap_delay;
+		jiffies = decode_audio->tap_jiffies;
+		sample_rate = decode_audio->tap_sample_rate;
+
+		fifo_barrier();
+		if ((seq & 1) || seq != decode_audio->tap_seq) {
+			continue;
+		}
+
+		/* frames still queued in the device */
+		elapsed = (u32_t)(((u64_t)(jive_jiffies() - jiffies) * sample_rate) / 1000);
+		lag = (elapsed < delay) ? delay - elapsed : 0;
+
+		/* stay clear of the frames being written */
+		if (lag > DECODE_TAP_FRAMES - DECODE_TAP_CHUNK - frames) {
+			lag = DECODE_TAP_FRAMES - DECODE_TAP_CHUNK - frames;
+		}
+
+		if (wptr < lag + frames) {
+			if (wptr <= lag) {
+				return 0;
+			}
+			frames = wptr - lag;
+		}
+
+		start = wptr - lag - frames;
+
+		pos = start & (DECODE_TAP_FRAMES - 1);
+		n = frames;
+		if (n > DECODE_TAP_FRAMES - pos) {
+			n = DECODE_TAP_FRAMES - pos;
+		}
+
+		memcpy(buf, decode_audio->tap_buf + (pos * 2), n * 2 * sizeof(s16_t));
+		if (n < frames) {
+			memcpy(buf + (n * 2), decode_audio->tap_buf, (frames - n) * 2 * sizeof(s16_t));
+		}
+
+		/* check the output did not wrap over the frames while copying */
+		fifo_barrier();
+		if (decode_audio->tap_wptr - start <= DECODE_TAP_FRAMES - DECODE_TAP_CHUNK) {
+			return frames;
+		}
+	}
+
+	return 0;
 }
 
 
@@ -58,13 +322,13 @@ bool_t decode_check_start_point(void) {
 	
 	track_start_offset = decode_audio->fifo.rptr - decode_audio->track_start_point;
 	if (track_start_offset < 0) {
-		track_start_offset += DECODE_FIFO_SIZE;
+		track_start_offset += decode_audio->fifo.size;
 	}
 
 	/* Past the start point */
 	decode_audio->check_start_point = FALSE;
 	decode_audio->num_tracks_started++;
-	decode_audio->elapsed_samples = BYTES_TO_SAMPLES(track_start_offset);
+	decode_audio->elapsed_samples = FIFO_BYTES_TO_FRAMES(track_start_offset);
 	decode_audio->sync_elapsed_timestamp = 0; /* bug 15344: don't send previous-track data */
 
 	return true;
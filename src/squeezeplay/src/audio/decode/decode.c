@@ -18,7 +18,11 @@ extern int luaopen_spprivate(lua_State *L);
 #endif
 
 #define DECODE_MAX_INTERVAL 500
-#define DECODE_WAIT_INTERVAL 100
+
+/* When the output fifo is full, sleep until it has room for this many
+ * decoder buffers so the decoder runs in bursts.
+ */
+#define DECODE_WAKEUP_BUFFERS 4
 
 #define DECODE_MQUEUE_SIZE 512
 
@@ -43,8 +47,13 @@ int decode_watchdog = -1;
 bool_t decode_first_buffer = FALSE;
 
 
+/* decoder heap allocations made while playing */
+u32_t decode_running_reallocs = 0;
+
+
 /* decoder fifo used to store decoded samples */
 u8_t *decode_fifo_buf;
+size_t decode_fifo_capacity = DECODE_FIFO_SIZE;
 
 
 /* decoder mqueue */
@@ -61,6 +70,17 @@ static u8_t *wma_guid;
 
 static bool_t trigger_resume = FALSE;
 
+/* resampler settings, applied at the next track start */
+static u32_t resample_rate = 0;
+static int resample_quality = -1;
+static bool_t resample_changed = FALSE;
+
+/* decoder thread wakeups, by cause */
+static u32_t wakeups_timer = 0;
+static u32_t wakeups_stream = 0;
+static u32_t wakeups_message = 0;
+static u32_t wakeups_idle = 0;
+
 
 /* audio instance */
 struct decode_audio *decode_audio;
@@ -172,6 +192,9 @@ static void decode_pause_audio_handler(void) {
 
 static void decode_skip_ahead_handler(void) {
 	Uint32 interval;
+	u32_t skip_frames, seek_frames = 0, played_frames = 0;
+	size_t fifo_frames, now_frames;
+	bool_t can_seek;
 
 	interval = mqueue_read_u32(&decode_mqueue);
 	mqueue_read_complete(&decode_mqueue);
@@ -180,12 +203,58 @@ static void decode_skip_ahead_handler(void) {
 
 	decode_audio_lock();
 
-	decode_audio->skip_ahead_bytes = SAMPLES_TO_BYTES((u32_t)((interval * decode_audio->track_sample_rate) / 1000));
+	skip_frames = (u32_t)((interval * decode_audio->track_sample_rate) / 1000);
+	fifo_frames = decode_fifo_frames_used();
+	can_seek = !decode_audio->check_start_point;
+
+	decode_audio_unlock();
+
+	/* Skip the frames past the end of the decode fifo in the compressed
+	 * stream, if the decoder is still on the playing track and can seek.
+	 * The output discards the rest. Seeking can take a while, so it is
+	 * done without the audio lock held.
+	 */
+	if (decoder && decoder->seek && can_seek && !decode_resample_active()) {
+		if (skip_frames > fifo_frames) {
+			seek_frames = decoder->seek(decoder_data, skip_frames - fifo_frames);
+
+			LOG_DEBUG(log_audio_decode, "decoder skipped %d of %d frames", seek_frames, (int)(skip_frames - fifo_frames));
+		}
+	}
+
+	decode_audio_lock();
+
+	/* only the output uses the fifo while the decoder seeks, the frames
+	 * it played since are part of the skip
+	 */
+	now_frames = decode_fifo_frames_used();
+	if (now_frames < fifo_frames) {
+		played_frames = (u32_t)(fifo_frames - now_frames);
+	}
+
+	if (skip_frames > seek_frames + played_frames) {
+		decode_audio->skip_ahead_frames = skip_frames - seek_frames - played_frames;
+	}
+	else {
+		decode_audio->skip_ahead_frames = 0;
+	}
+	decode_audio->elapsed_samples += seek_frames;
 
 	decode_audio_unlock();
 }
 
 
+static void decode_resample_handler(void) {
+	resample_rate = mqueue_read_u32(&decode_mqueue);
+	resample_quality = (int)mqueue_read_u32(&decode_mqueue);
+	mqueue_read_complete(&decode_mqueue);
+
+	LOG_DEBUG(log_audio_decode, "decode_resample_handler rate=%d quality=%d", resample_rate, resample_quality);
+
+	resample_changed = TRUE;
+}
+
+
 static void decode_stop_handler(void) {
 	mqueue_read_complete(&decode_mqueue);
 
@@ -202,6 +271,7 @@ static void decode_stop_handler(void) {
 		decoder = NULL;
 		decoder_data = NULL;
 	}
+	streambuf_release();
 
 	decode_audio->num_tracks_started = 0;
 	decode_first_buffer = FALSE;
@@ -226,6 +296,7 @@ static void decode_flush_handler(void) {
 		decoder = NULL;
 		decoder_data = NULL;
 	}
+	streambuf_release();
 
 	decode_first_buffer = FALSE;
 	decode_output_flush();
@@ -263,6 +334,7 @@ static void decode_start_handler(void) {
 		decoder = NULL;
 		decoder_data = NULL;
 	}
+	streambuf_release();
 
 	for (i=0; i<(sizeof(all_decoders)/sizeof(struct decode_module *)); i++) {
 		if (all_decoders[i]->id == decoder_id) {
@@ -281,10 +353,22 @@ static void decode_start_handler(void) {
 	decode_first_buffer = TRUE;
 	decode_output_set_transition(transition_type, transition_period);
 	decode_output_set_track_gain(replay_gain);
+	decode_output_set_track_bits(32);
 	decode_set_track_polarity_inversion(polarity_inversion);
 	decode_set_output_channels(output_channels);
 
+	/* the output rate only changes at a track boundary */
+	if (resample_changed) {
+		if (!decode_resample_set(resample_rate, resample_quality)) {
+			LOG_ERROR(log_audio_decode, "resampler init failed, rate=%d quality=%d", resample_rate, resample_quality);
+		}
+		resample_changed = FALSE;
+	}
+
 	decoder_data = decoder->start(params, num_params);
+	if (decoder_data) {
+		decode_resample_prepare(decoder->samples(decoder_data));
+	}
 
 	decode_audio_lock();
 	decode_audio->output_threshold = output_threshold;
@@ -335,10 +419,25 @@ static void decode_song_ended_handler(void) {
 }
 
 
+static void decode_wakeup_handler(void) {
+	mqueue_read_complete(&decode_mqueue);
+}
+
+
+/* Called from the streaming threads when data the decoder is waiting for
+ * has arrived.
+ */
+void decode_wakeup(void) {
+	if (mqueue_write_request(&decode_mqueue, decode_wakeup_handler, 0)) {
+		mqueue_write_complete(&decode_mqueue);
+	}
+}
+
+
 /* returns true if decode can run */
 static bool_t decode_timer_interval(u32_t *delay) {
-	size_t free_bytes, used_bytes, max_samples;
-	u32_t state, sample_rate;
+	size_t free_bytes, fifo_size, frame_bytes, max_bytes, wakeup_bytes, max_samples;
+	u32_t sample_rate;
 
 	if (!decoder || (current_decoder_state & (DECODE_STATE_RUNNING|DECODE_STATE_ERROR)) != DECODE_STATE_RUNNING) {
 		*delay = DECODE_MAX_INTERVAL;
@@ -346,37 +445,54 @@ static bool_t decode_timer_interval(u32_t *delay) {
 		return false;
 	}
 
-	/* Small delay if the stream empty but still streaming? */
-	/* special case for flac as it has a minimum number of bytes before the decoder processes anything */
-	if (streambuf_would_wait_for(decoder == &decode_flac ? DECODE_MINIMUM_BYTES_FLAC : DECODE_MINIMUM_BYTES_OTHER)) {
-		*delay = DECODE_WAIT_INTERVAL;
-		
+	/* Wait for data if the stream empty but still streaming, the streambuf
+	 * wakes us when it arrives. Special case for flac as it has a minimum
+	 * number of bytes before the decoder processes anything.
+	 */
+	if (streambuf_wait_for(decoder == &decode_flac ? DECODE_MINIMUM_BYTES_FLAC : DECODE_MINIMUM_BYTES_OTHER)) {
+		*delay = DECODE_MAX_INTERVAL;
+
 		return false;
 	}
 
 	/* Variable delay based on output buffer fullness */
 	max_samples = decoder->samples(decoder_data);
 
+	/* resampling can produce more frames than were decoded */
+	max_samples = decode_resample_max_frames(max_samples, decode_first_buffer);
+
 	decode_audio_lock();
-	state = decode_audio->state;
 	sample_rate = decode_audio->track_sample_rate;
+	frame_bytes = FIFO_FRAME_BYTES(decode_audio->fifo_bits);
+	fifo_size = decode_audio->fifo.size;
 	free_bytes = fifo_bytes_free(&decode_audio->fifo);
-	used_bytes = fifo_bytes_used(&decode_audio->fifo);
 	decode_audio_unlock();
 
-	if (SAMPLES_TO_BYTES(max_samples) < free_bytes) {
+	max_bytes = SAMPLES_TO_BYTES(max_samples);
+	if (max_bytes < free_bytes) {
 		*delay = 0;
 
 		return true;
 	}
-	else {
-		*delay = ((max_samples * 1000) / sample_rate) + 1; /* ms */
 
-		/* don't decode for every buffer, do it every other one */
-		*delay *= 2;
+	if (!sample_rate) {
+		*delay = DECODE_MAX_INTERVAL;
 
 		return false;
 	}
+
+	/* Sleep until the output has played down to the low water mark */
+	wakeup_bytes = max_bytes * DECODE_WAKEUP_BUFFERS;
+	if (wakeup_bytes >= fifo_size) {
+		wakeup_bytes = max_bytes + 1;
+	}
+
+	*delay = (u32_t)((((u64_t)(wakeup_bytes - free_bytes) / frame_bytes) * 1000) / sample_rate) + 1; /* ms */
+	if (*delay > DECODE_MAX_INTERVAL) {
+		*delay = DECODE_MAX_INTERVAL;
+	}
+
+	return false;
 }
 
 
@@ -407,11 +523,28 @@ static int decode_thread_execute(void *unused) {
 			// for debugging race conditions
 			//sleep(2);
 
+			if (handler == decode_wakeup_handler) {
+				wakeups_stream++;
+			}
+			else {
+				wakeups_message++;
+			}
+
 			handler();
 
 			can_decode = decode_timer_interval(&delay);
 		}
 
+		if (delay) {
+			/* timed out, see if there is any work now */
+			wakeups_timer++;
+
+			can_decode = decode_timer_interval(&delay);
+			if (!can_decode) {
+				wakeups_idle++;
+			}
+		}
+
 		if (can_decode && decoder
 		    && (current_decoder_state & DECODE_STATE_RUNNING)) {
 			decoder->callback(decoder_data);
@@ -656,6 +789,33 @@ static int decode_skip_ahead(lua_State *L) {
 }
 
 
+static int decode_set_resample(lua_State *L) {
+	Uint32 rate;
+	int quality;
+
+	/* stack is:
+	 * 1: self
+	 * 2: output rate, 0 to disable
+	 * 3: quality (optional)
+	 */
+
+	rate = (Uint32) luaL_optinteger(L, 2, 0);
+	quality = luaL_optinteger(L, 3, -1);
+	LOG_DEBUG(log_audio_decode, "decode_set_resample rate=%d quality=%d", rate, quality);
+
+	if (mqueue_write_request(&decode_mqueue, decode_resample_handler, 2 * sizeof(Uint32))) {
+		mqueue_write_u32(&decode_mqueue, rate);
+		mqueue_write_u32(&decode_mqueue, (Uint32) quality);
+		mqueue_write_complete(&decode_mqueue);
+	}
+	else {
+		LOG_DEBUG(log_audio_decode, "Full message queue, dropped resample message");
+	}
+
+	return 0;
+}
+
+
 static int decode_stop(lua_State *L) {
 	/* stack is:
 	 * 1: self
@@ -805,8 +965,8 @@ static int decode_status(lua_State *L) {
 	lua_setfield(L, -2, "outputSize");
 
 	if (decode_audio->track_sample_rate) {
-		output = fifo_bytes_used(&decode_audio->fifo);
-		output = (BYTES_TO_SAMPLES(output) * 1000) / decode_audio->track_sample_rate;
+		output = decode_fifo_frames_used();
+		output = (output * 1000) / decode_audio->track_sample_rate;
 	}
 	else {
 		output = 0;
@@ -856,6 +1016,29 @@ static int decode_status(lua_State *L) {
 	lua_pushinteger(L, decode_audio->state);
 	lua_setfield(L, -2, "audioState");
 
+	/* sample rate switches, with the last and worst gap in us */
+	lua_pushinteger(L, decode_audio->rate_switch_count);
+	lua_setfield(L, -2, "rateSwitches");
+
+	lua_pushinteger(L, decode_audio->rate_switch_us);
+	lua_setfield(L, -2, "rateSwitchLatency");
+
+	lua_pushinteger(L, decode_audio->rate_switch_max_us);
+	lua_setfield(L, -2, "rateSwitchMaxLatency");
+
+	/* decoder thread wakeups, idle wakeups are timeouts with no work */
+	lua_pushinteger(L, wakeups_timer);
+	lua_setfield(L, -2, "wakeupsTimer");
+
+	lua_pushinteger(L, wakeups_stream);
+	lua_setfield(L, -2, "wakeupsStream");
+
+	lua_pushinteger(L, wakeups_message);
+	lua_setfield(L, -2, "wakeupsMessage");
+
+	lua_pushinteger(L, wakeups_idle);
+	lua_setfield(L, -2, "wakeupsIdle");
+
 	// Allow a decoder to trigger audio to resume. This is
 	// needed to resume Spotify after rebuffering earlier than
 	// the server would normally resume
@@ -885,9 +1068,26 @@ static int decode_status(lua_State *L) {
 	lua_pushinteger(L, current_decoder_state);
 	lua_setfield(L, -2, "decodeState");
 
+	/* decode_realloc calls while playing, not all heap allocations */
+	lua_pushinteger(L, decode_running_reallocs);
+	lua_setfield(L, -2, "decodeReallocs");
+
 	return 1;
 }
 
+void *decode_realloc(void *ptr, size_t size) {
+	if (!decode_first_buffer && (current_decoder_state & DECODE_STATE_RUNNING)) {
+		decode_running_reallocs++;
+
+		LOG_WARN(log_audio_codec, "decoder allocated %d bytes while playing", (int)size);
+#ifdef DECODE_REALLOC_CHECK
+		assert(0);
+#endif
+	}
+
+	return realloc(ptr, size);
+}
+
 void decode_set_trigger_resume(void) {
 	decode_audio_lock();
 	trigger_resume = TRUE;
@@ -1030,6 +1230,45 @@ static int decode_audio_open(lua_State *L) {
 		return 2;
 	}
 
+	/* read the stream socket using a native thread */
+	lua_getfield(L, 2, "streamReaderThread");
+	streambuf_set_reader_thread(lua_toboolean(L, -1));
+	lua_pop(L, 1);
+
+	/* buffer sizes */
+	lua_getfield(L, 2, "streamBufferSize");
+	if (!lua_isnil(L, -1)) {
+		/* the decoder thread is not running yet */
+		streambuf_set_size(lua_tointeger(L, -1));
+		streambuf_flush();
+		streambuf_release();
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "outputBufferSize");
+	decode_fifo_capacity = lua_isnil(L, -1) ? DECODE_FIFO_SIZE : (size_t) lua_tointeger(L, -1);
+	if (decode_fifo_capacity < DECODE_FIFO_MIN_SIZE) {
+		decode_fifo_capacity = DECODE_FIFO_MIN_SIZE;
+	}
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	{
+		/* with alsa the fifo is locked in memory, keep it to a
+		 * sixteenth of the ram on small players
+		 */
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long page_size = sysconf(_SC_PAGESIZE);
+		size_t limit = (size_t) (pages / 16) * page_size;
+
+		if (pages > 0 && page_size > 0
+		    && limit >= DECODE_FIFO_MIN_SIZE && decode_fifo_capacity > limit) {
+			decode_fifo_capacity = limit;
+			LOG_WARN(log_audio_decode, "outputBufferSize limited to %d bytes", (int) decode_fifo_capacity);
+		}
+	}
+#endif
+	decode_fifo_capacity = SAMPLES_TO_BYTES(BYTES_TO_SAMPLES(decode_fifo_capacity));
+	lua_pop(L, 1);
+
 	/* audio initialization */
 	if (!f->init(L)) {
 		/* audio init failed */
@@ -1041,6 +1280,10 @@ static int decode_audio_open(lua_State *L) {
 	assert(decode_audio);
 	assert(decode_fifo_buf);
 
+	lua_getfield(L, 2, "outputBufferTime");
+	decode_audio->fifo_time = lua_isnil(L, -1) ? DECODE_FIFO_TIME : lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
 	decode_audio->f = f;
 
 	/* start decoder thread */
@@ -1061,6 +1304,7 @@ static const struct luaL_Reg decode_f[] = {
 	{ "resumeAudio", decode_resume_audio },
 	{ "pauseAudio", decode_pause_audio },
 	{ "skipAhead", decode_skip_ahead },
+	{ "resample", decode_set_resample },
 	{ "stop", decode_stop },
 	{ "flush", decode_flush },
 	{ "start", decode_start },
@@ -32,6 +32,10 @@ struct decode_alac {
 	/* stream info */
 	int sample_rate;
 	int num_channels;
+	u32_t frame_length;
+
+	/* packets read from the mp4 track */
+	u32_t packets;
 
 	/* buffers */
 	sample_t *output_buffer;
@@ -85,6 +89,9 @@ static bool_t decode_alac_callback(void *data) {
 		self->sample_rate = self->alacdec.samplerate;
 		self->num_channels = self->alacdec.channels;
 
+		/* samples per packet, all but the last packet are full */
+		self->frame_length = (conf[40] << 24) | (conf[41] << 16) | (conf[42] << 8) | conf[43];
+
 		LOG_INFO(log_audio_codec, "sample_rate=%d channels=%d", self->sample_rate, self->num_channels);
 		self->init = TRUE;
 	}
@@ -100,6 +107,8 @@ static bool_t decode_alac_callback(void *data) {
 		}
 	}
 
+	self->packets++;
+
 	outputsize = OUTPUT_BUFFER_SIZE;
 	if (self->alacdec.sample_fmt == SAMPLE_FMT_S16) outputsize /= 2;
 
@@ -132,6 +141,8 @@ static bool_t decode_alac_callback(void *data) {
 
 	switch (self->alacdec.sample_fmt) {
 	case SAMPLE_FMT_S16:
+		decode_output_set_track_bits(16);
+
 		if (self->num_channels == 1) {
 			/* mono */
 			s16_t *rptr = ((s16_t *)(void *)self->output_buffer) + (frames * 1);
@@ -221,6 +232,25 @@ static size_t decode_alac_samples(void *data) {
 }
 
 
+static u32_t decode_alac_seek(void *data, u32_t frames) {
+	struct decode_alac *self = (struct decode_alac *) data;
+	u32_t packets;
+
+	if (!self->init || !self->frame_length) {
+		return 0;
+	}
+
+	packets = frames / self->frame_length;
+	if (!packets || !mp4_seek(&self->mp4, 0, self->packets + packets)) {
+		return 0;
+	}
+
+	self->packets += packets;
+
+	return packets * self->frame_length;
+}
+
+
 // FIXME alac does not work fully yet, see Bug 12421
 struct decode_module decode_alac = {
 	'l',
@@ -229,4 +259,5 @@ struct decode_module decode_alac = {
 	decode_alac_stop,
 	decode_alac_samples,
 	decode_alac_callback,
+	decode_alac_seek,
 };
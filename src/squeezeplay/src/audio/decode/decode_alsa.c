@@ -204,7 +204,7 @@ static int decode_alsa_init(lua_State *L) {
 		shmctl(shmid, IPC_RMID, NULL);
 	}
 
-	shmid = shmget(56833, DECODE_AUDIO_BUFFER_SIZE, 0600 | IPC_CREAT);
+	shmid = shmget(56833, DECODE_AUDIO_BUFFER_SIZE(decode_fifo_capacity), 0600 | IPC_CREAT);
 	if (shmid == -1) {
 		// XXXX errors
 		LOG_ERROR(log_audio_codec, "shmget error %s", strerror(errno));
@@ -218,7 +218,7 @@ static int decode_alsa_init(lua_State *L) {
 		return 0;
 	}
 
-	decode_init_buffers(buf, true);
+	decode_init_buffers(buf, decode_fifo_capacity, true);
 
 
 	/* start threads */
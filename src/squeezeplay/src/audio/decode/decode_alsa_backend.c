@@ -16,6 +16,7 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
 
 
 #ifdef HAVE_LIBASOUND
@@ -126,6 +127,23 @@ struct decode_alsa {
 	/* playback state */
 	u32_t pcm_sample_rate;
 
+	/* hw params for the next track's sample rate, prepared before the
+	 * track start point is reached.
+	 */
+	snd_pcm_hw_params_t *next_hw_params;
+	u32_t next_sample_rate;
+	snd_pcm_format_t next_format;
+	unsigned int next_period_count;
+
+	/* time the last rate switch drained the pcm, valid until the pcm
+	 * is restarted.
+	 */
+	struct timeval switch_tstamp;
+	bool_t switch_pending;
+
+	/* frames queued in the pcm ahead of the buffer being filled */
+	u32_t tap_delay;
+
 	/* capture buffer */
 	void *cbuf;
 	ssize_t cbuf_size;
@@ -262,23 +280,67 @@ static void decode_alsa_copyright(struct decode_alsa *state,
 }
 
 
+/*
+ * Convert a chunk of the decode fifo to the alsa format. Called without
+ * the fifo-lock, the chunk is not released until this is done.
+ */
+static void playback_convert(struct decode_alsa *state, struct decode_chunk *chunk) {
+	if (chunk->decode_bits == 32) {
+		sample_t *decode_ptr = (sample_t *)(void *)chunk->decode_ptr;
+
+		if (PCM_SAMPLE_WIDTH() == 24) {
+			if (state->format == SND_PCM_FORMAT_S24_LE) {
+				sample_convert.s24(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+			} else {
+				sample_convert.s24_3(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+			}
+		}
+		else {
+			sample_convert.s16(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+		}
+	}
+	else {
+		s16_t *decode_ptr = (s16_t *)(void *)chunk->decode_ptr;
+
+		if (PCM_SAMPLE_WIDTH() == 24) {
+			if (state->format == SND_PCM_FORMAT_S24_LE) {
+				sample_convert.packed_s24(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+			} else {
+				sample_convert.packed_s24_3(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+			}
+		}
+		else {
+			sample_convert.packed_s16(chunk->output_ptr, decode_ptr, chunk->frames, chunk->lgain, chunk->rgain);
+		}
+	}
+}
+
+
 /*
  * This function is called by to copy samples from the output buffer to
- * the alsa buffer.
+ * the alsa buffer. It fills output_buf with up to output_frames frames,
+ * and returns the number of frames to commit. This is less than
+ * output_frames when the playback stops at a track that needs a
+ * different sample rate.
  *
- * Called with fifo-lock held.
+ * Called with fifo-lock held, the lock is released while the samples are
+ * converted.
  */
-static void playback_callback(struct decode_alsa *state,
-			      void *output_buf,
-			      size_t output_frames) {
-	size_t decode_frames, skip_frames = 0;
+static size_t playback_callback(struct decode_alsa *state,
+				void *output_buf,
+				size_t output_frames) {
+	size_t decode_frames, skip_frames = 0, total_frames = output_frames;
 	int add_silence_ms;
-	bool_t reached_start_point;
+	bool_t reached_start_point, rate_boundary = FALSE;
 	u8_t *output_buffer = (u8_t *)output_buf;
+	struct decode_chunk chunks[DECODE_MAX_CHUNKS];
+	struct decode_fade fade_before, fade_after;
+	int i, num_chunks = 0;
+	size_t rptr;
 
 	ASSERT_AUDIO_LOCKED();
 
-	decode_frames = BYTES_TO_SAMPLES(fifo_bytes_used(&decode_audio->fifo));
+	decode_frames = decode_fifo_frames_used();
 
 	/* Should we start the audio now based on having enough decoded data? */
 	if (decode_audio->state & DECODE_STATE_AUTOSTART
@@ -300,7 +362,7 @@ static void playback_callback(struct decode_alsa *state,
 	if (!(decode_audio->state & DECODE_STATE_RUNNING)) {
 		memset(output_buffer, 0, PCM_FRAMES_TO_BYTES(output_frames));
 
-		return;
+		return total_frames;
 	}
 
 	add_silence_ms = decode_audio->add_silence_ms;
@@ -322,15 +384,35 @@ static void playback_callback(struct decode_alsa *state,
 		decode_audio->add_silence_ms = add_silence_ms;
 
 		if (!output_frames) {
-			return;
+			return total_frames;
+		}
+	}
+
+	/* Stop at the start of a track with a different sample rate, so
+	 * the pcm can be switched exactly at the boundary. The frames before
+	 * the start point are in the current fifo format.
+	 */
+	if (decode_audio->check_start_point && decode_audio->track_sample_rate != state->pcm_sample_rate) {
+		size_t start_frames;
+
+		start_frames = decode_fifo_distance(decode_audio->fifo.rptr, decode_audio->track_start_point) / FIFO_FRAME_BYTES(decode_audio->fifo_bits);
+
+		if (decode_frames > start_frames) {
+			decode_frames = start_frames;
+			rate_boundary = TRUE;
+
+			if (start_frames < output_frames) {
+				total_frames -= output_frames - start_frames;
+				output_frames = start_frames;
+			}
 		}
 	}
 
 	/* only skip if it will not cause an underrun */
-	if (decode_frames >= output_frames && decode_audio->skip_ahead_bytes > 0) {
+	if (decode_frames >= output_frames && decode_audio->skip_ahead_frames > 0) {
 		skip_frames = decode_frames - output_frames;
-		if (skip_frames > BYTES_TO_SAMPLES(decode_audio->skip_ahead_bytes)) {
-			skip_frames = BYTES_TO_SAMPLES(decode_audio->skip_ahead_bytes);
+		if (skip_frames > decode_audio->skip_ahead_frames) {
+			skip_frames = decode_audio->skip_ahead_frames;
 		}
 	}
 
@@ -353,40 +435,51 @@ static void playback_callback(struct decode_alsa *state,
 	}
 	
 	if (skip_frames) {
-		size_t wrap_frames;
-
 		LOG_DEBUG("Skipping %d frames", (int)skip_frames);
-		
-		wrap_frames = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
+	}
+
+	while (skip_frames) {
+		size_t run_frames;
+		u32_t bits;
 
-		if (wrap_frames < skip_frames) {
-			fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(wrap_frames));
-			decode_audio->skip_ahead_bytes -= SAMPLES_TO_BYTES(wrap_frames);
-			decode_audio->elapsed_samples += wrap_frames;
-			skip_frames -= wrap_frames;
+		run_frames = decode_fifo_run(decode_audio->fifo.rptr, &bits) / FIFO_FRAME_BYTES(bits);
+		if (!run_frames) {
+			break;
+		}
+		if (run_frames > skip_frames) {
+			run_frames = skip_frames;
 		}
 
-		fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(skip_frames));
-		decode_audio->skip_ahead_bytes -= SAMPLES_TO_BYTES(skip_frames);
-		decode_audio->elapsed_samples += skip_frames;
+		decode_fifo_consume(run_frames, bits);
+		decode_audio->skip_ahead_frames -= run_frames;
+		skip_frames -= run_frames;
 	}
 
-	while (decode_frames) {
-		size_t wrap_frames, frames_write, frames_cnt;
+	/* Work out the gains with the fifo locked, but convert the samples
+	 * without it so the decoder is never held up by the output. A chunk
+	 * ends where the fifo wraps or changes format.
+	 */
+	rptr = decode_audio->fifo.rptr;
+	decode_fade_save(&fade_before);
+
+	while (decode_frames && num_chunks < DECODE_MAX_CHUNKS) {
+		size_t run_frames, frames_write;
 		s32_t lgain, rgain;
+		u32_t bits;
 		
 		lgain = decode_audio->lgain;
 		rgain = decode_audio->rgain;
 
-		wrap_frames = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
+		run_frames = decode_fifo_run(rptr, &bits) / FIFO_FRAME_BYTES(bits);
+		if (!run_frames) {
+			break;
+		}
 
 		frames_write = decode_frames;
-		if (wrap_frames < frames_write) {
-			frames_write = wrap_frames;
+		if (run_frames < frames_write) {
+			frames_write = run_frames;
 		}
 
-		frames_cnt = frames_write;
-		
 		/* Handle fading and delayed fading */
 		if (decode_audio->samples_to_fade) {
 			if (decode_audio->samples_until_fade > frames_write) {
@@ -426,55 +519,73 @@ static void playback_callback(struct decode_alsa *state,
 			}
 		}
 
-		if (PCM_SAMPLE_WIDTH() == 24) {
-			if (state->format == SND_PCM_FORMAT_S24_LE) {
-				/* handle SND_PCM_FORMAT_S24_LE case */
-				sample_t *decode_ptr;
-				Sint32 *output_ptr;
-				
-				output_ptr = (Sint32 *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-				while (frames_cnt--) {
-					*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 8;
-					*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 8;
-				}
-			} else {
-				/* handle SND_PCM_FORMAT_S24_3LE case */
-				sample_t *decode_ptr;
-				u8_t *output_ptr;
-				
-				output_ptr = (u8_t *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-				while (frames_cnt--) {
-					sample_t lsample = fixed_mul(lgain, *(decode_ptr++));
-					sample_t rsample = fixed_mul(rgain, *(decode_ptr++));
-					*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
-					*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
-					*(output_ptr++) = (lsample & 0xff000000) >> 24;
-					*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
-					*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
-					*(output_ptr++) = (rsample & 0xff000000) >> 24;
-				}
+		chunks[num_chunks].decode_ptr = decode_fifo_buf + rptr;
+		chunks[num_chunks].decode_bits = bits;
+		chunks[num_chunks].output_ptr = output_buffer;
+		chunks[num_chunks].frames = frames_write;
+		chunks[num_chunks].lgain = lgain;
+		chunks[num_chunks].rgain = rgain;
+		num_chunks++;
+
+		rptr += frames_write * FIFO_FRAME_BYTES(bits);
+		if (rptr == decode_audio->fifo.size) {
+			rptr = 0;
+		}
+
+		output_buffer += PCM_FRAMES_TO_BYTES(frames_write);
+		decode_frames -= frames_write;
+	}
+
+	/* the chunks ran out before the period was filled, play silence for
+	 * the rest of it
+	 */
+	if (decode_frames) {
+		memset(output_buffer, 0, PCM_FRAMES_TO_BYTES(decode_frames));
+
+		if ((decode_audio->state & DECODE_STATE_UNDERRUN) == 0) {
+			LOG_ERROR("Audio underrun: %ld frames not converted, requested %ld frames. elapsed samples %ld", decode_frames, output_frames, decode_audio->elapsed_samples);
+		}
+
+		decode_audio->state |= DECODE_STATE_UNDERRUN;
+	}
+
+	if (num_chunks) {
+		u32_t generation = decode_audio->fifo_generation;
+
+		decode_fade_save(&fade_after);
+		decode_audio_unlock();
+
+		for (i = 0; i < num_chunks; i++) {
+			playback_convert(state, &chunks[i]);
+		}
+
+		/* the visualizer can do without the stale samples too */
+		fifo_barrier();
+		if (generation == decode_audio->fifo_generation) {
+			for (i = 0; i < num_chunks; i++) {
+				decode_tap_write(chunks[i].decode_ptr, chunks[i].frames, chunks[i].decode_bits,
+					state->tap_delay + PCM_BYTES_TO_FRAMES(chunks[i].output_ptr - (u8_t *)output_buf),
+					state->pcm_sample_rate);
 			}
 		}
-		else {
-			/* handle SND_PCM_FORMAT_S16_LE case */
-			sample_t *decode_ptr;
-			Sint16 *output_ptr;
-
-			output_ptr = (Sint16 *)(void *)output_buffer;
-			decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-			while (frames_cnt--) {
-				*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 16;
-				*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 16;
+
+		decode_audio_lock();
+
+		/* the decoder may have reset the fifo while it was unlocked,
+		 * the converted samples are stale so play silence
+		 */
+		if (!decode_fifo_commit(chunks, num_chunks, generation, &fade_before, &fade_after)) {
+			for (i = 0; i < num_chunks; i++) {
+				memset(chunks[i].output_ptr, 0, PCM_FRAMES_TO_BYTES(chunks[i].frames));
 			}
 		}
+	}
 
-		fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(frames_write));
-		decode_audio->elapsed_samples += frames_write;
+	if (rate_boundary && decode_audio->fifo.rptr == decode_audio->track_start_point) {
+		/* switch rate once the frames up to the boundary are played */
+		decode_audio->set_sample_rate = decode_audio->track_sample_rate;
 
-		output_buffer += PCM_FRAMES_TO_BYTES(frames_write);
-		decode_frames -= frames_write;
+		return total_frames;
 	}
 
 	reached_start_point = decode_check_start_point();
@@ -490,6 +601,8 @@ static void playback_callback(struct decode_alsa *state,
 
 		decode_alsa_copyright(state, decode_audio->track_copyright);
 	}
+
+	return total_frames;
 }
 
 
@@ -552,57 +665,49 @@ static int pcm_close(struct decode_alsa *state, snd_pcm_t **pcmp, int mode) {
 }
 
 
-static int _pcm_open(struct decode_alsa *state,
-		     snd_pcm_t **pcmp,
-		     int mode,
-		     const char *device,
-		     snd_pcm_access_t access,
-		     u32_t sample_rate)
+/* Fill in hw_params, and the format and period count they ask for. The
+ * caller commits these to the state once snd_pcm_hw_params succeeds, so
+ * the playing pcm is not changed by preparing the next rate.
+ */
+static int pcm_hw_params_setup(struct decode_alsa *state,
+			       snd_pcm_t *pcm,
+			       snd_pcm_hw_params_t *hw_params,
+			       snd_pcm_access_t access,
+			       u32_t sample_rate,
+			       snd_pcm_format_t *format,
+			       unsigned int *period_count)
 {
 	int err, dir;
 	unsigned int val;
-	snd_pcm_uframes_t size;
-	snd_ctl_elem_id_t *id;
-	snd_pcm_hw_params_t *hw_params;
-
-	/* Close existing pcm (if any) */
-	if (*pcmp) {
-		pcm_close(state, pcmp, mode);
-	}
 
-	/* Open pcm */
-	if ((err = snd_pcm_open(pcmp, device, mode, 0)) < 0) {
-		LOG_ERROR("Playback open error: %s", snd_strerror(err));
-		return err;
-	}
+	*format = state->format;
 
-	hw_params = (snd_pcm_hw_params_t *) alloca(snd_pcm_hw_params_sizeof());
 	memset(hw_params, 0, snd_pcm_hw_params_sizeof());
-	if ((err = snd_pcm_hw_params_any(*pcmp, hw_params)) < 0) {
+	if ((err = snd_pcm_hw_params_any(pcm, hw_params)) < 0) {
 		LOG_ERROR("hwparam init error: %s", snd_strerror(err));
 		return err;
 	}
 
 	/* set hardware resampling */
-	if ((err = snd_pcm_hw_params_set_rate_resample(*pcmp, hw_params, 1)) < 0) {
+	if ((err = snd_pcm_hw_params_set_rate_resample(pcm, hw_params, 1)) < 0) {
 		LOG_ERROR("Resampling setup failed: %s", snd_strerror(err));
 		return err;
 	}
 
 	/* set mmap interleaved access format */
-	if ((err = snd_pcm_hw_params_set_access(*pcmp, hw_params, access)) < 0) {
+	if ((err = snd_pcm_hw_params_set_access(pcm, hw_params, access)) < 0) {
 		LOG_ERROR("Access type not available: %s", snd_strerror(err));
 		return err;
 	}
 
 	/* set the sample format */
-	if ((err = snd_pcm_hw_params_set_format(*pcmp, hw_params, state->format)) < 0) {
+	if ((err = snd_pcm_hw_params_set_format(pcm, hw_params, *format)) < 0) {
 
 		/* for 24bit try S24_LE and S24_3LE */
-		if (state->format == SND_PCM_FORMAT_S24_LE) {
-			state->format = SND_PCM_FORMAT_S24_3LE;
+		if (*format == SND_PCM_FORMAT_S24_LE) {
+			*format = SND_PCM_FORMAT_S24_3LE;
 			LOG_INFO("S24_LE unavailable trying S24_3LE");
-			err = snd_pcm_hw_params_set_format(*pcmp, hw_params, state->format);
+			err = snd_pcm_hw_params_set_format(pcm, hw_params, *format);
 		}
 
 		if (err < 0) {
@@ -612,38 +717,74 @@ static int _pcm_open(struct decode_alsa *state,
 	}
 
 	/* set the channel count */
-	if ((err = snd_pcm_hw_params_set_channels(*pcmp, hw_params, 2)) < 0) {
+	if ((err = snd_pcm_hw_params_set_channels(pcm, hw_params, 2)) < 0) {
 		LOG_ERROR("Channel count not available: %s", snd_strerror(err));
 		return err;
 	}
 
 	/* set the stream rate */
 	val = sample_rate;
-	if ((err = snd_pcm_hw_params_set_rate_near(*pcmp, hw_params, &val, 0)) < 0) {
+	if ((err = snd_pcm_hw_params_set_rate_near(pcm, hw_params, &val, 0)) < 0) {
 		LOG_ERROR("Rate not available: %s", snd_strerror(err));
 		return err;
 	}
 
 	/* set buffer and period times */
 	val = state->period_count;
-	if ((err = snd_pcm_hw_params_set_periods_near(*pcmp, hw_params, &val, 0)) < 0) {
+	if ((err = snd_pcm_hw_params_set_periods_near(pcm, hw_params, &val, 0)) < 0) {
 		LOG_ERROR("Unable to set period size %s", snd_strerror(err));
 		return err;
 	}
-	state->period_count = val;
+	*period_count = val;
 
 	val = state->buffer_time;
 	dir = 1;
-	if ((err = snd_pcm_hw_params_set_buffer_time_near(*pcmp, hw_params, &val, &dir)) < 0) {
+	if ((err = snd_pcm_hw_params_set_buffer_time_near(pcm, hw_params, &val, &dir)) < 0) {
 		LOG_ERROR("Unable to set  buffer time %s", snd_strerror(err));
 		return err;
 	}
 
+	return 0;
+}
+
+
+static int _pcm_open(struct decode_alsa *state,
+		     snd_pcm_t **pcmp,
+		     int mode,
+		     const char *device,
+		     snd_pcm_access_t access,
+		     u32_t sample_rate)
+{
+	int err;
+	snd_pcm_uframes_t size;
+	snd_ctl_elem_id_t *id;
+	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_format_t format;
+	unsigned int period_count;
+
+	/* Close existing pcm (if any) */
+	if (*pcmp) {
+		pcm_close(state, pcmp, mode);
+	}
+
+	/* Open pcm */
+	if ((err = snd_pcm_open(pcmp, device, mode, 0)) < 0) {
+		LOG_ERROR("Playback open error: %s", snd_strerror(err));
+		return err;
+	}
+
+	hw_params = (snd_pcm_hw_params_t *) alloca(snd_pcm_hw_params_sizeof());
+	if ((err = pcm_hw_params_setup(state, *pcmp, hw_params, access, sample_rate, &format, &period_count)) < 0) {
+		return err;
+	}
+
 	/* set hardware parameters */
 	if ((err = snd_pcm_hw_params(*pcmp, hw_params)) < 0) {
 		LOG_ERROR("Unable to set hw params: %s", snd_strerror(err));
 		return err;
 	}
+	state->format = format;
+	state->period_count = period_count;
 
 	if ((err = snd_pcm_hw_params_get_period_size(hw_params, &size, 0)) < 0) {
 		LOG_ERROR("Unable to get period size: %s", snd_strerror(err));
@@ -725,6 +866,7 @@ static int pcm_open(struct decode_alsa *state, bool_t loopback, int mode)
 		}
 
 		state->pcm_sample_rate = sample_rate;
+		state->next_sample_rate = 0;
 	}
 	else {
 		err = _pcm_open(state,
@@ -743,6 +885,80 @@ static int pcm_open(struct decode_alsa *state, bool_t loopback, int mode)
 }
 
 
+/* Prepare the hw params for the next track's sample rate while the
+ * current track is playing.
+ */
+static int pcm_prepare_rate(struct decode_alsa *state, u32_t sample_rate) {
+	int err;
+
+	state->next_sample_rate = 0;
+
+	err = pcm_hw_params_setup(state,
+				  state->pcm,
+				  state->next_hw_params,
+				  state->has_mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED,
+				  sample_rate,
+				  &state->next_format,
+				  &state->next_period_count);
+	if (err < 0) {
+		return err;
+	}
+
+	LOG_DEBUG("prepared hw params for %d Hz", sample_rate);
+
+	state->next_sample_rate = sample_rate;
+
+	return 0;
+}
+
+
+/* Switch the playback pcm to a new sample rate. The frames written up
+ * to the track boundary are drained, then the prepared hw params are
+ * applied to the open pcm. This avoids closing and reopening the device.
+ */
+static int pcm_switch_rate(struct decode_alsa *state, u32_t sample_rate) {
+	snd_pcm_uframes_t size;
+	int err;
+
+	if ((err = snd_pcm_drain(state->pcm)) < 0) {
+		LOG_ERROR("snd_pcm_drain error: %s", snd_strerror(err));
+	}
+
+	gettimeofday(&state->switch_tstamp, 0);
+
+	if (state->next_sample_rate != sample_rate) {
+		if ((err = pcm_prepare_rate(state, sample_rate)) < 0) {
+			return err;
+		}
+	}
+	state->next_sample_rate = 0;
+
+	if ((err = snd_pcm_hw_params(state->pcm, state->next_hw_params)) < 0) {
+		LOG_ERROR("Unable to set hw params: %s", snd_strerror(err));
+		return err;
+	}
+	state->format = state->next_format;
+	state->period_count = state->next_period_count;
+
+	if ((err = snd_pcm_hw_params_get_period_size(state->next_hw_params, &size, 0)) < 0) {
+		LOG_ERROR("Unable to get period size: %s", snd_strerror(err));
+		return err;
+	}
+	state->period_size = size;
+
+	state->pcm_sample_rate = sample_rate;
+	state->switch_pending = TRUE;
+
+	LOG_DEBUG("switched to %d Hz", sample_rate);
+
+	if (IS_LOG_PRIORITY(LOG_PRIORITY_DEBUG)) {
+		snd_pcm_dump(state->pcm, output);
+	}
+
+	return 0;
+}
+
+
 static int pcm_test(struct decode_alsa *state) {
 	snd_pcm_t *pcm;
 	snd_pcm_hw_params_t *hw_params;
@@ -796,7 +1012,7 @@ static void *audio_thread_execute(void *data) {
 	snd_pcm_sframes_t avail;
 	snd_pcm_status_t *status;
 	int err, count = 0, count_max = 441, first = 1;
-	u32_t delay, do_open = 1;
+	u32_t delay, do_open = 1, switch_rate = 0, prepare_rate = 0, prepare_failed_rate = 0;
 	void *buf = NULL;
 
 	LOG_DEBUG("audio_thread_execute");
@@ -805,10 +1021,24 @@ static void *audio_thread_execute(void *data) {
 	decode_audio->set_sample_rate = 44100;
 
 	status = malloc(snd_pcm_hw_params_sizeof());
+	state->next_hw_params = (snd_pcm_hw_params_t *) alloca(snd_pcm_hw_params_sizeof());
+	memset(state->next_hw_params, 0, snd_pcm_hw_params_sizeof());
 
 	while (1) {
 		TIMER_INIT(10.0f); /* 10 ms limit */
 
+		/* change rate on the open pcm if possible */
+		if (switch_rate && !do_open) {
+			if (state->capture_pcm || pcm_switch_rate(state, switch_rate) < 0) {
+				do_open = 1;
+			}
+			else {
+				first = 1;
+				count_max = state->pcm_sample_rate / 1000;
+			}
+		}
+		switch_rate = 0;
+
 		if (do_open) {
 			bool_t loopback = ((decode_audio->state & DECODE_STATE_LOOPBACK) != 0);
 
@@ -835,6 +1065,7 @@ static void *audio_thread_execute(void *data) {
 
 			first = 1;
 			count_max = state->pcm_sample_rate / 1000;
+			prepare_failed_rate = 0;
 		}
 
 		if (count++ > count_max) {
@@ -851,6 +1082,21 @@ static void *audio_thread_execute(void *data) {
 			}
 		}
 		    
+		/* get ready for the next track's sample rate. a rate that failed
+		 * is not retried until a different rate is requested, the switch
+		 * at the track boundary reports the error.
+		 */
+		if (prepare_rate && prepare_rate != state->next_sample_rate && prepare_rate != prepare_failed_rate) {
+			if (pcm_prepare_rate(state, prepare_rate) < 0) {
+				LOG_WARN("unable to prepare hw params for %d Hz", prepare_rate);
+				prepare_failed_rate = prepare_rate;
+			}
+			else {
+				prepare_failed_rate = 0;
+			}
+		}
+		prepare_rate = 0;
+
 		TIMER_CHECK("OPEN");
 
 		pcm_state = snd_pcm_state(state->pcm);
@@ -897,6 +1143,27 @@ static void *audio_thread_execute(void *data) {
 					LOG_ERROR("snd_pcm_start error: %s", snd_strerror(err));
 				}
 
+				if (state->switch_pending) {
+					struct timeval now, diff;
+					u32_t gap;
+
+					gettimeofday(&now, 0);
+					timersub(&now, &state->switch_tstamp, &diff);
+					gap = diff.tv_sec * 1000000 + diff.tv_usec;
+
+					decode_audio_lock();
+					decode_audio->rate_switch_count++;
+					decode_audio->rate_switch_us = gap;
+					if (gap > decode_audio->rate_switch_max_us) {
+						decode_audio->rate_switch_max_us = gap;
+					}
+					decode_audio_unlock();
+
+					LOG_DEBUG("rate switch gap %d us", gap);
+
+					state->switch_pending = FALSE;
+				}
+
 				if (state->capture_pcm) {
 					if ((err = snd_pcm_start(state->capture_pcm)) < 0) {
 						LOG_ERROR("snd_pcm_start capture error: %s", snd_strerror(err));
@@ -953,6 +1220,11 @@ static void *audio_thread_execute(void *data) {
 				decode_audio_lock();
 				TIMER_CHECK("LOCK");
 
+				/* the next track needs a different rate */
+				if (decode_audio->check_start_point && decode_audio->track_sample_rate != state->pcm_sample_rate) {
+					prepare_rate = decode_audio->track_sample_rate;
+				}
+
 				if (state->capture_pcm) {
 					memcpy(buf, state->cbuf, PCM_FRAMES_TO_BYTES(frames));
 				}
@@ -984,14 +1256,18 @@ static void *audio_thread_execute(void *data) {
 						decode_audio->sync_elapsed_timestamp = jive_jiffies();
 					}
 
-					playback_callback(state, buf, frames);
+					state->tap_delay = snd_pcm_status_get_delay(status) + (state->period_size - size);
+
+					frames = playback_callback(state, buf, frames);
 				}
 
 				/* sample rate changed? we do this check while the
 				 * fifo is locked, so we don't need to lock it twice
 				 * per loop.
 				 */
-				do_open = decode_audio->set_sample_rate && (decode_audio->set_sample_rate != state->pcm_sample_rate);
+				if (decode_audio->set_sample_rate && (decode_audio->set_sample_rate != state->pcm_sample_rate)) {
+					switch_rate = decode_audio->set_sample_rate;
+				}
 
 				/* start or stop loopback? */
 				if (state->capture_device && decode_audio->state & DECODE_STATE_LOOPBACK) {
@@ -1043,6 +1319,11 @@ static void *audio_thread_execute(void *data) {
 			size -= frames;
 
 			TIMER_CHECK("COMMIT");
+
+			/* stop writing at a rate change */
+			if (switch_rate || do_open) {
+				break;
+			}
 		}
 	}
 
@@ -1102,8 +1383,8 @@ static int decode_lock_memory()
 	page_size = sysconf(_SC_PAGESIZE);
 
 	/* touch each page of buffer */
-	for (i=0; i<DECODE_AUDIO_BUFFER_SIZE; i+=page_size) {
-		*(decode_fifo_buf + i) = 0;
+	for (i=0; i<DECODE_AUDIO_BUFFER_SIZE(decode_audio->fifo_capacity); i+=page_size) {
+		*((u8_t *)decode_audio + i) = 0;
 	}
 
 #if DEBUG_PAGEFAULTS
@@ -1125,8 +1406,8 @@ static int decode_alsa_shared_mem_attach(void)
 	decode_audio = shmat(shmid, 0, 0);
 	// XXXX errors
 
-	decode_fifo_buf = (((u8_t *)decode_audio) + sizeof(struct decode_audio));
-	effect_fifo_buf = ((u8_t *)decode_fifo_buf) + DECODE_FIFO_SIZE;
+	effect_fifo_buf = (((u8_t *)decode_audio) + sizeof(struct decode_audio));
+	decode_fifo_buf = ((u8_t *)effect_fifo_buf) + EFFECT_FIFO_SIZE;
 
 	return 0;
 }
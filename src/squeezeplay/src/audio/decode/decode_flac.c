@@ -15,14 +15,53 @@
 
 #define BLOCKSIZE 4096
 
+/* largest blocksize allowed in the FLAC subset */
+#define MAX_SUBSET_BLOCKSIZE 4608
+
 struct decode_flac {
 	FLAC__StreamDecoder *decoder;
 
+	/* scratch buffer for decoded frames */
+	sample_t *output_buffer;
+	unsigned int output_blocksize;
+
 	int sample_rate;
 	bool_t error_occurred;
+
+	/* seeking, stream offsets are from the start of the stream */
+	FLAC__StreamMetadata_SeekPoint *seek_points;
+	unsigned int num_seek_points;
+	FLAC__uint64 bytes_read;
+	FLAC__uint64 frame_offset;
+	FLAC__uint64 first_frame_offset;
+	bool_t have_first_frame;
+	FLAC__uint64 next_sample;
+	bool_t ogg;
 };
 
 
+/* grow the output buffer, on failure the old buffer is kept */
+static bool_t decode_flac_alloc_output(struct decode_flac *self, unsigned int blocksize) {
+	sample_t *buf;
+
+	if (blocksize <= self->output_blocksize) {
+		return TRUE;
+	}
+
+	LOG_DEBUG(log_audio_codec, "FLAC output buffer %d frames", blocksize);
+
+	buf = decode_realloc(self->output_buffer, sizeof(sample_t) * 2 * blocksize);
+	if (!buf) {
+		LOG_ERROR(log_audio_codec, "FLAC output buffer %d frames failed", blocksize);
+		return FALSE;
+	}
+
+	self->output_buffer = buf;
+	self->output_blocksize = blocksize;
+	return TRUE;
+}
+
+
 
 static FLAC__StreamDecoderReadStatus decode_flac_read_callback(
 	const FLAC__StreamDecoder *decoder,
@@ -44,6 +83,8 @@ static FLAC__StreamDecoderReadStatus decode_flac_read_callback(
 	}
 
 	*bytes = streambuf_read(buffer, 0, requested_bytes, &streaming);
+	self->bytes_read += *bytes;
+
 	if (*bytes == 0) {
 		current_decoder_state |= DECODE_STATE_UNDERRUN;
 
@@ -59,6 +100,20 @@ static FLAC__StreamDecoderReadStatus decode_flac_read_callback(
 }
 
 
+/* only used for FLAC__stream_decoder_get_decode_position() */
+static FLAC__StreamDecoderTellStatus decode_flac_tell_callback(
+	const FLAC__StreamDecoder *decoder,
+	FLAC__uint64 *absolute_byte_offset,
+	void *data) {
+
+	struct decode_flac *self = (struct decode_flac *) data;
+
+	*absolute_byte_offset = self->bytes_read;
+
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+
 static FLAC__StreamDecoderWriteStatus decode_flac_write_callback(
 	const FLAC__StreamDecoder *decoder,
 	const FLAC__Frame *frame,
@@ -76,9 +131,25 @@ static FLAC__StreamDecoderWriteStatus decode_flac_write_callback(
 
 	self->sample_rate = frame->header.sample_rate;
 
+	/* the seek table offsets are from the first frame */
+	if (frame->header.number.sample_number == 0 && !self->have_first_frame) {
+		self->first_frame_offset = self->frame_offset;
+		self->have_first_frame = TRUE;
+	}
+	self->next_sample = frame->header.number.sample_number + frame->header.blocksize;
+
+	/* only streams without a STREAMINFO block or with an invalid max
+	 * blocksize need to grow the buffer here.
+	 */
+	if (!decode_flac_alloc_output(self, frame->header.blocksize)) {
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+
 	lptr = buffer[0];
 	rptr = buffer[1];
-	sbuf = sptr = malloc(sizeof(sample_t) * 2 * frame->header.blocksize);
+	sbuf = sptr = self->output_buffer;
+
+	decode_output_set_track_bits(frame->header.bits_per_sample == 16 ? 16 : 32);
 
 	/* Scale samples, and copy if we have mono input */
 	if (frame->header.channels == 1) {
@@ -116,8 +187,6 @@ static FLAC__StreamDecoderWriteStatus decode_flac_write_callback(
 			      frame->header.blocksize,
 			      frame->header.sample_rate);
 
-	free(sbuf);
-
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -132,6 +201,31 @@ static void decode_flac_metadata_callback(
 
 	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
 		self->sample_rate = metadata->data.stream_info.sample_rate;
+
+		decode_flac_alloc_output(self, metadata->data.stream_info.max_blocksize);
+	}
+	else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE) {
+		FLAC__StreamMetadata_SeekPoint *points = NULL;
+		unsigned int num_points = metadata->data.seek_table.num_points;
+
+		if (num_points) {
+			points = decode_realloc(self->seek_points, sizeof(FLAC__StreamMetadata_SeekPoint) * num_points);
+		}
+
+		if (points) {
+			memcpy(points, metadata->data.seek_table.points, sizeof(FLAC__StreamMetadata_SeekPoint) * num_points);
+		}
+		else {
+			/* no seek table, seeking is disabled */
+			if (num_points) {
+				LOG_ERROR(log_audio_codec, "FLAC seek table %d points failed", num_points);
+			}
+			free(self->seek_points);
+			num_points = 0;
+		}
+
+		self->seek_points = points;
+		self->num_seek_points = num_points;
 	}
 }
 
@@ -163,6 +257,11 @@ static bool_t decode_flac_callback(void *data) {
 		return FALSE;
 	}
 
+	/* start of the next frame, for the seek table. this fails for ogg */
+	if (!FLAC__stream_decoder_get_decode_position(self->decoder, &self->frame_offset)) {
+		self->frame_offset = 0;
+	}
+
 	FLAC__stream_decoder_process_single(self->decoder);
 
 	state = FLAC__stream_decoder_get_state(self->decoder);
@@ -181,6 +280,61 @@ static size_t decode_flac_samples(void *data) {
 }
 
 
+static u32_t decode_flac_seek(void *data, u32_t frames) {
+	struct decode_flac *self = (struct decode_flac *) data;
+	FLAC__StreamMetadata_SeekPoint *point = NULL;
+	FLAC__uint64 target, offset, skip_bytes = 0;
+	size_t used;
+	unsigned int i;
+	u32_t skipped;
+
+	/* the seek table offsets are into the flac stream, not into the
+	 * ogg pages that carry it
+	 */
+	if (self->ogg || !self->have_first_frame || !self->seek_points) {
+		return 0;
+	}
+
+	target = self->next_sample + frames;
+	used = streambuf_get_usedbytes();
+
+	/* the last seek point before the target that has been received.
+	 * libFLAC has already read the bytes up to bytes_read.
+	 */
+	for (i = 0; i < self->num_seek_points; i++) {
+		FLAC__StreamMetadata_SeekPoint *p = &self->seek_points[i];
+
+		if (p->sample_number == FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER || p->sample_number > target) {
+			break;
+		}
+
+		offset = self->first_frame_offset + p->stream_offset;
+		if (p->sample_number <= self->next_sample || offset < self->bytes_read) {
+			continue;
+		}
+		if (offset - self->bytes_read > used) {
+			break;
+		}
+
+		point = p;
+		skip_bytes = offset - self->bytes_read;
+	}
+
+	if (!point || !streambuf_skip((size_t)skip_bytes)) {
+		return 0;
+	}
+
+	FLAC__stream_decoder_flush(self->decoder);
+
+	self->bytes_read += skip_bytes;
+
+	skipped = (u32_t)(point->sample_number - self->next_sample);
+	self->next_sample = point->sample_number;
+
+	return skipped;
+}
+
+
 static void *decode_flac_start(u8_t *params, u32_t num_params) {
 	struct decode_flac *self;
 
@@ -189,16 +343,21 @@ static void *decode_flac_start(u8_t *params, u32_t num_params) {
 	self = malloc(sizeof(struct decode_flac));
 	memset(self, 0, sizeof(struct decode_flac));
 
+	/* enough for subset streams, STREAMINFO may ask for more */
+	decode_flac_alloc_output(self, MAX_SUBSET_BLOCKSIZE);
+
 	self->decoder = FLAC__stream_decoder_new();
 	// XXXX error handling
 
+	FLAC__stream_decoder_set_metadata_respond(self->decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+
 	if (params[0] != 'o') {
 
 		FLAC__stream_decoder_init_stream(
 			self->decoder,
 			decode_flac_read_callback,
 			NULL, /* seek_callback */
-			NULL, /* tell_callback */
+			decode_flac_tell_callback,
 			NULL, /* length_callback */
 			NULL, /* eof_callback */
 			decode_flac_write_callback,
@@ -211,6 +370,8 @@ static void *decode_flac_start(u8_t *params, u32_t num_params) {
 
 		LOG_DEBUG(log_audio_codec, "oggflac stream - using init_ogg_stream()");
 
+		self->ogg = TRUE;
+
 		FLAC__stream_decoder_init_ogg_stream(
 			self->decoder,
 			decode_flac_read_callback,
@@ -247,6 +408,14 @@ static void decode_flac_stop(void *data) {
 		FLAC__stream_decoder_delete(self->decoder);
 		self->decoder = NULL;
 	}
+
+	if (self->output_buffer) {
+		free(self->output_buffer);
+	}
+
+	if (self->seek_points) {
+		free(self->seek_points);
+	}
 	
 	free(self);
 }
@@ -259,4 +428,5 @@ struct decode_module decode_flac = {
 	decode_flac_stop,
 	decode_flac_samples,
 	decode_flac_callback,
+	decode_flac_seek,
 };
@@ -33,6 +33,9 @@ struct decode_mad {
 	sample_t *output_buffer;
 	u8_t *guard_pointer;
 
+	/* libmad is decoding data that has not been consumed from the streambuf */
+	bool_t peeking;
+
 	u32_t packets;
 	u32_t encoder_delay;
 	u32_t encoder_padding;
@@ -69,6 +72,11 @@ struct decode_mad {
 */
 #define MAD_DECODER_DELAY 529
 
+/* Frames decoded without output after a seek, to refill the bit reservoir
+ * and the synthesis state.
+ */
+#define MAD_SEEK_PREROLL 2
+
 
 static void xing_parse(struct decode_mad *self) {
 	struct mad_bitptr ptr = self->stream.anc_ptr;
@@ -237,70 +245,137 @@ void null_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
 #endif
 
 
-static void decode_mad_frame(struct decode_mad *self) {
-	size_t read_max, read_num, remaining;
+/* Copy the stream into the input buffer, after any data left from
+ * the last time. Used for filtered streams and at the end of the stream.
+ */
+static bool_t decode_mad_read(struct decode_mad *self, size_t remaining) {
+	size_t read_max, read_num;
 	u8_t *read_start;
 	bool_t streaming;
 
-	do {
-		/* The input stream must be filled if it's the first
-		 * execution of the loop or it becomes empty
+	read_start = self->input_buffer + remaining;
+	read_max = INPUT_BUFFER_SIZE - remaining;
+
+	read_num = streambuf_read(read_start, 0, read_max, &streaming);
+
+	if (!read_num) {
+		current_decoder_state |= DECODE_STATE_UNDERRUN;
+		if (streaming) {
+			return FALSE;
+		}
+
+		/* Mark that we are at the end of the file,
+		 * for some reason this is not required on
+		 * ip3k, but it is needed in SqueezePlay as
+		 * this_frame never reaches the guard_pionter?
 		 */
-		if (self->stream.buffer == NULL ||
-		    self->stream.error == MAD_ERROR_BUFLEN) {
+		if (self->guard_pointer) {
+			self->stream.this_frame = self->guard_pointer;
+			self->state = MAD_STATE_PCM_READY;
+			return FALSE;
+		}
 
-			/* If there's data left from the last time,
-			 * copy it to the beginning of the input buffer
-			 */
-			if (self->stream.next_frame) {
-				remaining = self->stream.bufend - self->stream.next_frame;
-				memmove(self->input_buffer, self->stream.next_frame, remaining);
-			}
-			/* Otherwise fill the input buffer */
-			else {
-				remaining = 0;
-			}
+		/* If we're at the end of the input file, write
+		 * out the buffer guard.
+		 */
+		self->guard_pointer = read_start;
+		memset(self->guard_pointer, 0, MAD_BUFFER_GUARD);
+		read_num = MAD_BUFFER_GUARD;
+	}
+	else {
+		current_decoder_state &= ~DECODE_STATE_UNDERRUN;
+	}
 
-			read_start = self->input_buffer + remaining;
-			read_max = INPUT_BUFFER_SIZE - remaining;
+	/* Send the new content to libmad's stream decoder
+	 */
+	mad_stream_buffer(&self->stream,
+			  self->input_buffer,
+			  read_num + remaining);
 
-			read_num = streambuf_read(read_start, 0, read_max, &streaming);
+	self->stream.error = MAD_ERROR_NONE;
 
-			if (!read_num) {
-				current_decoder_state |= DECODE_STATE_UNDERRUN;
-				if (streaming) {
-					return;
-				}
+	return TRUE;
+}
 
-				/* Mark that we are at the end of the file,
-				 * for some reason this is not required on
-				 * ip3k, but it is needed in SqueezePlay as
-				 * this_frame never reaches the guard_pionter?
-				 */
-				if (self->guard_pointer) {
-					self->stream.this_frame = self->guard_pointer;
-					self->state = MAD_STATE_PCM_READY;
-					return;
-				}
 
-				/* If we're at the end of the input file, write
-				 * out the buffer guard.
-				 */
-				self->guard_pointer = read_start;
-				memset(self->guard_pointer, 0, MAD_BUFFER_GUARD);
-				read_num = MAD_BUFFER_GUARD;
-			}
-			else {
-				current_decoder_state &= ~DECODE_STATE_UNDERRUN;
-			}
+/* Fill libmad's input. When the stream is not filtered the frames are
+ * decoded directly from the streambuf, and the bytes are consumed once
+ * libmad has finished with them. The input buffer is only used when a
+ * frame may be split by the streambuf wrap.
+ */
+static bool_t decode_mad_fill(struct decode_mad *self) {
+	size_t read_num, remaining = 0, used;
+	u8_t *read_ptr;
+	bool_t streaming;
+
+	if (self->peeking) {
+		/* the remaining bytes are still in the streambuf */
+		streambuf_consume(self->stream.next_frame - self->stream.buffer);
+		remaining = self->stream.bufend - self->stream.next_frame;
+
+		self->peeking = FALSE;
+	}
+	else if (self->stream.next_frame) {
+		/* If there's data left from the last time,
+		 * copy it to the beginning of the input buffer
+		 */
+		remaining = self->stream.bufend - self->stream.next_frame;
+		memmove(self->input_buffer, self->stream.next_frame, remaining);
+
+		return decode_mad_read(self, remaining);
+	}
+
+	if (streambuf_has_filter()) {
+		return decode_mad_read(self, 0);
+	}
+
+	read_num = streambuf_peek(&read_ptr, &used, &streaming);
+
+	if (used <= remaining && !streaming) {
+		/* End of the stream, move the last bytes to the input
+		 * buffer to write out the buffer guard.
+		 */
+		read_num = streambuf_peek_copy(self->input_buffer, INPUT_BUFFER_SIZE);
+		streambuf_consume(read_num);
+
+		return decode_mad_read(self, read_num);
+	}
 
-			/* Send the new content to libmad's stream decoder
-			 */
-			mad_stream_buffer(&self->stream,
-					  self->input_buffer,
-					  read_num + remaining);
+	if (read_num < used && read_num < INPUT_BUFFER_SIZE) {
+		/* a frame may be split by the fifo wrap, use a copy */
+		read_num = streambuf_peek_copy(self->input_buffer, INPUT_BUFFER_SIZE);
+		read_ptr = self->input_buffer;
+	}
+
+	mad_stream_buffer(&self->stream, read_ptr, read_num);
+	self->peeking = TRUE;
+
+	if (used <= remaining) {
+		/* wait for more data */
+		current_decoder_state |= DECODE_STATE_UNDERRUN;
+		self->stream.error = MAD_ERROR_BUFLEN;
+		return FALSE;
+	}
+
+	current_decoder_state &= ~DECODE_STATE_UNDERRUN;
+	self->stream.error = MAD_ERROR_NONE;
 
-			self->stream.error = MAD_ERROR_NONE;
+	return TRUE;
+}
+
+
+static void decode_mad_frame(struct decode_mad *self) {
+
+	do {
+		/* The input stream must be filled if it's the first
+		 * execution of the loop or it becomes empty
+		 */
+		if (self->stream.buffer == NULL ||
+		    self->stream.error == MAD_ERROR_BUFLEN) {
+
+			if (!decode_mad_fill(self)) {
+				return;
+			}
 		}
 
 		if (mad_frame_decode(&self->frame, &self->stream)) {
@@ -514,6 +589,116 @@ static size_t decode_mad_samples(void *data) {
 }
 
 
+/* Refill libmad's input while seeking, only when a full input buffer of
+ * new data is in the streambuf so the end of the stream is not reached.
+ */
+static bool_t decode_mad_seek_fill(struct decode_mad *self) {
+	size_t have = 0;
+
+	if (self->guard_pointer) {
+		return FALSE;
+	}
+
+	if (self->peeking) {
+		have = self->stream.bufend - self->stream.buffer;
+	}
+
+	if (streambuf_get_usedbytes() < have + INPUT_BUFFER_SIZE) {
+		return FALSE;
+	}
+
+	return decode_mad_fill(self);
+}
+
+
+/* Skip frames by parsing only their headers. The Xing TOC is not used as
+ * it has a resolution of 1% of the track, this is sample accurate.
+ */
+static u32_t decode_mad_seek(void *data, u32_t frames) {
+	struct decode_mad *self = (struct decode_mad *) data;
+	struct mad_header header;
+	u32_t skipped = 0, frame_samples;
+	int preroll = 0;
+
+	/* not before the first frames, or during the encoder delay */
+	if (self->state != MAD_STATE_OK || self->packets < 2 || self->encoder_delay) {
+		return 0;
+	}
+
+	if (self->encoder_padding && frames > self->lame_samples_remain) {
+		frames = (u32_t)self->lame_samples_remain;
+	}
+
+	frame_samples = 32 * MAD_NSBSAMPLES(&self->frame.header);
+
+	mad_header_init(&header);
+
+	while (skipped + (MAD_SEEK_PREROLL + 1) * frame_samples <= frames) {
+		if (self->stream.error == MAD_ERROR_BUFLEN) {
+			if (!decode_mad_seek_fill(self)) {
+				break;
+			}
+		}
+
+		if (mad_header_decode(&header, &self->stream)) {
+			if (MAD_RECOVERABLE(self->stream.error) || self->stream.error == MAD_ERROR_BUFLEN) {
+				continue;
+			}
+			break;
+		}
+
+		skipped += 32 * MAD_NSBSAMPLES(&header);
+	}
+
+	if (!skipped) {
+		return 0;
+	}
+
+	/* the reservoir and overlap are from before the skipped frames */
+	self->stream.md_len = 0;
+	mad_frame_mute(&self->frame);
+	mad_synth_mute(&self->synth);
+
+	while (preroll < MAD_SEEK_PREROLL && skipped + frame_samples <= frames) {
+		if (self->stream.error == MAD_ERROR_BUFLEN) {
+			if (!decode_mad_seek_fill(self)) {
+				break;
+			}
+		}
+
+		if (mad_frame_decode(&self->frame, &self->stream)) {
+			if (self->stream.error == MAD_ERROR_BUFLEN) {
+				continue;
+			}
+			if (!MAD_RECOVERABLE(self->stream.error)) {
+				break;
+			}
+			if ((self->stream.error & 0xff00) == 0x0100) {
+				/* header errors, no frame was consumed */
+				continue;
+			}
+		}
+		else {
+#ifdef HAVE_NULLAUDIO
+			null_synth_frame(&self->synth, &self->frame);
+#else
+			mad_synth_frame(&self->synth, &self->frame);
+#endif
+		}
+
+		skipped += frame_samples;
+		preroll++;
+	}
+
+	self->decoded_samples += skipped;
+	if (self->encoder_padding) {
+		self->lame_samples_remain -= skipped;
+	}
+
+	return skipped;
+}
+
+
 static void *decode_mad_start(u8_t *params, u32_t num_params) {
 	struct decode_mad *self;
 
@@ -564,4 +749,5 @@ struct decode_module decode_mad = {
 	decode_mad_stop,
 	decode_mad_samples,
 	decode_mad_callback,
+	decode_mad_seek,
 };
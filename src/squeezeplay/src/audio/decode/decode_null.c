@@ -24,9 +24,12 @@ static u32_t stream_sample_rate;
  * audio samples
  */
 static Uint32 callback(Uint32 interval) {
-	size_t bytes_used, len, skip_bytes = 0, add_bytes = 0;
+	size_t frames_used, len, skip_frames = 0, add_frames = 0, rptr;
 	int add_silence_ms;
 	bool_t reached_start_point;
+	struct decode_chunk chunks[DECODE_MAX_CHUNKS];
+	struct decode_fade fade;
+	int i, num_chunks = 0;
 	u32_t delay;
 
 	if ((decode_audio->state & (DECODE_STATE_AUTOSTART | DECODE_STATE_RUNNING)) == 0) {
@@ -37,14 +40,14 @@ static Uint32 callback(Uint32 interval) {
 	decode_audio_lock();
 
 	stream_sample_rate = decode_audio->set_sample_rate;
-	len = SAMPLES_TO_BYTES(stream_sample_rate * interval / 1000);
+	len = stream_sample_rate * interval / 1000;
 
-	bytes_used = fifo_bytes_used(&decode_audio->fifo);
+	frames_used = decode_fifo_frames_used();
 
 	/* Should we start the audio now based on having enough decoded data? */
 	if (decode_audio->state & DECODE_STATE_AUTOSTART
-			&& bytes_used >=  len
-			&& bytes_used >= SAMPLES_TO_BYTES((u32_t)((decode_audio->output_threshold * stream_sample_rate) / 10))
+			&& frames_used >=  len
+			&& frames_used >= (u32_t)((decode_audio->output_threshold * stream_sample_rate) / 10)
 		)
 	{
 		u32_t now = jive_jiffies();
@@ -76,10 +79,10 @@ static Uint32 callback(Uint32 interval) {
 
 	add_silence_ms = decode_audio->add_silence_ms;
 	if (add_silence_ms) {
-		add_bytes = SAMPLES_TO_BYTES((u32_t)((add_silence_ms * stream_sample_rate) / 1000));
-		if (add_bytes > len) add_bytes = len;
-		len -= add_bytes;
-		add_silence_ms -= (BYTES_TO_SAMPLES(add_bytes) * 1000) / stream_sample_rate;
+		add_frames = (u32_t)((add_silence_ms * stream_sample_rate) / 1000);
+		if (add_frames > len) add_frames = len;
+		len -= add_frames;
+		add_silence_ms -= (add_frames * 1000) / stream_sample_rate;
 		if (add_silence_ms < 2)
 			add_silence_ms = 0;
 
@@ -91,64 +94,84 @@ static Uint32 callback(Uint32 interval) {
 	}
 
 	/* only skip if it will not cause an underrun */
-	if (bytes_used >= len && decode_audio->skip_ahead_bytes > 0) {
-		skip_bytes = bytes_used - len;
-		if (skip_bytes > decode_audio->skip_ahead_bytes) {
-			skip_bytes = decode_audio->skip_ahead_bytes;			
+	if (frames_used >= len && decode_audio->skip_ahead_frames > 0) {
+		skip_frames = frames_used - len;
+		if (skip_frames > decode_audio->skip_ahead_frames) {
+			skip_frames = decode_audio->skip_ahead_frames;
 		}
 	}
 
-	if (bytes_used > len) {
-		bytes_used = len;
+	if (frames_used > len) {
+		frames_used = len;
 	}
 
 	/* audio underrun? */
-	if (bytes_used == 0) {
+	if (frames_used == 0) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
 
 		goto mixin_effects;
 	}
 
-	if (bytes_used < len) {
+	if (frames_used < len) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
 	}
 	else {
 		decode_audio->state &= ~DECODE_STATE_UNDERRUN;
 	}
 
-	if (skip_bytes) {
-		size_t wrap;
+	if (skip_frames) {
+		LOG_DEBUG(log_audio_output, "Skipping %d frames", (int) skip_frames);
 
-		LOG_DEBUG(log_audio_output, "Skipping %d bytes", (int) skip_bytes);
-		
-		wrap = fifo_bytes_until_rptr_wrap(&decode_audio->fifo);
+		decode_audio->skip_ahead_frames -= skip_frames;
+		frames_used += skip_frames;
+	}
+
+	/* the frames are discarded after the visualizer tap has them, a
+	 * chunk ends where the fifo wraps or changes format.
+	 */
+	rptr = decode_audio->fifo.rptr;
+
+	while (frames_used && num_chunks < DECODE_MAX_CHUNKS) {
+		size_t run_frames;
+		u32_t bits;
+
+		run_frames = decode_fifo_run(rptr, &bits) / FIFO_FRAME_BYTES(bits);
+		if (!run_frames) {
+			break;
+		}
+		if (run_frames > frames_used) {
+			run_frames = frames_used;
+		}
+
+		chunks[num_chunks].decode_ptr = decode_fifo_buf + rptr;
+		chunks[num_chunks].decode_bits = bits;
+		chunks[num_chunks].output_ptr = NULL;
+		chunks[num_chunks].frames = run_frames;
+		chunks[num_chunks].lgain = chunks[num_chunks].rgain = 0;
+		num_chunks++;
 
-		if (wrap < skip_bytes) {
-			fifo_rptr_incby(&decode_audio->fifo, wrap);
-			skip_bytes -= wrap;
-			decode_audio->skip_ahead_bytes -= wrap;
-			decode_audio->elapsed_samples += BYTES_TO_SAMPLES(wrap);
+		rptr += run_frames * FIFO_FRAME_BYTES(bits);
+		if (rptr == decode_audio->fifo.size) {
+			rptr = 0;
 		}
 
-		fifo_rptr_incby(&decode_audio->fifo, skip_bytes);
-		decode_audio->skip_ahead_bytes -= skip_bytes;
-		decode_audio->elapsed_samples += BYTES_TO_SAMPLES(skip_bytes);
+		frames_used -= run_frames;
 	}
 
-	while (bytes_used) {
-		size_t wrap, bytes_write;
+	if (num_chunks) {
+		u32_t generation = decode_audio->fifo_generation;
 
-		wrap = fifo_bytes_until_rptr_wrap(&decode_audio->fifo);
+		/* no fade here, both sides are the same */
+		decode_fade_save(&fade);
+		decode_audio_unlock();
 
-		bytes_write = bytes_used;
-		if (wrap < bytes_write) {
-			bytes_write = wrap;
+		for (i = 0; i < num_chunks; i++) {
+			decode_tap_write(chunks[i].decode_ptr, chunks[i].frames, chunks[i].decode_bits, delay, stream_sample_rate);
 		}
 
-		fifo_rptr_incby(&decode_audio->fifo, bytes_write);
-		decode_audio->elapsed_samples += BYTES_TO_SAMPLES(bytes_write);
+		decode_audio_lock();
 
-		bytes_used -= bytes_write;
+		decode_fifo_commit(chunks, num_chunks, generation, &fade, &fade);
 	}
 
 	reached_start_point = decode_check_start_point();
@@ -231,13 +254,13 @@ static int decode_null_init(lua_State *L) {
 	void *buf;
 
 	/* allocate output memory */
-	buf = malloc(DECODE_AUDIO_BUFFER_SIZE);
+	buf = malloc(DECODE_AUDIO_BUFFER_SIZE(decode_fifo_capacity));
 	if (!buf) {
 		LOG_WARN(log_audio_output, "Cannot allocate output buffer");
 		return 0;
 	}
 
-	decode_init_buffers(buf, false);
+	decode_init_buffers(buf, decode_fifo_capacity, false);
 	decode_audio->max_rate = 48000;
 
 	stream_sample_rate = decode_audio->set_sample_rate = decode_audio->track_sample_rate = 44100;
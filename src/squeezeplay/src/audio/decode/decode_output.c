@@ -11,6 +11,7 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
 
 #if defined(WIN32)
 #include <winsock2.h>
@@ -38,6 +39,9 @@ static s32_t track_inversion[2] = { 1, 1 };
 /* Output channels */
 static u8_t output_channels = 0;
 
+/* Bits per sample of the decoded track */
+static u32_t track_bits = 32;
+
 /* Upload tests */
 static int upload_fd = 0;
 
@@ -127,11 +131,15 @@ void decode_output_end(void) {
 
 	decode_audio->fifo.rptr = 0;
 	decode_audio->fifo.wptr = 0;
+	decode_audio->fifo_generation++;
+	decode_audio->fifo_bits_pending = FALSE;
 
 	if (decode_audio) {
 		decode_audio->f->stop();
 	}
 
+	decode_resample_reset();
+
 	crossfade_started = FALSE;
 	transition_gain_step = 0;
 	decode_audio->elapsed_samples = 0;
@@ -144,6 +152,13 @@ void decode_output_flush(void) {
 
 	ASSERT_AUDIO_LOCKED();
 
+	decode_audio->fifo_generation++;
+
+	/* any format change is at or after the track start point */
+	decode_audio->fifo_bits_pending = FALSE;
+
+	decode_resample_reset();
+
 	if (decode_audio->check_start_point) {
 		decode_audio->fifo.wptr = decode_audio->track_start_point;
 	}
@@ -158,6 +173,109 @@ void decode_output_flush(void) {
 }
 
 
+/* Size the decode fifo to hold fifo_time seconds of 32-bit samples at
+ * the sample rate, within the allocated capacity, and set the format of
+ * the samples. The fifo must be empty.
+ */
+static void decode_resize_fifo(u32_t sample_rate, u32_t bits) {
+	size_t size;
+
+	ASSERT_AUDIO_LOCKED();
+
+	if (!fifo_empty(&decode_audio->fifo)) {
+		return;
+	}
+
+	size = decode_audio->fifo_capacity;
+	if (decode_audio->fifo_time && sample_rate) {
+		size = SAMPLES_TO_BYTES(decode_audio->fifo_time * sample_rate);
+
+		if (size < DECODE_FIFO_MIN_SIZE) {
+			size = DECODE_FIFO_MIN_SIZE;
+		}
+		if (size > decode_audio->fifo_capacity) {
+			size = decode_audio->fifo_capacity;
+		}
+	}
+
+	decode_audio->fifo_bits_pending = FALSE;
+
+	if (size == decode_audio->fifo.size && bits == decode_audio->fifo_bits) {
+		return;
+	}
+
+	LOG_DEBUG(log_audio_decode, "decode fifo resized %d bytes (%d Hz, %d bits)", (int)size, sample_rate, bits);
+
+	/* restart at zero so frames are aligned to the wrap */
+	decode_audio->fifo_bits = bits;
+	decode_audio->fifo.rptr = 0;
+	decode_audio->fifo.wptr = 0;
+	decode_audio->fifo.size = size;
+	decode_audio->fifo_generation++;
+}
+
+
+/* Bits per sample of the frames written at wptr.
+ */
+static u32_t decode_fifo_write_bits(void) {
+	size_t rptr = decode_audio->fifo.rptr;
+
+	ASSERT_AUDIO_LOCKED();
+
+	if (decode_audio->fifo_bits_pending
+	    && decode_fifo_distance(rptr, decode_audio->fifo.wptr) >= decode_fifo_distance(rptr, decode_audio->fifo_bits_ptr)) {
+		return decode_audio->fifo_next_bits;
+	}
+
+	return decode_audio->fifo_bits;
+}
+
+
+/* The fifo format for the current track. 16-bit tracks, and resampled
+ * tracks which are only 16-bit precision, are stored packed when this
+ * is lossless.
+ */
+static u32_t decode_track_fifo_bits(void) {
+	if ((track_bits <= DECODE_FIFO_PACKED_BITS || decode_resample_active())
+	    && track_gain == FIXED_ONE
+	    && track_inversion[0] == 1
+	    && track_inversion[1] == 1) {
+		return DECODE_FIFO_PACKED_BITS;
+	}
+
+	return 32;
+}
+
+
+/* Widen the fifo format from ptr onwards, the output switches format
+ * when it reaches ptr. The fifo only returns to 16-bit once it has been
+ * emptied.
+ */
+static void decode_widen_fifo_bits(size_t ptr, u32_t bits) {
+	size_t rem;
+
+	ASSERT_AUDIO_LOCKED();
+
+	/* the first frames must not straddle the wrap, so start on the next
+	 * wide frame boundary. the fifo size is a multiple of the wide frame,
+	 * and the decoder fills any gap with narrow frames.
+	 */
+	rem = ptr % FIFO_FRAME_BYTES(bits);
+	if (rem) {
+		ptr += FIFO_FRAME_BYTES(bits) - rem;
+	}
+	if (ptr == decode_audio->fifo.size) {
+		ptr = 0;
+	}
+
+	LOG_DEBUG(log_audio_decode, "decode fifo %d bits at %d", bits, (int)ptr);
+
+	decode_audio->fifo_next_bits = bits;
+	decode_audio->fifo_bits_ptr = ptr;
+	decode_audio->fifo_bits_pending = TRUE;
+}
+
+
 /* Apply track gain and polarity inversion
  */
 static void volume_get_clip_range(fft_fixed gain, sample_t clip_range[2]) {
@@ -172,33 +290,14 @@ static void volume_get_clip_range(fft_fixed gain, sample_t clip_range[2]) {
 }
 
 
-static inline sample_t volume_mul(sample_t sample, fft_fixed gain, sample_t clip_range[2]) {
-	if (sample > clip_range[0]) {
-		return SAMPLE_MAX;
-	}
-	if (sample < clip_range[1]) {
-		return SAMPLE_MIN;
-	}
-
-	return fixed_mul(gain, sample);
-}
-
-
 static void decode_apply_track_gain(sample_t *buffer, int nsamples) {
-	int s;
-
 	if (track_gain == FIXED_ONE
 	    && track_inversion[0] == 1
 	    && track_inversion[1] == 1) {
 		return;
 	}
 
-	for (s = 0; s < nsamples; s++) {
-		*buffer = track_inversion[0] * volume_mul(*buffer, track_gain, track_clip_range);
-		buffer++;
-		*buffer = track_inversion[1] * volume_mul(*buffer, track_gain, track_clip_range);
-		buffer++;
-	}
+	sample_convert.track_gain(buffer, nsamples, track_gain, track_clip_range, track_inversion);
 }
 
 /* How many bytes till we're done with the transition.
@@ -213,43 +312,58 @@ static inline size_t decode_transition_bytes_remaining(size_t ptr) {
  * a transition - crossfade or fade in. This method applies gain
  * to both the new signal and the one that's already in the fifo.
  */
-static void decode_transition_copy_bytes(sample_t *buffer, size_t nbytes) {
-	sample_t sample, *sptr;
+static void decode_transition_copy_frames(sample_t *buffer, size_t nframes, u32_t bits) {
+	sample_t sample;
 	int nsamples, s;
-	size_t bytes_read;
 	fft_fixed in_gain, out_gain;
 
 	ASSERT_AUDIO_LOCKED();
 
-	while (nbytes) {
-		bytes_read = SAMPLES_TO_BYTES(transition_sample_step - transition_samples_in_step);
+	while (nframes) {
+		nsamples = transition_sample_step - transition_samples_in_step;
 
-		if (bytes_read > nbytes) {
-			bytes_read = nbytes;
+		if ((size_t)nsamples > nframes) {
+			nsamples = nframes;
 		}
 
-		nsamples = BYTES_TO_SAMPLES(bytes_read);
-
-		sptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.wptr);
-
 		in_gain = transition_gain;
 		out_gain = FIXED_ONE - in_gain;
 
-		if (crossfade_started) {
-			for (s=0; s<nsamples * 2; s++) {
-				sample = fixed_mul(out_gain, *sptr);
-				sample += fixed_mul(in_gain, *buffer++);
-				*sptr++ = sample;
+		if (bits == 32) {
+			sample_t *sptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.wptr);
+
+			if (crossfade_started) {
+				for (s=0; s<nsamples * 2; s++) {
+					sample = fixed_mul(out_gain, *sptr);
+					sample += fixed_mul(in_gain, *buffer++);
+					*sptr++ = sample;
+				}
+			}
+			else {
+				for (s=0; s<nsamples * 2; s++) {
+					*sptr++ = fixed_mul(in_gain, *buffer++);
+				}
 			}
 		}
 		else {
-			for (s=0; s<nsamples * 2; s++) {
-				*sptr++ = fixed_mul(in_gain, *buffer++);
+			s16_t *sptr = (s16_t *)(void *)(decode_fifo_buf + decode_audio->fifo.wptr);
+
+			if (crossfade_started) {
+				for (s=0; s<nsamples * 2; s++) {
+					sample = fixed_mul(out_gain, *sptr << 16);
+					sample += fixed_mul(in_gain, *buffer++);
+					*sptr++ = sample >> 16;
+				}
+			}
+			else {
+				for (s=0; s<nsamples * 2; s++) {
+					*sptr++ = fixed_mul(in_gain, *buffer++) >> 16;
+				}
 			}
 		}
 
-		fifo_wptr_incby(&decode_audio->fifo, bytes_read);
-		nbytes -= bytes_read;
+		fifo_wptr_incby(&decode_audio->fifo, nsamples * FIFO_FRAME_BYTES(bits));
+		nframes -= nsamples;
 
 		transition_samples_in_step += nsamples;
 		while (transition_samples_in_step >= transition_sample_step) {
@@ -261,8 +375,7 @@ static void decode_transition_copy_bytes(sample_t *buffer, size_t nbytes) {
 
 
 void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
-	size_t bytes_out;
-
+	u32_t fifo_bits;
 	/* Some decoders can pass no samples at the start of the track. Stop
 	 * early, otherwise we may send the track start event at the wrong
 	 * time.
@@ -271,6 +384,14 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 		return;
 	}
 
+	/* resample to the fixed output rate, if set */
+	nsamples = decode_resample(&buffer, nsamples, sample_rate);
+	sample_rate = decode_resample_rate(sample_rate);
+
+	if (nsamples == 0) {
+		return;
+	}
+
 	// XXXX full port from ip3k
 
 	decode_audio_lock();
@@ -280,15 +401,20 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 
 		upload_open();
 
+		/* size the fifo for this track when it has been flushed */
+		fifo_bits = decode_track_fifo_bits();
+		decode_resize_fifo(sample_rate, fifo_bits);
+
 		crossfade_started = FALSE;
 		decode_audio->track_start_point = decode_audio->fifo.wptr;
 		
-		if (decode_transition_type & TRANSITION_CROSSFADE) {
+		/* no crossfade across a pending format change */
+		if ((decode_transition_type & TRANSITION_CROSSFADE) && !decode_audio->fifo_bits_pending) {
 			size_t crossfadeBytes;
 			fft_fixed interval;
 
 			if (decode_transition_type & TRANSITION_IMMEDIATE) {
-				size_t wanted = SAMPLES_TO_BYTES(decode_transition_period * decode_audio->track_sample_rate);
+				size_t wanted = FIFO_FRAMES_TO_BYTES(decode_transition_period * decode_audio->track_sample_rate);
 				size_t used = fifo_bytes_used(&decode_audio->fifo);
 
 				if (used > wanted) {
@@ -339,12 +465,24 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 			transition_samples_in_step = 0;
 		}
 
+		if (fifo_bits > decode_fifo_write_bits()) {
+			decode_widen_fifo_bits(crossfade_started ? crossfade_ptr : decode_audio->fifo.wptr, fifo_bits);
+		}
+
 		decode_audio->track_copyright = streambuf_is_copyright();
 		decode_audio->track_sample_rate = sample_rate;
 
 		decode_audio->check_start_point = TRUE;
 		decode_first_buffer = FALSE;
 	}
+	else if (track_bits > DECODE_FIFO_PACKED_BITS
+		 && !decode_resample_active()
+		 && !crossfade_started
+		 && !decode_audio->fifo_bits_pending
+		 && decode_audio->fifo_bits == DECODE_FIFO_PACKED_BITS) {
+		/* the track has outgrown the packed format */
+		decode_widen_fifo_bits(decode_audio->fifo.wptr, 32);
+	}
 
 	if (upload_samples(buffer, nsamples)) {
 		decode_audio_unlock();
@@ -368,16 +506,23 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 
 	decode_apply_track_gain(buffer, nsamples);
 
-	bytes_out = SAMPLES_TO_BYTES(nsamples);
-
-	while (bytes_out) {
-		size_t wrap, bytes_write, bytes_remaining;
+	while (nsamples) {
+		size_t wrap, frames_write, bytes_remaining;
+		u32_t bits = decode_fifo_write_bits();
 
 		/* The size of the output write is limied by the
 		 * space untill our fifo wraps.
 		 */
 		wrap = fifo_bytes_until_wptr_wrap(&decode_audio->fifo);
 
+		/* and by a change of fifo format */
+		if (decode_audio->fifo_bits_pending && bits != decode_audio->fifo_next_bits) {
+			bytes_remaining = decode_fifo_distance(decode_audio->fifo.wptr, decode_audio->fifo_bits_ptr);
+			if (bytes_remaining < wrap) {
+				wrap = bytes_remaining;
+			}
+		}
+
 		/* When crossfading limit the output write to the
 		 * end of the transition.
 		 */
@@ -388,13 +533,13 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 			}
 		}
 
-		bytes_write = bytes_out;
-		if (bytes_write > wrap) {
-			bytes_write = wrap;
+		frames_write = wrap / FIFO_FRAME_BYTES(bits);
+		if (frames_write > nsamples) {
+			frames_write = nsamples;
 		}
 
 		if (transition_gain_step) {
-			decode_transition_copy_bytes(buffer, bytes_write);
+			decode_transition_copy_frames(buffer, frames_write, bits);
 
 			if ((crossfade_started && decode_audio->fifo.wptr == crossfade_ptr)
 			    || transition_gain >= FIXED_ONE) {
@@ -405,12 +550,24 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 			}
 		}
 		else {
-			memcpy(decode_fifo_buf + decode_audio->fifo.wptr, buffer, bytes_write);
-			fifo_wptr_incby(&decode_audio->fifo, bytes_write);
+			/* only the decoder moves wptr, and the output never
+			 * reads the free space, so copy without the lock.
+			 */
+			decode_audio_unlock();
+
+			if (bits == 32) {
+				memcpy(decode_fifo_buf + decode_audio->fifo.wptr, buffer, SAMPLES_TO_BYTES(frames_write));
+			}
+			else {
+				sample_convert.pack16(decode_fifo_buf + decode_audio->fifo.wptr, buffer, frames_write);
+			}
+			fifo_spsc_wptr_incby(&decode_audio->fifo, frames_write * FIFO_FRAME_BYTES(bits));
+
+			decode_audio_lock();
 		}
 
-		buffer += (bytes_write / sizeof(sample_t));
-		bytes_out -= bytes_write;
+		buffer += 2 * frames_write;
+		nsamples -= frames_write;
 	}
 
 	decode_audio_unlock();
@@ -529,6 +686,10 @@ void decode_set_track_polarity_inversion(u8_t inversion) {
 	track_inversion[1] = (inversion & POLARITY_INVERSION_RIGHT) ? -1 : 1;
 }
 
+void decode_output_set_track_bits(u32_t bits) {
+	track_bits = bits;
+}
+
 void decode_set_output_channels(u8_t channels) {
 	LOG_DEBUG(log_audio_decode, "Output channels left %d, right %d",
 		channels & OUTPUT_CHANNEL_LEFT ? 1 : 0, channels & OUTPUT_CHANNEL_RIGHT ? 1 : 0);
@@ -9,6 +9,7 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
 
 
 #define BLOCKSIZE 4096
@@ -22,6 +23,9 @@ struct decode_pcm {
 	u32_t sample_rate;
 	u32_t sample_size;
 	bool_t stereo;
+
+	/* unpack kernel for the sample format */
+	void (*unpack)(sample_t *dst, u8_t *src, size_t frames);
 };
 
 
@@ -37,112 +41,72 @@ static u32_t pcm_sample_widths[] = {
 };
 
 
-static sample_t pcm_read8bit(u8_t *pos) { 
-	// 8 bit wav stores samples as unsigned char
-	return (sample_t) ((((u8_t)*pos) - 128) << 24);
-}
-
-static sample_t pcm_read16bitBE(u8_t *pos) { 
-	sample_t sample = *pos << 24;
-	sample |= *++pos << 16;
-	return sample;
-}
-
-static sample_t pcm_read16bitLE(u8_t *pos) {
-	sample_t sample = *pos << 16;
-	sample |= *++pos << 24;
-	return sample;
-}
+static bool_t decode_pcm_callback(void *data) {
+	struct decode_pcm *self = (struct decode_pcm *) data;
+	u8_t *read_pos;
+	u32_t num_frames, width, frame_size;
+	size_t sz, used;
+
+	width = pcm_sample_widths[self->sample_size];
+	frame_size = self->stereo ? 2 * width : width;
+
+	if (streambuf_has_filter()) {
+		/* the filter must see all of the stream, so read through it
+		 * and keep any partial frame for the next call
+		 */
+		sz = streambuf_read(self->read_buffer + self->leftover, 0, BLOCKSIZE - self->leftover, NULL);
+		if (!sz) {
+			current_decoder_state |= DECODE_STATE_UNDERRUN;
+			return FALSE;
+		}
 
-static sample_t pcm_read24bitBE(u8_t *pos) {
-	sample_t sample = *pos << 24;
-	sample |= *++pos << 16;
-	sample |= *++pos << 8;
-	return sample;
-}
+		current_decoder_state &= ~DECODE_STATE_UNDERRUN;
 
-static sample_t pcm_read24bitLE(u8_t *pos) {
-	sample_t sample = *pos << 8;
-	sample |= *++pos << 16;
-	sample |= *++pos << 24;
-	return sample;
-}
+		sz += self->leftover;
+		num_frames = sz / frame_size;
 
-static sample_t pcm_read32bitBE(u8_t *pos) {
-	sample_t sample = *pos << 24;
-	sample |= *++pos << 16;
-	sample |= *++pos << 8;
-	sample |= *++pos;
-	return sample;
-}
+		self->unpack(self->write_buffer, self->read_buffer, num_frames);
 
-static sample_t pcm_read32bitLE(u8_t *pos) { 
-	/* XXX should this not increment pos? */
-	return *((sample_t *)(void *)pos);
-}
+		self->leftover = sz - (num_frames * frame_size);
+		if (self->leftover) {
+			memmove(self->read_buffer, self->read_buffer + (num_frames * frame_size), self->leftover);
+		}
 
+		if (num_frames) {
+			decode_output_samples(self->write_buffer, num_frames, self->sample_rate);
+		}
 
-typedef sample_t (*pcm_read_func_t)(u8_t *pos);
-static pcm_read_func_t pcm_read_funcs[] = {
-	pcm_read8bit,
-	pcm_read8bit,
-	pcm_read16bitLE,
-	pcm_read16bitBE,
-	pcm_read24bitLE,
-	pcm_read24bitBE,
-	pcm_read32bitLE,
-	pcm_read32bitBE
-};
+		return TRUE;
+	}
 
+	/* parse the samples directly from the streambuf */
+	sz = streambuf_peek(&read_pos, &used, NULL);
+	if (sz < frame_size) {
+		if (used < frame_size) {
+			current_decoder_state |= DECODE_STATE_UNDERRUN;
+			return FALSE;
+		}
 
-static bool_t decode_pcm_callback(void *data) {
-	struct decode_pcm *self = (struct decode_pcm *) data;
-	pcm_read_func_t read_func;
-	sample_t *write_pos;
-	u8_t *read_pos;
-	u32_t s, num_samples;
-	sample_t sample;
-	size_t sz;
-
-	sz = streambuf_read(self->read_buffer + self->leftover, 0, BLOCKSIZE - self->leftover, NULL);
-	if (!sz) {
-		current_decoder_state |= DECODE_STATE_UNDERRUN;
-		return FALSE;
+		/* the frame is split by the streambuf wrap */
+		sz = streambuf_peek_copy(self->read_buffer, frame_size);
+		read_pos = self->read_buffer;
 	}
 
 	current_decoder_state &= ~DECODE_STATE_UNDERRUN;
 
-	sz += self->leftover;
-
-	read_func = pcm_read_funcs[(2 * self->sample_size) + self->big_endian];
-	read_pos = self->read_buffer;
-	write_pos = self->write_buffer;
-
-	num_samples = sz / pcm_sample_widths[self->sample_size];
-	if (self->stereo) {
-		/* we need the same number of sample for both channels */
-		num_samples &= ~0x01;
+	if (sz > BLOCKSIZE) {
+		sz = BLOCKSIZE;
 	}
 
-	for (s = 0; s < num_samples; s++) {
-		sample = read_func(read_pos);
-		*write_pos++ = sample;
-		if (!self->stereo) {
-			*write_pos++ = sample;
-		}
-		read_pos += pcm_sample_widths[self->sample_size];
-	}
+	/* we need the same number of sample for both channels */
+	num_frames = sz / frame_size;
 
-	if (num_samples) {
-		decode_output_samples(self->write_buffer, self->stereo ? num_samples / 2 : num_samples, self->sample_rate);
-	}
+	self->unpack(self->write_buffer, read_pos, num_frames);
 
-	self->leftover = sz - (read_pos - self->read_buffer);
+	streambuf_consume(num_frames * frame_size);
+
+	decode_output_samples(self->write_buffer, num_frames, self->sample_rate);
 
-	if (self->leftover) {
-		memcpy(self->read_buffer, read_pos, self->leftover);
-	}
-					      
 	return TRUE;
 }		
 
@@ -152,6 +116,30 @@ static size_t decode_pcm_samples(void *data) {
 }
 
 
+static u32_t decode_pcm_seek(void *data, u32_t frames) {
+	struct decode_pcm *self = (struct decode_pcm *) data;
+	u32_t frame_size;
+	size_t used;
+
+	frame_size = pcm_sample_widths[self->sample_size];
+	if (self->stereo) {
+		frame_size *= 2;
+	}
+
+	/* skip the whole frames that have been received */
+	used = streambuf_get_usedbytes() / frame_size;
+	if (frames > used) {
+		frames = used;
+	}
+
+	if (!streambuf_skip(frames * frame_size)) {
+		return 0;
+	}
+
+	return frames;
+}
+
+
 static void *decode_pcm_start(u8_t *params, u32_t num_params) {
 	struct decode_pcm *self;
 
@@ -168,6 +156,14 @@ static void *decode_pcm_start(u8_t *params, u32_t num_params) {
 	LOG_DEBUG(log_audio_codec, "sample_size=%d sample_rate=%d stereo=%d big_endian=%d",
 		    self->sample_size, self->sample_rate, self->stereo, self->big_endian);
 
+	self->unpack = sample_convert.pcm_unpack[PCM_UNPACK_INDEX(pcm_sample_widths[self->sample_size], self->big_endian, self->stereo)];
+
+	/* 8 and 16-bit samples can be stored packed */
+	decode_output_set_track_bits(pcm_sample_widths[self->sample_size] <= 2 ? 16 : 32);
+
+	/* used for frames split by the streambuf wrap, and to read a
+	 * filtered stream
+	 */
 	self->read_buffer = malloc(sizeof(u8_t) * BLOCKSIZE);
 	self->write_buffer = malloc(sizeof(sample_t) * 2 * BLOCKSIZE);
 	
@@ -193,4 +189,5 @@ struct decode_module decode_pcm = {
 	decode_pcm_stop,
 	decode_pcm_samples,
 	decode_pcm_callback,
+	decode_pcm_seek,
 };
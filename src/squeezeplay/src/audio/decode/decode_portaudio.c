@@ -11,6 +11,7 @@
 #include "audio/mqueue.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
 
 
 #ifdef HAVE_LIBPORTAUDIO
@@ -37,10 +38,13 @@ static int callback(const void *inputBuffer,
 		    const PaStreamCallbackTimeInfo *timeInfo,
 		    PaStreamCallbackFlags statusFlags,
 		    void *userData) {
-	size_t bytes_used, len, skip_bytes = 0, add_bytes = 0;
+	size_t frames_used, len, skip_frames = 0, add_frames = 0, rptr;
 	int add_silence_ms;
 	bool_t reached_start_point;
 	Uint8 *outputArray = (u8_t *)outputBuffer;
+	struct decode_chunk chunks[DECODE_MAX_CHUNKS];
+	struct decode_fade fade_before, fade_after;
+	int i, num_chunks = 0;
 	u32_t delay;
 	int ret = paContinue;
 
@@ -50,16 +54,16 @@ static int callback(const void *inputBuffer,
 
 	// XXXX full port from ip3k
 
-	len = SAMPLES_TO_BYTES(framesPerBuffer);
+	len = framesPerBuffer;
 
 	decode_audio_lock();
 
-	bytes_used = fifo_bytes_used(&decode_audio->fifo);
+	frames_used = decode_fifo_frames_used();
 
 	/* Should we start the audio now based on having enough decoded data? */
 	if (decode_audio->state & DECODE_STATE_AUTOSTART
-			&& bytes_used >=  len
-			&& bytes_used >= SAMPLES_TO_BYTES((u32_t)((decode_audio->output_threshold * stream_sample_rate) / 10))
+			&& frames_used >=  len
+			&& frames_used >= (u32_t)((decode_audio->output_threshold * stream_sample_rate) / 10)
 		)
 	{
 		u32_t now = jive_jiffies();
@@ -74,7 +78,7 @@ static int callback(const void *inputBuffer,
 
 	/* audio running? */
 	if (!(decode_audio->state & DECODE_STATE_RUNNING)) {
-		memset(outputArray, 0, len);
+		memset(outputArray, 0, SAMPLES_TO_BYTES(len));
 
 		/* mix in sound effects */
 		goto mixin_effects;
@@ -91,12 +95,12 @@ static int callback(const void *inputBuffer,
 
 	add_silence_ms = decode_audio->add_silence_ms;
 	if (add_silence_ms) {
-		add_bytes = SAMPLES_TO_BYTES((u32_t)((add_silence_ms * stream_sample_rate) / 1000));
-		if (add_bytes > len) add_bytes = len;
-		memset(outputArray, 0, add_bytes);
-		outputArray += add_bytes;
-		len -= add_bytes;
-		add_silence_ms -= (BYTES_TO_SAMPLES(add_bytes) * 1000) / stream_sample_rate;
+		add_frames = (u32_t)((add_silence_ms * stream_sample_rate) / 1000);
+		if (add_frames > len) add_frames = len;
+		memset(outputArray, 0, SAMPLES_TO_BYTES(add_frames));
+		outputArray += SAMPLES_TO_BYTES(add_frames);
+		len -= add_frames;
+		add_silence_ms -= (add_frames * 1000) / stream_sample_rate;
 		if (add_silence_ms < 2)
 			add_silence_ms = 0;
 
@@ -108,68 +112,78 @@ static int callback(const void *inputBuffer,
 	}
 
 	/* only skip if it will not cause an underrun */
-	if (bytes_used >= len && decode_audio->skip_ahead_bytes > 0) {
-		skip_bytes = bytes_used - len;
-		if (skip_bytes > decode_audio->skip_ahead_bytes) {
-			skip_bytes = decode_audio->skip_ahead_bytes;			
+	if (frames_used >= len && decode_audio->skip_ahead_frames > 0) {
+		skip_frames = frames_used - len;
+		if (skip_frames > decode_audio->skip_ahead_frames) {
+			skip_frames = decode_audio->skip_ahead_frames;
 		}
 	}
 
-	if (bytes_used > len) {
-		bytes_used = len;
+	if (frames_used > len) {
+		frames_used = len;
 	}
 
 	/* audio underrun? */
-	if (bytes_used == 0) {
+	if (frames_used == 0) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
-		memset(outputArray, 0, len);
+		memset(outputArray, 0, SAMPLES_TO_BYTES(len));
 
 		goto mixin_effects;
 	}
 
-	if (bytes_used < len) {
+	if (frames_used < len) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
-		memset(outputArray + bytes_used, 0, len - bytes_used);
+		memset(outputArray + SAMPLES_TO_BYTES(frames_used), 0, SAMPLES_TO_BYTES(len - frames_used));
 	}
 	else {
 		decode_audio->state &= ~DECODE_STATE_UNDERRUN;
 	}
 
-	if (skip_bytes) {
-		size_t wrap;
+	if (skip_frames) {
+		LOG_DEBUG(log_audio_output, "Skipping %d frames", (int) skip_frames);
+	}
 
-		LOG_DEBUG(log_audio_output, "Skipping %d bytes", (int) skip_bytes);
-		
-		wrap = fifo_bytes_until_rptr_wrap(&decode_audio->fifo);
+	while (skip_frames) {
+		size_t run_frames;
+		u32_t bits;
 
-		if (wrap < skip_bytes) {
-			fifo_rptr_incby(&decode_audio->fifo, wrap);
-			skip_bytes -= wrap;
-			decode_audio->skip_ahead_bytes -= wrap;
-			decode_audio->elapsed_samples += BYTES_TO_SAMPLES(wrap);
+		run_frames = decode_fifo_run(decode_audio->fifo.rptr, &bits) / FIFO_FRAME_BYTES(bits);
+		if (!run_frames) {
+			break;
+		}
+		if (run_frames > skip_frames) {
+			run_frames = skip_frames;
 		}
 
-		fifo_rptr_incby(&decode_audio->fifo, skip_bytes);
-		decode_audio->skip_ahead_bytes -= skip_bytes;
-		decode_audio->elapsed_samples += BYTES_TO_SAMPLES(skip_bytes);
+		decode_fifo_consume(run_frames, bits);
+		decode_audio->skip_ahead_frames -= run_frames;
+		skip_frames -= run_frames;
 	}
 
-	while (bytes_used) {
-		size_t wrap, bytes_write, samples_write;
-		sample_t *output_ptr, *decode_ptr;
+	/* Work out the gains with the fifo locked, but convert the samples
+	 * without it. A chunk ends where the fifo wraps or changes format.
+	 */
+	rptr = decode_audio->fifo.rptr;
+	decode_fade_save(&fade_before);
+
+	while (frames_used) {
+		size_t run_frames, samples_write;
 		s32_t lgain, rgain;
+		u32_t bits;
 		
 		lgain = decode_audio->lgain;
 		rgain = decode_audio->rgain;
 
-		wrap = fifo_bytes_until_rptr_wrap(&decode_audio->fifo);
-
-		bytes_write = bytes_used;
-		if (wrap < bytes_write) {
-			bytes_write = wrap;
+		run_frames = decode_fifo_run(rptr, &bits) / FIFO_FRAME_BYTES(bits);
+		if (!run_frames || num_chunks == DECODE_MAX_CHUNKS) {
+			memset(outputArray, 0, SAMPLES_TO_BYTES(frames_used));
+			break;
 		}
 
-		samples_write = BYTES_TO_SAMPLES(bytes_write);
+		samples_write = frames_used;
+		if (run_frames < samples_write) {
+			samples_write = run_frames;
+		}
 		
 		/* Handle fading and delayed fading */
 		if (decode_audio->samples_to_fade) {
@@ -210,18 +224,55 @@ static int callback(const void *inputBuffer,
 			}
 		}
 
-		output_ptr = (sample_t *)outputArray;
-		decode_ptr = (sample_t *)(decode_fifo_buf + decode_audio->fifo.rptr);
-		while (samples_write--) {
-			*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++));
-			*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++));
+		chunks[num_chunks].decode_ptr = decode_fifo_buf + rptr;
+		chunks[num_chunks].decode_bits = bits;
+		chunks[num_chunks].output_ptr = outputArray;
+		chunks[num_chunks].frames = samples_write;
+		chunks[num_chunks].lgain = lgain;
+		chunks[num_chunks].rgain = rgain;
+		num_chunks++;
+
+		rptr += samples_write * FIFO_FRAME_BYTES(bits);
+		if (rptr == decode_audio->fifo.size) {
+			rptr = 0;
+		}
+
+		outputArray += SAMPLES_TO_BYTES(samples_write);
+		frames_used -= samples_write;
+	}
+
+	if (num_chunks) {
+		u32_t generation = decode_audio->fifo_generation;
+
+		decode_fade_save(&fade_after);
+		decode_audio_unlock();
+
+		for (i = 0; i < num_chunks; i++) {
+			if (chunks[i].decode_bits == 32) {
+				sample_convert.s32(chunks[i].output_ptr, (sample_t *)(void *)chunks[i].decode_ptr, chunks[i].frames, chunks[i].lgain, chunks[i].rgain);
+			}
+			else {
+				sample_convert.packed_s32(chunks[i].output_ptr, (s16_t *)(void *)chunks[i].decode_ptr, chunks[i].frames, chunks[i].lgain, chunks[i].rgain);
+			}
+		}
+
+		fifo_barrier();
+		if (generation == decode_audio->fifo_generation) {
+			for (i = 0; i < num_chunks; i++) {
+				decode_tap_write(chunks[i].decode_ptr, chunks[i].frames, chunks[i].decode_bits,
+					delay + BYTES_TO_SAMPLES(chunks[i].output_ptr - (u8_t *)outputBuffer),
+					stream_sample_rate);
+			}
 		}
 
-		fifo_rptr_incby(&decode_audio->fifo, bytes_write);
-		decode_audio->elapsed_samples += BYTES_TO_SAMPLES(bytes_write);
+		decode_audio_lock();
 
-		outputArray += bytes_write;
-		bytes_used -= bytes_write;
+		/* the decoder may have reset the fifo while it was unlocked */
+		if (!decode_fifo_commit(chunks, num_chunks, generation, &fade_before, &fade_after)) {
+			for (i = 0; i < num_chunks; i++) {
+				memset(chunks[i].output_ptr, 0, SAMPLES_TO_BYTES(chunks[i].frames));
+			}
+		}
 	}
 
 	reached_start_point = decode_check_start_point();
@@ -399,12 +450,12 @@ static int decode_portaudio_init(lua_State *L) {
 	outputParam.suggestedLatency = Pa_GetDeviceInfo(outputParam.device)->defaultHighOutputLatency;
 
 	/* allocate output memory */
-	buf = malloc(DECODE_AUDIO_BUFFER_SIZE);
+	buf = malloc(DECODE_AUDIO_BUFFER_SIZE(decode_fifo_capacity));
 	if (!buf) {
 		goto err0;
 	}
 
-	decode_init_buffers(buf, false);
+	decode_init_buffers(buf, decode_fifo_capacity, false);
 	decode_audio->max_rate = 48000;
 
 	/* open stream */
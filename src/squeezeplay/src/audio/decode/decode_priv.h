@@ -68,6 +68,10 @@ struct decode_module {
 	size_t (*samples)(void *data);
 	/* callback to decode samples to output buffer */
 	bool_t (*callback)(void *data);
+	/* skip forward by at most frames within the streambuf, returns the
+	 * number of frames skipped. may be NULL.
+	 */
+	u32_t (*seek)(void *data, u32_t frames);
 };
 
 
@@ -114,6 +118,19 @@ extern void decode_set_track_polarity_inversion(u8_t inversion);
 extern void decode_set_output_channels(u8_t channels);
 extern void decode_set_trigger_resume(void);
 
+extern void decode_output_set_track_bits(u32_t bits);
+
+/* Decoders allocate their scratch buffers with decode_realloc() when the
+ * track starts. Calls to decode_realloc() while the track is playing are
+ * counted in decode_running_reallocs, steady state decoding should not
+ * grow these buffers. Only decode_realloc() is counted, malloc calls in
+ * the decoders and codec libraries are not, so these must only allocate
+ * when a decoder starts. Define DECODE_REALLOC_CHECK to assert on a
+ * counted call.
+ */
+extern void *decode_realloc(void *ptr, size_t size);
+extern u32_t decode_running_reallocs;
+
 
 /* Audio output backends */
 struct decode_audio_func {
@@ -124,11 +141,21 @@ struct decode_audio_func {
 	void (*stop)(void);
 };
 
+/* The visualizer tap holds the last frames sent to the output as 16-bit
+ * stereo. DECODE_TAP_FRAMES must be a power of two, and the output writes
+ * at most DECODE_TAP_CHUNK frames before publishing them.
+ */
+#define DECODE_TAP_FRAMES 32768
+#define DECODE_TAP_CHUNK 4096
+
 struct decode_audio {
 	struct decode_audio_func *f;
 
-	/* fifo locks: playback state, track state, sync state */
+	/* fifo locks: playback state, track state, sync state. the samples
+	 * are written and read without the lock, see fifo_spsc_*
+	 */
 	struct fifo fifo;
+	u32_t fifo_generation; /* changed when the pointers are reset */
 
 	/* playback state */
 	bool_t running;
@@ -151,7 +178,7 @@ struct decode_audio {
 	u32_t num_tracks_started;
 	
 	/* sync state */
-	size_t skip_ahead_bytes;
+	size_t skip_ahead_frames;
 	int add_silence_ms;
 	u32_t start_at_jiffies;
 
@@ -161,6 +188,13 @@ struct decode_audio {
 
 	/* device info */
 	u32_t max_rate;
+
+	/* sample rate switches without reopening the device, and the gap
+	 * in playback they caused.
+	 */
+	u32_t rate_switch_count;
+	u32_t rate_switch_us;
+	u32_t rate_switch_max_us;
 	
 	/* fading state */
 	u32_t samples_until_fade;
@@ -170,28 +204,98 @@ struct decode_audio {
 	fft_fixed transition_gain_step;
 	u32_t transition_sample_step;
 	u32_t transition_samples_in_step;
+
+	/* decode fifo sizing */
+	size_t fifo_capacity;
+	u32_t fifo_time; /* seconds */
+
+	/* decode fifo format: bits per sample at rptr, and a change to
+	 * fifo_next_bits pending at fifo_bits_ptr.
+	 */
+	u32_t fifo_bits;
+	u32_t fifo_next_bits;
+	bool_t fifo_bits_pending;
+	size_t fifo_bits_ptr;
+
+	/* visualizer tap, written by the output without the lock. tap_seq
+	 * is odd while the other fields are updated. tap_delay is the number
+	 * of frames before tap_wptr that had not been played at tap_jiffies.
+	 */
+	u32_t tap_seq;
+	u32_t tap_wptr;
+	u32_t tap_delay;
+	u32_t tap_jiffies;
+	u32_t tap_sample_rate;
+	s16_t tap_buf[2 * DECODE_TAP_FRAMES];
 };
 
 extern struct decode_audio *decode_audio;
 
+/* Bytes from position from to position to in the decode fifo */
+static inline size_t decode_fifo_distance(size_t from, size_t to) {
+	return (to >= from) ? (to - from) : (to + decode_audio->fifo.size - from);
+}
+
 #define decode_audio_lock() fifo_lock(&(decode_audio->fifo))
 #define decode_audio_unlock() fifo_unlock(&(decode_audio->fifo))
 
 #define ASSERT_AUDIO_LOCKED() ASSERT_FIFO_LOCKED(&(decode_audio->fifo))
 
+/* A run of frames read from the decode fifo by the output. The output
+ * plans the chunks with the fifo locked, converts them without the lock
+ * and then releases them with decode_fifo_commit.
+ */
+struct decode_chunk {
+	u8_t *decode_ptr;
+	u32_t decode_bits;
+	u8_t *output_ptr;
+	size_t frames;
+	s32_t lgain, rgain;
+};
+
+/* the fifo may wrap on both sides of a format change */
+#define DECODE_MAX_CHUNKS 4
+
+/* Output fade state, advanced while the chunks are planned */
+struct decode_fade {
+	u32_t samples_until_fade;
+	fft_fixed transition_gain;
+	fft_fixed transition_gain_step;
+	u32_t transition_sample_step;
+	u32_t transition_samples_in_step;
+};
+
 /* Audio output backends */
 extern struct decode_audio_func decode_alsa;
 extern struct decode_audio_func decode_portaudio;
 extern struct decode_audio_func decode_null;
 
 /* Decode output api */
-extern void decode_init_buffers(void *buf, bool_t prio_inherit);
+extern void decode_init_buffers(void *buf, size_t fifo_capacity, bool_t prio_inherit);
+extern size_t decode_fifo_frames_used(void);
+extern size_t decode_fifo_run(size_t pos, u32_t *bits);
+extern void decode_fifo_consume(size_t frames, u32_t bits);
+extern void decode_fade_save(struct decode_fade *fade);
+extern bool_t decode_fifo_commit(struct decode_chunk *chunks, int num_chunks, u32_t generation, struct decode_fade *before, struct decode_fade *after);
+extern void decode_tap_write(u8_t *src, size_t frames, u32_t bits, u32_t delay, u32_t sample_rate);
+extern size_t decode_tap_read(s16_t *buf, size_t frames);
 extern void decode_output_begin(void);
 extern void decode_output_end(void);
 extern void decode_output_flush(void);
 extern bool_t decode_check_start_point(void);
 extern void decode_mix_effects(void *outputBuffer, size_t framesPerBuffer, int sample_width, int output_sample_rate);
 
+/* Resampling to a fixed output rate, a rate of zero turns it off. A
+ * quality below zero selects the default for the platform.
+ */
+extern bool_t decode_resample_set(u32_t rate, int quality);
+extern u32_t decode_resample_rate(u32_t sample_rate);
+extern bool_t decode_resample_active(void);
+extern size_t decode_resample_max_frames(size_t frames, bool_t new_track);
+extern size_t decode_resample(sample_t **buffer, size_t frames, u32_t sample_rate);
+extern void decode_resample_reset(void);
+extern void decode_resample_prepare(size_t frames);
+
 
 /* Sample playback api (sound effects) */
 extern int decode_sample_init(lua_State *L);
@@ -208,18 +312,34 @@ extern int decode_spectrum_init(lua_State *L);
 #define SAMPLES_TO_BYTES(n)  (2 * (n) * sizeof(sample_t))
 #define BYTES_TO_SAMPLES(n)  ((n) / (2 * sizeof(sample_t)))
 
+/* The decode fifo holds interleaved stereo frames of sample_t, or of
+ * 16-bit samples for tracks that are no wider (see fifo_bits). Only the
+ * output converts the samples to the device format.
+ */
+#define DECODE_FIFO_PACKED_BITS 16
+#define FIFO_FRAME_BYTES(bits) (2 * ((bits) >> 3))
+#define FIFO_BYTES_TO_FRAMES(n) ((n) / FIFO_FRAME_BYTES(decode_audio->fifo_bits))
+#define FIFO_FRAMES_TO_BYTES(n) ((n) * FIFO_FRAME_BYTES(decode_audio->fifo_bits))
+
 /* State variables for the current track */
 extern bool_t decode_first_buffer;
 
 
-/* The fifo used to store decoded samples */
-#define DECODE_FIFO_SIZE (10 * 2 * 44100 * sizeof(sample_t)) 
+/* The fifo used to store decoded samples. The buffer is allocated with
+ * the capacity given in the platform settings, and the fifo is resized
+ * to hold fifo_time seconds at the track sample rate.
+ */
+#define DECODE_FIFO_TIME 10
+#define DECODE_FIFO_SIZE (DECODE_FIFO_TIME * 2 * 44100 * sizeof(sample_t)) 
+#define DECODE_FIFO_MIN_SIZE (2 * 44100 * sizeof(sample_t))
 extern u8_t *decode_fifo_buf;
+extern size_t decode_fifo_capacity;
 
 #define EFFECT_FIFO_SIZE (1 * 1 * 44100 * sizeof(effect_t))
 extern u8_t *effect_fifo_buf;
 
-#define DECODE_AUDIO_BUFFER_SIZE (sizeof(struct decode_audio) + DECODE_FIFO_SIZE + EFFECT_FIFO_SIZE)
+/* shared memory layout: struct decode_audio, effect fifo, decode fifo */
+#define DECODE_AUDIO_BUFFER_SIZE(fifo_capacity) (sizeof(struct decode_audio) + EFFECT_FIFO_SIZE + (fifo_capacity))
 
 /* Decode message queue */
 extern struct mqueue decode_mqueue;
@@ -230,7 +350,7 @@ extern struct mqueue decode_mqueue;
  * down till we find an interval that we have enough audio for.
  */
 static fft_fixed determine_transition_interval(u32_t sample_rate, u32_t transition_period, size_t *nbytes) {
-	size_t bytes_used, sample_step_bytes;
+	size_t frames_used, frames;
 	fft_fixed interval, interval_step;
 	u32_t transition_sample_step;
 
@@ -240,24 +360,24 @@ static fft_fixed determine_transition_interval(u32_t sample_rate, u32_t transiti
 		return 0;
 	}
 
-	bytes_used = fifo_bytes_used(&decode_audio->fifo);
-	*nbytes = SAMPLES_TO_BYTES(TRANSITION_MINIMUM_SECONDS * sample_rate);
-	if (bytes_used < *nbytes) {
+	frames_used = decode_fifo_frames_used();
+	if (frames_used < TRANSITION_MINIMUM_SECONDS * sample_rate) {
 		return 0;
 	}
 
-	*nbytes = SAMPLES_TO_BYTES(transition_period * sample_rate);
+	frames = transition_period * sample_rate;
 	transition_sample_step = sample_rate / TRANSITION_STEPS_PER_SECOND;
-	sample_step_bytes = SAMPLES_TO_BYTES(transition_sample_step);
 
 	interval = s32_to_fixed(transition_period);
 	interval_step = fixed_div(FIXED_ONE, TRANSITION_STEPS_PER_SECOND);
 
-	while (bytes_used < (*nbytes + sample_step_bytes)) {
-		*nbytes -= sample_step_bytes;
+	while (frames_used < (frames + transition_sample_step)) {
+		frames -= transition_sample_step;
 		interval -= interval_step;
 	}
 
+	*nbytes = FIFO_FRAMES_TO_BYTES(frames);
+
 	return interval;
 }
 
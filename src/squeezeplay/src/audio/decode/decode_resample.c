@@ -0,0 +1,285 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "audio/fifo.h"
+#include "audio/fixed_math.h"
+#include "audio/decode/decode_priv.h"
+
+
+/* Resampling stage between the decoders and the decode fifo. When an
+ * output rate is set every track is resampled to that rate, so the
+ * device does not need to be reopened between tracks and tracks of
+ * different rates can be crossfaded. This uses the fixed-point build
+ * of the speex resampler, so samples are resampled at 16-bit precision.
+ *
+ * All functions are called from the decoder thread. The buffers are sized
+ * when a track's rate is first seen, so steady state resampling does not
+ * use the heap.
+ */
+
+#ifdef RESAMPLE_DECODE
+#   include "../speex/speex_resampler.h"
+
+/* frames converted to 16-bit per call to the resampler */
+#define RESAMPLE_CHUNK_FRAMES 512
+
+/* lowest input rate, used to bound the output before a track starts */
+#define RESAMPLE_MIN_RATE 8000
+
+#ifdef __arm__
+#define RESAMPLE_DEFAULT_QUALITY 3
+#else
+#define RESAMPLE_DEFAULT_QUALITY SPEEX_RESAMPLER_QUALITY_DESKTOP
+#endif
+
+static SpeexResamplerState *resampler;
+
+/* output rate, or zero when not resampling */
+static u32_t resample_out_rate;
+
+/* input rate of the resampler, or zero when its history is not valid */
+static u32_t resample_in_rate;
+
+/* rate of the last decoded samples */
+static u32_t resample_track_rate;
+
+/* input rate that could not be resampled, tracks at this rate are
+ * played at their own rate
+ */
+static u32_t resample_skip_rate;
+
+/* most frames the decoder passes at once, the buffers are resized for
+ * a new track
+ */
+static size_t resample_max_in_frames = RESAMPLE_CHUNK_FRAMES;
+static bool_t resample_resize = TRUE;
+
+static s16_t resample_in[2 * RESAMPLE_CHUNK_FRAMES];
+static s16_t *resample_out;
+static size_t resample_out_frames;
+
+static sample_t *resample_buf;
+static size_t resample_buf_frames;
+
+
+bool_t decode_resample_set(u32_t rate, int quality) {
+	int err;
+
+	if (quality < 0) {
+		quality = RESAMPLE_DEFAULT_QUALITY;
+	}
+
+	if (resampler) {
+		jive_resampler_destroy(resampler);
+		resampler = NULL;
+	}
+
+	resample_out_rate = 0;
+	resample_in_rate = 0;
+
+	if (!rate) {
+		return TRUE;
+	}
+
+	resampler = jive_resampler_init(2, rate, rate, quality, &err);
+	if (!resampler) {
+		return FALSE;
+	}
+
+	resample_out_rate = rate;
+
+	return TRUE;
+}
+
+
+u32_t decode_resample_rate(u32_t sample_rate) {
+	return resample_in_rate ? resample_out_rate : sample_rate;
+}
+
+
+bool_t decode_resample_active(void) {
+	return resample_in_rate != 0;
+}
+
+
+size_t decode_resample_max_frames(size_t frames, bool_t new_track) {
+	u32_t in_rate;
+
+	if (!resample_out_rate) {
+		return frames;
+	}
+
+	in_rate = resample_track_rate;
+	if (new_track || !in_rate) {
+		/* the rate of a new track is not known until it is decoded */
+		in_rate = RESAMPLE_MIN_RATE;
+	}
+
+	return (size_t)(((u64_t)frames * resample_out_rate) / in_rate) + (frames / RESAMPLE_CHUNK_FRAMES) + 2;
+}
+
+
+void decode_resample_reset(void) {
+	resample_in_rate = 0;
+}
+
+
+void decode_resample_prepare(size_t frames) {
+	resample_max_in_frames = frames;
+	resample_skip_rate = 0;
+	resample_resize = TRUE;
+}
+
+
+/* grow the buffers for resampling from sample_rate, on failure the old
+ * buffers are kept
+ */
+static bool_t resample_alloc(u32_t sample_rate) {
+	size_t out_frames, buf_frames;
+
+	out_frames = (size_t)(((u64_t)RESAMPLE_CHUNK_FRAMES * resample_out_rate) / sample_rate) + 2;
+	if (out_frames > resample_out_frames) {
+		s16_t *out;
+
+		out = decode_realloc(resample_out, out_frames * 2 * sizeof(s16_t));
+		if (!out) {
+			return FALSE;
+		}
+
+		resample_out = out;
+		resample_out_frames = out_frames;
+	}
+
+	buf_frames = (size_t)(((u64_t)resample_max_in_frames * resample_out_rate) / sample_rate) + (resample_max_in_frames / RESAMPLE_CHUNK_FRAMES) + 2;
+	if (buf_frames > resample_buf_frames) {
+		sample_t *buf;
+
+		buf = decode_realloc(resample_buf, SAMPLES_TO_BYTES(buf_frames));
+		if (!buf) {
+			return FALSE;
+		}
+
+		resample_buf = buf;
+		resample_buf_frames = buf_frames;
+	}
+
+	return TRUE;
+}
+
+
+size_t decode_resample(sample_t **buffer, size_t frames, u32_t sample_rate) {
+	sample_t *src, *dst;
+	size_t out_frames = 0, i;
+
+	resample_track_rate = sample_rate;
+
+	if (!resample_out_rate || sample_rate == resample_out_rate || sample_rate == resample_skip_rate) {
+		resample_in_rate = 0;
+		return frames;
+	}
+
+	if (resample_resize || resample_in_rate != sample_rate) {
+		if (!resample_alloc(sample_rate)) {
+			LOG_ERROR(log_audio_codec, "resample buffers failed, playing %d Hz", sample_rate);
+
+			resample_skip_rate = sample_rate;
+			resample_in_rate = 0;
+			return frames;
+		}
+
+		resample_resize = FALSE;
+	}
+
+	if (resample_in_rate != sample_rate) {
+		if (!resample_in_rate) {
+			/* start without the filter delay */
+			jive_resampler_reset_mem(resampler);
+			jive_resampler_set_rate(resampler, sample_rate, resample_out_rate);
+			jive_resampler_skip_zeros(resampler);
+		}
+		else {
+			/* keep the history at a gapless rate change */
+			jive_resampler_set_rate(resampler, sample_rate, resample_out_rate);
+		}
+
+		resample_in_rate = sample_rate;
+	}
+
+	src = *buffer;
+	dst = resample_buf;
+
+	while (frames) {
+		spx_uint32_t in_len, out_len;
+		size_t n;
+
+		n = frames;
+		if (n > RESAMPLE_CHUNK_FRAMES) {
+			n = RESAMPLE_CHUNK_FRAMES;
+		}
+
+		for (i = 0; i < n * 2; i++) {
+			resample_in[i] = (s16_t)(src[i] >> 16);
+		}
+
+		in_len = n;
+		out_len = resample_out_frames;
+		jive_resampler_process_interleaved_int(resampler, resample_in, &in_len, resample_out, &out_len);
+
+		if (out_frames + out_len > resample_buf_frames) {
+			out_len = resample_buf_frames - out_frames;
+		}
+
+		for (i = 0; i < out_len * 2; i++) {
+			dst[i] = resample_out[i] << 16;
+		}
+
+		dst += out_len * 2;
+		out_frames += out_len;
+
+		if (in_len == 0) {
+			break;
+		}
+
+		src += in_len * 2;
+		frames -= in_len;
+	}
+
+	*buffer = resample_buf;
+
+	return out_frames;
+}
+
+#else
+
+bool_t decode_resample_set(u32_t rate, int quality) {
+	return rate == 0;
+}
+
+u32_t decode_resample_rate(u32_t sample_rate) {
+	return sample_rate;
+}
+
+bool_t decode_resample_active(void) {
+	return FALSE;
+}
+
+size_t decode_resample_max_frames(size_t frames, bool_t new_track) {
+	return frames;
+}
+
+void decode_resample_reset(void) {
+}
+
+void decode_resample_prepare(size_t frames) {
+}
+
+size_t decode_resample(sample_t **buffer, size_t frames, u32_t sample_rate) {
+	return frames;
+}
+
+#endif
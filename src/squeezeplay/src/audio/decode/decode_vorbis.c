@@ -277,6 +277,9 @@ static void *decode_vorbis_start(u8_t *params, u32_t num_params) {
 
 	self->output_buffer = malloc(OUTPUT_BUFFER_SIZE);
 	self->state = OGG_STATE_INIT;
+
+	/* tremor decodes to 16-bit */
+	decode_output_set_track_bits(16);
 	
 	return self;
 }
@@ -0,0 +1,308 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "audio/fixed_math.h"
+#include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
+
+
+/* The SIMD kernels are built in their own files with the compiler flags
+ * for the instruction set, configure defines HAVE_SAMPLE_CONVERT_SSE2 or
+ * HAVE_SAMPLE_CONVERT_NEON when they are built. Configure only checks the
+ * compiler, the kernels are selected at runtime from cpuid or the kernel
+ * hwcaps.
+ *
+ * Fab4 (ARM1136) and Baby (ARM926) have no NEON unit and their compilers
+ * don't build NEON, so they always use the C kernels.
+ */
+#if defined(HAVE_SAMPLE_CONVERT_SSE2) && defined(__i386__)
+#include <cpuid.h>
+#endif
+
+
+struct sample_convert_func sample_convert;
+
+
+/*
+ * Scalar kernels
+ */
+
+static void convert_s32_c(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	sample_t *output_ptr = (sample_t *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, *(src++));
+		*(output_ptr++) = fixed_mul(rgain, *(src++));
+	}
+}
+
+
+static void convert_s24_c(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	Sint32 *output_ptr = (Sint32 *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, *(src++)) >> 8;
+		*(output_ptr++) = fixed_mul(rgain, *(src++)) >> 8;
+	}
+}
+
+
+static inline void pack_s24_3(u8_t *output_ptr, sample_t lsample, sample_t rsample) {
+	*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
+	*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
+	*(output_ptr++) = (lsample & 0xff000000) >> 24;
+	*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
+	*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
+	*(output_ptr++) = (rsample & 0xff000000) >> 24;
+}
+
+
+static void convert_s24_3_c(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	u8_t *output_ptr = (u8_t *)dst;
+
+	while (frames--) {
+		sample_t lsample = fixed_mul(lgain, *(src++));
+		sample_t rsample = fixed_mul(rgain, *(src++));
+
+		pack_s24_3(output_ptr, lsample, rsample);
+		output_ptr += 6;
+	}
+}
+
+
+static void convert_s16_c(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	Sint16 *output_ptr = (Sint16 *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, *(src++)) >> 16;
+		*(output_ptr++) = fixed_mul(rgain, *(src++)) >> 16;
+	}
+}
+
+
+static inline sample_t volume_mul(sample_t sample, fft_fixed gain, sample_t clip_range[2]) {
+	if (sample > clip_range[0]) {
+		return SAMPLE_MAX;
+	}
+	if (sample < clip_range[1]) {
+		return SAMPLE_MIN;
+	}
+
+	return fixed_mul(gain, sample);
+}
+
+
+static void track_gain_c(sample_t *buf, size_t frames, fft_fixed gain, sample_t clip_range[2], s32_t inversion[2]) {
+	while (frames--) {
+		*buf = inversion[0] * volume_mul(*buf, gain, clip_range);
+		buf++;
+		*buf = inversion[1] * volume_mul(*buf, gain, clip_range);
+		buf++;
+	}
+}
+
+
+static void pack16_c(void *dst, sample_t *src, size_t frames) {
+	s16_t *output_ptr = (s16_t *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = *(src++) >> 16;
+		*(output_ptr++) = *(src++) >> 16;
+	}
+}
+
+
+static void packed_s32_c(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	sample_t *output_ptr = (sample_t *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, (sample_t)*(src++) << 16);
+		*(output_ptr++) = fixed_mul(rgain, (sample_t)*(src++) << 16);
+	}
+}
+
+
+static void packed_s24_c(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	Sint32 *output_ptr = (Sint32 *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, (sample_t)*(src++) << 16) >> 8;
+		*(output_ptr++) = fixed_mul(rgain, (sample_t)*(src++) << 16) >> 8;
+	}
+}
+
+
+static void packed_s24_3_c(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	u8_t *output_ptr = (u8_t *)dst;
+
+	while (frames--) {
+		sample_t lsample = fixed_mul(lgain, (sample_t)*(src++) << 16);
+		sample_t rsample = fixed_mul(rgain, (sample_t)*(src++) << 16);
+
+		pack_s24_3(output_ptr, lsample, rsample);
+		output_ptr += 6;
+	}
+}
+
+
+static void packed_s16_c(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	Sint16 *output_ptr = (Sint16 *)dst;
+
+	while (frames--) {
+		*(output_ptr++) = fixed_mul(lgain, (sample_t)*(src++) << 16) >> 16;
+		*(output_ptr++) = fixed_mul(rgain, (sample_t)*(src++) << 16) >> 16;
+	}
+}
+
+
+/* The streambuf data is not aligned, so the pcm samples are read a byte
+ * at a time. 8 bit wav stores samples as unsigned char.
+ */
+static inline sample_t pcm_read8(u8_t *p) {
+	return (sample_t)((u32_t)(p[0] ^ 0x80) << 24);
+}
+
+static inline sample_t pcm_read16le(u8_t *p) {
+	return (sample_t)(((u32_t)p[1] << 24) | ((u32_t)p[0] << 16));
+}
+
+static inline sample_t pcm_read16be(u8_t *p) {
+	return (sample_t)(((u32_t)p[0] << 24) | ((u32_t)p[1] << 16));
+}
+
+static inline sample_t pcm_read24le(u8_t *p) {
+	return (sample_t)(((u32_t)p[2] << 24) | ((u32_t)p[1] << 16) | ((u32_t)p[0] << 8));
+}
+
+static inline sample_t pcm_read24be(u8_t *p) {
+	return (sample_t)(((u32_t)p[0] << 24) | ((u32_t)p[1] << 16) | ((u32_t)p[2] << 8));
+}
+
+static inline sample_t pcm_read32le(u8_t *p) {
+	return (sample_t)(((u32_t)p[3] << 24) | ((u32_t)p[2] << 16) | ((u32_t)p[1] << 8) | (u32_t)p[0]);
+}
+
+static inline sample_t pcm_read32be(u8_t *p) {
+	return (sample_t)(((u32_t)p[0] << 24) | ((u32_t)p[1] << 16) | ((u32_t)p[2] << 8) | (u32_t)p[3]);
+}
+
+
+/* Mono and stereo unpack kernels for one sample format */
+#define PCM_UNPACK_C(fmt, width) \
+static void unpack_##fmt##_mono_c(sample_t *dst, u8_t *src, size_t frames) { \
+	while (frames--) { \
+		sample_t sample = pcm_read##fmt(src); \
+		*(dst++) = sample; \
+		*(dst++) = sample; \
+		src += (width); \
+	} \
+} \
+static void unpack_##fmt##_stereo_c(sample_t *dst, u8_t *src, size_t frames) { \
+	while (frames--) { \
+		*(dst++) = pcm_read##fmt(src); \
+		*(dst++) = pcm_read##fmt(src + (width)); \
+		src += 2 * (width); \
+	} \
+}
+
+PCM_UNPACK_C(8, 1)
+PCM_UNPACK_C(16le, 2)
+PCM_UNPACK_C(16be, 2)
+PCM_UNPACK_C(24le, 3)
+PCM_UNPACK_C(24be, 3)
+PCM_UNPACK_C(32le, 4)
+PCM_UNPACK_C(32be, 4)
+
+
+struct sample_convert_func sample_convert_scalar = {
+	"c",
+	convert_s32_c,
+	convert_s24_c,
+	convert_s24_3_c,
+	convert_s16_c,
+	track_gain_c,
+	pack16_c,
+	packed_s32_c,
+	packed_s24_c,
+	packed_s24_3_c,
+	packed_s16_c,
+	{
+		unpack_8_mono_c, unpack_8_stereo_c, unpack_8_mono_c, unpack_8_stereo_c,
+		unpack_16le_mono_c, unpack_16le_stereo_c, unpack_16be_mono_c, unpack_16be_stereo_c,
+		unpack_24le_mono_c, unpack_24le_stereo_c, unpack_24be_mono_c, unpack_24be_stereo_c,
+		unpack_32le_mono_c, unpack_32le_stereo_c, unpack_32be_mono_c, unpack_32be_stereo_c,
+	},
+};
+
+
+#ifdef HAVE_SAMPLE_CONVERT_SSE2
+
+static bool_t cpu_has_sse2(void) {
+#if defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (edx & bit_SSE2) != 0;
+#else
+	/* always present on x86_64 */
+	return true;
+#endif
+}
+
+#endif // HAVE_SAMPLE_CONVERT_SSE2
+
+
+#ifdef HAVE_SAMPLE_CONVERT_NEON
+
+static bool_t cpu_has_neon(void) {
+#if defined(__arm__) && defined(__linux__)
+	/* NEON is optional on armv7, check the kernel hwcaps */
+	unsigned long auxv[2];
+	bool_t neon = false;
+	FILE *fp;
+
+	fp = fopen("/proc/self/auxv", "r");
+	if (!fp) {
+		return false;
+	}
+
+	while (fread(auxv, sizeof(auxv), 1, fp) == 1) {
+		if (auxv[0] == 16 /* AT_HWCAP */) {
+			neon = (auxv[1] & (1 << 12) /* HWCAP_NEON */) != 0;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return neon;
+#else
+	/* always present on aarch64 */
+	return true;
+#endif
+}
+
+#endif // HAVE_SAMPLE_CONVERT_NEON
+
+
+void sample_convert_init(void) {
+	sample_convert = sample_convert_scalar;
+
+#ifdef HAVE_SAMPLE_CONVERT_SSE2
+	if (cpu_has_sse2()) {
+		sample_convert_sse2_init(&sample_convert);
+	}
+#endif
+
+#ifdef HAVE_SAMPLE_CONVERT_NEON
+	if (cpu_has_neon()) {
+		sample_convert_neon_init(&sample_convert);
+	}
+#endif
+}
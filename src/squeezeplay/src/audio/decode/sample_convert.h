@@ -0,0 +1,72 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#ifndef AUDIO_SAMPLE_CONVERT_H
+#define AUDIO_SAMPLE_CONVERT_H
+
+#include "audio/decode/decode_priv.h"
+
+
+/* PCM unpack kernels, by sample width in bytes, endianness and channels */
+#define PCM_UNPACK_INDEX(width, big_endian, stereo) ((((width) - 1) << 2) | ((big_endian) ? 2 : 0) | ((stereo) ? 1 : 0))
+#define PCM_UNPACK_NUM 16
+
+
+/* Sample conversion kernels. These apply the left and right gains to
+ * interleaved stereo samples from the decode fifo, and pack the result
+ * in the output format. The vectorized kernels give the same results as
+ * fixed_mul.
+ */
+struct sample_convert_func {
+	const char *name;
+
+	/* 32-bit native endian */
+	void (*s32)(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain);
+
+	/* 24-bit in the low three bytes of a 32-bit word, little endian */
+	void (*s24)(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain);
+
+	/* 24-bit packed in three bytes, little endian */
+	void (*s24_3)(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain);
+
+	/* 16-bit native endian */
+	void (*s16)(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain);
+
+	/* Replay gain, clip and polarity inversion in place */
+	void (*track_gain)(sample_t *buf, size_t frames, fft_fixed gain, sample_t clip_range[2], s32_t inversion[2]);
+
+	/* Pack samples with no more than 16 significant bits */
+	void (*pack16)(void *dst, sample_t *src, size_t frames);
+
+	/* The output conversions from packed 16-bit samples */
+	void (*packed_s32)(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain);
+	void (*packed_s24)(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain);
+	void (*packed_s24_3)(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain);
+	void (*packed_s16)(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain);
+
+	/* Unpack interleaved pcm into stereo frames, mono is duplicated to
+	 * both channels. Indexed by PCM_UNPACK_INDEX, src need not be aligned.
+	 */
+	void (*pcm_unpack[PCM_UNPACK_NUM])(sample_t *dst, u8_t *src, size_t frames);
+};
+
+
+/* The kernels selected for this cpu, valid after sample_convert_init() */
+extern struct sample_convert_func sample_convert;
+
+/* The portable C kernels */
+extern struct sample_convert_func sample_convert_scalar;
+
+/* Replace the kernels in f with the SIMD kernels, f starts as a copy of
+ * the C kernels.
+ */
+extern void sample_convert_sse2_init(struct sample_convert_func *f);
+extern void sample_convert_neon_init(struct sample_convert_func *f);
+
+extern void sample_convert_init(void);
+
+#endif // AUDIO_SAMPLE_CONVERT_H
@@ -0,0 +1,247 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+/*
+ * Micro-benchmark for the sample conversion kernels. Runs the C kernels,
+ * which are the loops previously used in the output backends, and the
+ * kernels selected for this cpu over the same data and checks that the
+ * results match. The pcm unpack kernels are reported in MB/s of input.
+ *
+ * sample_convert_bench [frames] [iterations]
+ */
+
+#include "common.h"
+
+#include "audio/fixed_math.h"
+#include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
+
+
+#define DEFAULT_FRAMES 4096
+#define DEFAULT_ITERATIONS 2000
+
+
+enum bench_kernel {
+	BENCH_S32 = 0,
+	BENCH_S24,
+	BENCH_S24_3,
+	BENCH_S16,
+	BENCH_TRACK_GAIN,
+	BENCH_PACK16,
+	BENCH_PACKED_S32,
+	BENCH_PACKED_S24,
+	BENCH_PACKED_S24_3,
+	BENCH_PACKED_S16,
+	BENCH_NUM_KERNELS
+};
+
+static const char *bench_names[BENCH_NUM_KERNELS] = {
+	"s32", "s24", "s24_3", "s16", "track_gain",
+	"pack16", "packed_s32", "packed_s24", "packed_s24_3", "packed_s16"
+};
+
+static const size_t bench_sizes[BENCH_NUM_KERNELS] = {
+	8, 8, 6, 4, 8,
+	4, 8, 8, 6, 4
+};
+
+
+static const char *unpack_names[PCM_UNPACK_NUM] = {
+	"u8 mono", "u8 stereo", NULL, NULL,
+	"s16le mono", "s16le stereo", "s16be mono", "s16be stereo",
+	"s24le mono", "s24le stereo", "s24be mono", "s24be stereo",
+	"s32le mono", "s32le stereo", "s32be mono", "s32be stereo"
+};
+
+
+static double now_us(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+
+static void run_kernel(struct sample_convert_func *func, enum bench_kernel k, void *dst, sample_t *src, size_t frames) {
+	static sample_t clip_range[2] = { 0x60000000, -0x60000000 };
+	static s32_t inversion[2] = { 1, -1 };
+
+	switch (k) {
+	case BENCH_S32:
+		func->s32(dst, src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_S24:
+		func->s24(dst, src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_S24_3:
+		func->s24_3(dst, src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_S16:
+		func->s16(dst, src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_TRACK_GAIN:
+		/* in place, dst holds a copy of src */
+		memcpy(dst, src, frames * 2 * sizeof(sample_t));
+		func->track_gain(dst, frames, 0x14000, clip_range, inversion);
+		break;
+	case BENCH_PACK16:
+		func->pack16(dst, src, frames);
+		break;
+	case BENCH_PACKED_S32:
+		func->packed_s32(dst, (s16_t *)src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_PACKED_S24:
+		func->packed_s24(dst, (s16_t *)src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_PACKED_S24_3:
+		func->packed_s24_3(dst, (s16_t *)src, frames, 0xC000, 0x8000);
+		break;
+	case BENCH_PACKED_S16:
+		func->packed_s16(dst, (s16_t *)src, frames, 0xC000, 0x8000);
+		break;
+	default:
+		break;
+	}
+}
+
+
+static double time_kernel(struct sample_convert_func *func, enum bench_kernel k, void *dst, sample_t *src, size_t frames, int iterations) {
+	double start;
+	int i;
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		run_kernel(func, k, dst, src, frames);
+	}
+
+	return (now_us() - start) * 1000.0 / ((double)frames * iterations);
+}
+
+
+static double time_unpack(struct sample_convert_func *func, int k, sample_t *dst, u8_t *src, size_t frames, int iterations) {
+	double start;
+	int i;
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		func->pcm_unpack[k](dst, src, frames);
+	}
+
+	return (now_us() - start) / iterations;
+}
+
+
+static int bench_unpack(size_t frames, int iterations) {
+	u8_t *src;
+	sample_t *dst_c, *dst_v;
+	int k, errors = 0;
+	size_t i;
+
+	src = malloc(8 * frames + 1);
+	dst_c = malloc(SAMPLES_TO_BYTES(frames));
+	dst_v = malloc(SAMPLES_TO_BYTES(frames));
+
+	for (i = 0; i < 8 * frames + 1; i++) {
+		src[i] = rand();
+	}
+
+	printf("\n%-14s %10s %10s %8s\n", "unpack", "c MB/s", sample_convert.name, "speedup");
+
+	for (k = 0; k < PCM_UNPACK_NUM; k++) {
+		size_t bytes;
+		double t_c, t_v;
+
+		if (!unpack_names[k]) {
+			continue;
+		}
+
+		bytes = frames * ((k >> 2) + 1) * ((k & 1) ? 2 : 1);
+
+		/* odd offset, the streambuf data is not aligned */
+		sample_convert_scalar.pcm_unpack[k](dst_c, src + 1, frames);
+		sample_convert.pcm_unpack[k](dst_v, src + 1, frames);
+
+		if (memcmp(dst_c, dst_v, SAMPLES_TO_BYTES(frames)) != 0) {
+			printf("%-14s MISMATCH\n", unpack_names[k]);
+			errors++;
+			continue;
+		}
+
+		t_c = time_unpack(&sample_convert_scalar, k, dst_c, src + 1, frames, iterations);
+		t_v = time_unpack(&sample_convert, k, dst_v, src + 1, frames, iterations);
+
+		printf("%-14s %10.1f %10.1f %7.2fx\n", unpack_names[k], bytes / t_c, bytes / t_v, t_c / t_v);
+	}
+
+	free(src);
+	free(dst_c);
+	free(dst_v);
+
+	return errors;
+}
+
+
+int main(int argc, char *argv[]) {
+	size_t frames = DEFAULT_FRAMES;
+	int iterations = DEFAULT_ITERATIONS;
+	sample_t *src;
+	u8_t *dst_c, *dst_v;
+	int k, errors = 0;
+	size_t i;
+
+	if (argc > 1) {
+		frames = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		iterations = atoi(argv[2]);
+	}
+
+	sample_convert_init();
+
+	/* odd offsets so the vector kernels see unaligned buffers and tails */
+	src = malloc(SAMPLES_TO_BYTES(frames + 1));
+	dst_c = malloc(SAMPLES_TO_BYTES(frames + 1));
+	dst_v = malloc(SAMPLES_TO_BYTES(frames + 1));
+
+	srand(1);
+	for (i = 0; i < 2 * (frames + 1); i++) {
+		src[i] = (rand() << 16) ^ rand();
+	}
+	src[0] = SAMPLE_MAX;
+	src[1] = SAMPLE_MIN;
+
+	printf("kernels: %s, %d frames x %d iterations\n", sample_convert.name, (int)frames, iterations);
+	printf("%-12s %10s %10s %8s\n", "kernel", "c ns/frame", sample_convert.name, "speedup");
+
+	for (k = 0; k < BENCH_NUM_KERNELS; k++) {
+		double t_c, t_v;
+
+		memset(dst_c, 0, SAMPLES_TO_BYTES(frames + 1));
+		memset(dst_v, 0, SAMPLES_TO_BYTES(frames + 1));
+
+		run_kernel(&sample_convert_scalar, k, dst_c + 1, src + 1, frames);
+		run_kernel(&sample_convert, k, dst_v + 1, src + 1, frames);
+
+		if (memcmp(dst_c, dst_v, bench_sizes[k] * (frames + 1)) != 0) {
+			printf("%-12s MISMATCH\n", bench_names[k]);
+			errors++;
+			continue;
+		}
+
+		t_c = time_kernel(&sample_convert_scalar, k, dst_c, src, frames, iterations);
+		t_v = time_kernel(&sample_convert, k, dst_v, src, frames, iterations);
+
+		printf("%-12s %10.2f %10.2f %7.2fx\n", bench_names[k], t_c, t_v, t_c / t_v);
+	}
+
+	errors += bench_unpack(frames, iterations);
+
+	free(src);
+	free(dst_c);
+	free(dst_v);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,338 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "audio/fixed_math.h"
+#include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
+
+
+/* The NEON kernels are built with -mfpu=neon and only used when the cpu
+ * supports NEON.
+ */
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+
+/*
+ * NEON kernels, two stereo frames per vector
+ */
+
+#if defined(__arm__)
+/* round like the arm fixed_mul */
+#define neon_shrn_16(x) vrshrn_n_s64((x), 16)
+#else
+#define neon_shrn_16(x) vshrn_n_s64((x), 16)
+#endif
+
+static inline int32x4_t neon_fixed_mul(int32x4_t x, int32x2_t g) {
+	int64x2_t lo = vmull_s32(vget_low_s32(x), g);
+	int64x2_t hi = vmull_s32(vget_high_s32(x), g);
+
+	return vcombine_s32(neon_shrn_16(lo), neon_shrn_16(hi));
+}
+
+
+static inline int32x2_t neon_gains(s32_t lgain, s32_t rgain) {
+	int32x2_t g = vdup_n_s32(lgain);
+
+	return vset_lane_s32(rgain, g, 1);
+}
+
+
+static void convert_s32_neon(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int32_t *output_ptr = (int32_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 2; frames -= 2) {
+		vst1q_s32(output_ptr, neon_fixed_mul(vld1q_s32(src), g));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.s32(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void convert_s24_neon(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int32_t *output_ptr = (int32_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 2; frames -= 2) {
+		vst1q_s32(output_ptr, vshrq_n_s32(neon_fixed_mul(vld1q_s32(src), g), 8));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.s24(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void convert_s24_3_neon(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	u8_t *output_ptr = (u8_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 4; frames -= 4) {
+		int32x4_t a = neon_fixed_mul(vld1q_s32(src), g);
+		int32x4_t b = neon_fixed_mul(vld1q_s32(src + 4), g);
+		uint8x16x2_t q;
+		uint8x8x2_t even, odd;
+		uint8x8x3_t packed;
+
+		/* split the samples into byte planes, then store the top
+		 * three planes interleaved.
+		 */
+		q = vuzpq_u8(vreinterpretq_u8_s32(a), vreinterpretq_u8_s32(b));
+		even = vuzp_u8(vget_low_u8(q.val[0]), vget_high_u8(q.val[0]));
+		odd = vuzp_u8(vget_low_u8(q.val[1]), vget_high_u8(q.val[1]));
+
+		packed.val[0] = odd.val[0];
+		packed.val[1] = even.val[1];
+		packed.val[2] = odd.val[1];
+		vst3_u8(output_ptr, packed);
+
+		output_ptr += 24;
+		src += 8;
+	}
+
+	sample_convert_scalar.s24_3(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void convert_s16_neon(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int16_t *output_ptr = (int16_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 4; frames -= 4) {
+		int16x4_t a = vshrn_n_s32(neon_fixed_mul(vld1q_s32(src), g), 16);
+		int16x4_t b = vshrn_n_s32(neon_fixed_mul(vld1q_s32(src + 4), g), 16);
+
+		vst1q_s16(output_ptr, vcombine_s16(a, b));
+		output_ptr += 8;
+		src += 8;
+	}
+
+	sample_convert_scalar.s16(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void track_gain_neon(sample_t *buf, size_t frames, fft_fixed gain, sample_t clip_range[2], s32_t inversion[2]) {
+	int32x2_t g = vdup_n_s32(gain);
+	int32x4_t clip_hi = vdupq_n_s32(clip_range[0]);
+	int32x4_t clip_lo = vdupq_n_s32(clip_range[1]);
+	int32x4_t max = vdupq_n_s32(SAMPLE_MAX);
+	int32x4_t min = vdupq_n_s32(SAMPLE_MIN);
+	int32x2_t inv2 = vset_lane_s32(inversion[1], vdup_n_s32(inversion[0]), 1);
+	int32x4_t inv = vcombine_s32(inv2, inv2);
+	sample_t *ptr = buf;
+
+	for (; frames >= 2; frames -= 2) {
+		int32x4_t x = vld1q_s32(ptr);
+		int32x4_t r = neon_fixed_mul(x, g);
+
+		r = vbslq_s32(vcgtq_s32(x, clip_hi), max, r);
+		r = vbslq_s32(vcltq_s32(x, clip_lo), min, r);
+
+		vst1q_s32(ptr, vmulq_s32(r, inv));
+		ptr += 4;
+	}
+
+	sample_convert_scalar.track_gain(ptr, frames, gain, clip_range, inversion);
+}
+
+
+static void pack16_neon(void *dst, sample_t *src, size_t frames) {
+	int16_t *output_ptr = (int16_t *)dst;
+
+	for (; frames >= 2; frames -= 2) {
+		vst1_s16(output_ptr, vshrn_n_s32(vld1q_s32(src), 16));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.pack16(output_ptr, src, frames);
+}
+
+
+static void packed_s32_neon(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int32_t *output_ptr = (int32_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 2; frames -= 2) {
+		vst1q_s32(output_ptr, neon_fixed_mul(vshll_n_s16(vld1_s16(src), 16), g));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.packed_s32(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void packed_s24_neon(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int32_t *output_ptr = (int32_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 2; frames -= 2) {
+		vst1q_s32(output_ptr, vshrq_n_s32(neon_fixed_mul(vshll_n_s16(vld1_s16(src), 16), g), 8));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.packed_s24(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void packed_s16_neon(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	int16_t *output_ptr = (int16_t *)dst;
+	int32x2_t g = neon_gains(lgain, rgain);
+
+	for (; frames >= 2; frames -= 2) {
+		vst1_s16(output_ptr, vshrn_n_s32(neon_fixed_mul(vshll_n_s16(vld1_s16(src), 16), g), 16));
+		output_ptr += 4;
+		src += 4;
+	}
+
+	sample_convert_scalar.packed_s16(output_ptr, src, frames, lgain, rgain);
+}
+
+
+/* Store four samples, duplicating them for mono. Returns the number of
+ * samples stored.
+ */
+static inline size_t neon_store_unpacked(sample_t *dst, int32x4_t x, bool_t stereo) {
+	int32x4x2_t d;
+
+	if (stereo) {
+		vst1q_s32(dst, x);
+		return 4;
+	}
+
+	d = vzipq_s32(x, x);
+	vst1q_s32(dst, d.val[0]);
+	vst1q_s32(dst + 4, d.val[1]);
+	return 8;
+}
+
+
+static inline void unpack_16_neon(sample_t *dst, u8_t *src, size_t frames, bool_t big_endian, bool_t stereo) {
+	size_t samples = stereo ? frames * 2 : frames;
+
+	for (; samples >= 8; samples -= 8) {
+		uint8x16_t b = vld1q_u8(src);
+		int16x8_t x;
+
+		if (big_endian) {
+			b = vrev16q_u8(b);
+		}
+		x = vreinterpretq_s16_u8(b);
+
+		dst += neon_store_unpacked(dst, vshll_n_s16(vget_low_s16(x), 16), stereo);
+		dst += neon_store_unpacked(dst, vshll_n_s16(vget_high_s16(x), 16), stereo);
+		src += 16;
+	}
+
+	frames = stereo ? samples / 2 : samples;
+	sample_convert_scalar.pcm_unpack[PCM_UNPACK_INDEX(2, big_endian, stereo)](dst, src, frames);
+}
+
+
+/* vld3 splits 16 samples into their bytes, these are zipped back
+ * together with a zero low byte.
+ */
+static inline void unpack_24_neon(sample_t *dst, u8_t *src, size_t frames, bool_t big_endian, bool_t stereo) {
+	uint8x16_t zero = vdupq_n_u8(0);
+	size_t samples = stereo ? frames * 2 : frames;
+
+	for (; samples >= 16; samples -= 16) {
+		uint8x16x3_t b = vld3q_u8(src);
+		uint8x16x2_t lo, hi;
+		uint16x8x2_t x;
+
+		if (big_endian) {
+			lo = vzipq_u8(zero, b.val[2]);
+			hi = vzipq_u8(b.val[1], b.val[0]);
+		}
+		else {
+			lo = vzipq_u8(zero, b.val[0]);
+			hi = vzipq_u8(b.val[1], b.val[2]);
+		}
+
+		x = vzipq_u16(vreinterpretq_u16_u8(lo.val[0]), vreinterpretq_u16_u8(hi.val[0]));
+		dst += neon_store_unpacked(dst, vreinterpretq_s32_u16(x.val[0]), stereo);
+		dst += neon_store_unpacked(dst, vreinterpretq_s32_u16(x.val[1]), stereo);
+
+		x = vzipq_u16(vreinterpretq_u16_u8(lo.val[1]), vreinterpretq_u16_u8(hi.val[1]));
+		dst += neon_store_unpacked(dst, vreinterpretq_s32_u16(x.val[0]), stereo);
+		dst += neon_store_unpacked(dst, vreinterpretq_s32_u16(x.val[1]), stereo);
+
+		src += 48;
+	}
+
+	frames = stereo ? samples / 2 : samples;
+	sample_convert_scalar.pcm_unpack[PCM_UNPACK_INDEX(3, big_endian, stereo)](dst, src, frames);
+}
+
+
+static void unpack_16le_mono_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_neon(dst, src, frames, false, false);
+}
+
+static void unpack_16le_stereo_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_neon(dst, src, frames, false, true);
+}
+
+static void unpack_16be_mono_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_neon(dst, src, frames, true, false);
+}
+
+static void unpack_16be_stereo_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_neon(dst, src, frames, true, true);
+}
+
+static void unpack_24le_mono_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_24_neon(dst, src, frames, false, false);
+}
+
+static void unpack_24le_stereo_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_24_neon(dst, src, frames, false, true);
+}
+
+static void unpack_24be_mono_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_24_neon(dst, src, frames, true, false);
+}
+
+static void unpack_24be_stereo_neon(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_24_neon(dst, src, frames, true, true);
+}
+
+
+void sample_convert_neon_init(struct sample_convert_func *f) {
+	f->name = "neon";
+
+	f->s32 = convert_s32_neon;
+	f->s24 = convert_s24_neon;
+	f->s24_3 = convert_s24_3_neon;
+	f->s16 = convert_s16_neon;
+	f->track_gain = track_gain_neon;
+	f->pack16 = pack16_neon;
+	f->packed_s32 = packed_s32_neon;
+	f->packed_s24 = packed_s24_neon;
+	f->packed_s16 = packed_s16_neon;
+
+	/* 8 and 32-bit unpack use the C kernels */
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, false, false)] = unpack_16le_mono_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, false, true)] = unpack_16le_stereo_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, true, false)] = unpack_16be_mono_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, true, true)] = unpack_16be_stereo_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(3, false, false)] = unpack_24le_mono_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(3, false, true)] = unpack_24le_stereo_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(3, true, false)] = unpack_24be_mono_neon;
+	f->pcm_unpack[PCM_UNPACK_INDEX(3, true, true)] = unpack_24be_stereo_neon;
+}
+
+#endif // __ARM_NEON__
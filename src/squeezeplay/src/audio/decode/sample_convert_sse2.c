@@ -0,0 +1,323 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "audio/fixed_math.h"
+#include "audio/decode/decode_priv.h"
+#include "audio/decode/sample_convert.h"
+
+
+/* The SSE2 kernels are built with -msse2 and only used when cpuid
+ * reports SSE2. On x86-64 the s32 and s24 gain kernels are about as
+ * fast as C, they are kept for i386 where fixed_mul needs a 64-bit
+ * multiply split over two registers.
+ */
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+
+/*
+ * SSE2 kernels, two stereo frames per vector
+ */
+
+/* SSE2 only has an unsigned 32x32->64 multiply. The signed product
+ * differs from the unsigned product in the upper 32 bits, correct this
+ * before taking bits 16..47.
+ */
+static inline __m128i sse2_fixed_mul(__m128i x, __m128i g) {
+	const __m128i mask_lo = _mm_set_epi32(0, -1, 0, -1);
+	__m128i p02, p13, r, corr;
+
+	p02 = _mm_mul_epu32(x, g);
+	p13 = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(g, 32));
+
+	r = _mm_or_si128(_mm_and_si128(mask_lo, _mm_srli_epi64(p02, 16)),
+			 _mm_andnot_si128(mask_lo, _mm_slli_epi64(p13, 16)));
+
+	corr = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(x, 31), g),
+			     _mm_and_si128(_mm_srai_epi32(g, 31), x));
+
+	return _mm_sub_epi32(r, _mm_slli_epi32(corr, 16));
+}
+
+
+static void convert_s32_sse2(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+
+	for (; frames >= 2; frames -= 2) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		_mm_storeu_si128(output_ptr++, sse2_fixed_mul(x, g));
+		src += 4;
+	}
+
+	sample_convert_scalar.s32(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void convert_s24_sse2(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+
+	for (; frames >= 2; frames -= 2) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		_mm_storeu_si128(output_ptr++, _mm_srai_epi32(sse2_fixed_mul(x, g), 8));
+		src += 4;
+	}
+
+	sample_convert_scalar.s24(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void convert_s16_sse2(void *dst, sample_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+
+	for (; frames >= 4; frames -= 4) {
+		__m128i a = _mm_loadu_si128((__m128i *)(void *)src);
+		__m128i b = _mm_loadu_si128((__m128i *)(void *)(src + 4));
+
+		a = _mm_srai_epi32(sse2_fixed_mul(a, g), 16);
+		b = _mm_srai_epi32(sse2_fixed_mul(b, g), 16);
+
+		_mm_storeu_si128(output_ptr++, _mm_packs_epi32(a, b));
+		src += 8;
+	}
+
+	sample_convert_scalar.s16(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void track_gain_sse2(sample_t *buf, size_t frames, fft_fixed gain, sample_t clip_range[2], s32_t inversion[2]) {
+	__m128i g = _mm_set1_epi32(gain);
+	__m128i clip_hi = _mm_set1_epi32(clip_range[0]);
+	__m128i clip_lo = _mm_set1_epi32(clip_range[1]);
+	__m128i max = _mm_set1_epi32(SAMPLE_MAX);
+	__m128i min = _mm_set1_epi32(SAMPLE_MIN);
+	__m128i neg = _mm_set_epi32(-(inversion[1] < 0), -(inversion[0] < 0), -(inversion[1] < 0), -(inversion[0] < 0));
+	sample_t *ptr = buf;
+
+	for (; frames >= 2; frames -= 2) {
+		__m128i x, r, over, under;
+
+		x = _mm_loadu_si128((__m128i *)(void *)ptr);
+
+		over = _mm_cmpgt_epi32(x, clip_hi);
+		under = _mm_cmplt_epi32(x, clip_lo);
+
+		r = sse2_fixed_mul(x, g);
+		r = _mm_andnot_si128(_mm_or_si128(over, under), r);
+		r = _mm_or_si128(r, _mm_and_si128(over, max));
+		r = _mm_or_si128(r, _mm_and_si128(under, min));
+
+		/* polarity inversion, negate where neg is all ones */
+		r = _mm_sub_epi32(_mm_xor_si128(r, neg), neg);
+
+		_mm_storeu_si128((__m128i *)(void *)ptr, r);
+		ptr += 4;
+	}
+
+	sample_convert_scalar.track_gain(ptr, frames, gain, clip_range, inversion);
+}
+
+
+static void pack16_sse2(void *dst, sample_t *src, size_t frames) {
+	__m128i *output_ptr = (__m128i *)dst;
+
+	for (; frames >= 4; frames -= 4) {
+		__m128i a = _mm_loadu_si128((__m128i *)(void *)src);
+		__m128i b = _mm_loadu_si128((__m128i *)(void *)(src + 4));
+
+		_mm_storeu_si128(output_ptr++, _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+		src += 8;
+	}
+
+	sample_convert_scalar.pack16(output_ptr, src, frames);
+}
+
+
+/* Unpacking with zeros in the low half gives the samples shifted left
+ * by 16 bits, the same as the 32-bit fifo.
+ */
+static void packed_s32_sse2(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+	__m128i zero = _mm_setzero_si128();
+
+	for (; frames >= 4; frames -= 4) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		_mm_storeu_si128(output_ptr++, sse2_fixed_mul(_mm_unpacklo_epi16(zero, x), g));
+		_mm_storeu_si128(output_ptr++, sse2_fixed_mul(_mm_unpackhi_epi16(zero, x), g));
+		src += 8;
+	}
+
+	sample_convert_scalar.packed_s32(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void packed_s24_sse2(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+	__m128i zero = _mm_setzero_si128();
+
+	for (; frames >= 4; frames -= 4) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		_mm_storeu_si128(output_ptr++, _mm_srai_epi32(sse2_fixed_mul(_mm_unpacklo_epi16(zero, x), g), 8));
+		_mm_storeu_si128(output_ptr++, _mm_srai_epi32(sse2_fixed_mul(_mm_unpackhi_epi16(zero, x), g), 8));
+		src += 8;
+	}
+
+	sample_convert_scalar.packed_s24(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static void packed_s16_sse2(void *dst, s16_t *src, size_t frames, s32_t lgain, s32_t rgain) {
+	__m128i *output_ptr = (__m128i *)dst;
+	__m128i g = _mm_set_epi32(rgain, lgain, rgain, lgain);
+	__m128i zero = _mm_setzero_si128();
+
+	for (; frames >= 4; frames -= 4) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+		__m128i a = _mm_srai_epi32(sse2_fixed_mul(_mm_unpacklo_epi16(zero, x), g), 16);
+		__m128i b = _mm_srai_epi32(sse2_fixed_mul(_mm_unpackhi_epi16(zero, x), g), 16);
+
+		_mm_storeu_si128(output_ptr++, _mm_packs_epi32(a, b));
+		src += 8;
+	}
+
+	sample_convert_scalar.packed_s16(output_ptr, src, frames, lgain, rgain);
+}
+
+
+static inline __m128i sse2_bswap16(__m128i x) {
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+
+static inline __m128i sse2_bswap32(__m128i x) {
+	x = sse2_bswap16(x);
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+}
+
+
+/* Store four samples, duplicating them for mono. Returns the number of
+ * samples stored.
+ */
+static inline size_t sse2_store_unpacked(sample_t *dst, __m128i x, bool_t stereo) {
+	if (stereo) {
+		_mm_storeu_si128((__m128i *)dst, x);
+		return 4;
+	}
+
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi32(x, x));
+	_mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi32(x, x));
+	return 8;
+}
+
+
+static inline void unpack_16_sse2(sample_t *dst, u8_t *src, size_t frames, bool_t big_endian, bool_t stereo) {
+	__m128i zero = _mm_setzero_si128();
+	size_t samples = stereo ? frames * 2 : frames;
+
+	for (; samples >= 8; samples -= 8) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		if (big_endian) {
+			x = sse2_bswap16(x);
+		}
+
+		dst += sse2_store_unpacked(dst, _mm_unpacklo_epi16(zero, x), stereo);
+		dst += sse2_store_unpacked(dst, _mm_unpackhi_epi16(zero, x), stereo);
+		src += 16;
+	}
+
+	frames = stereo ? samples / 2 : samples;
+	sample_convert_scalar.pcm_unpack[PCM_UNPACK_INDEX(2, big_endian, stereo)](dst, src, frames);
+}
+
+
+static inline void unpack_32_sse2(sample_t *dst, u8_t *src, size_t frames, bool_t big_endian, bool_t stereo) {
+	size_t samples = stereo ? frames * 2 : frames;
+
+	for (; samples >= 4; samples -= 4) {
+		__m128i x = _mm_loadu_si128((__m128i *)(void *)src);
+
+		if (big_endian) {
+			x = sse2_bswap32(x);
+		}
+
+		dst += sse2_store_unpacked(dst, x, stereo);
+		src += 16;
+	}
+
+	frames = stereo ? samples / 2 : samples;
+	sample_convert_scalar.pcm_unpack[PCM_UNPACK_INDEX(4, big_endian, stereo)](dst, src, frames);
+}
+
+
+static void unpack_16le_mono_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_sse2(dst, src, frames, false, false);
+}
+
+static void unpack_16le_stereo_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_sse2(dst, src, frames, false, true);
+}
+
+static void unpack_16be_mono_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_sse2(dst, src, frames, true, false);
+}
+
+static void unpack_16be_stereo_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_16_sse2(dst, src, frames, true, true);
+}
+
+static void unpack_32le_mono_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_32_sse2(dst, src, frames, false, false);
+}
+
+static void unpack_32le_stereo_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_32_sse2(dst, src, frames, false, true);
+}
+
+static void unpack_32be_mono_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_32_sse2(dst, src, frames, true, false);
+}
+
+static void unpack_32be_stereo_sse2(sample_t *dst, u8_t *src, size_t frames) {
+	unpack_32_sse2(dst, src, frames, true, true);
+}
+
+
+void sample_convert_sse2_init(struct sample_convert_func *f) {
+	f->name = "sse2";
+
+	f->s32 = convert_s32_sse2;
+	f->s24 = convert_s24_sse2;
+	f->s16 = convert_s16_sse2;
+	f->track_gain = track_gain_sse2;
+	f->pack16 = pack16_sse2;
+	f->packed_s32 = packed_s32_sse2;
+	f->packed_s24 = packed_s24_sse2;
+	f->packed_s16 = packed_s16_sse2;
+
+	/* no byte shuffle in SSE2 for 8 and 24-bit */
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, false, false)] = unpack_16le_mono_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, false, true)] = unpack_16le_stereo_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, true, false)] = unpack_16be_mono_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(2, true, true)] = unpack_16be_stereo_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(4, false, false)] = unpack_32le_mono_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(4, false, true)] = unpack_32le_stereo_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(4, true, false)] = unpack_32be_mono_sse2;
+	f->pcm_unpack[PCM_UNPACK_INDEX(4, true, true)] = unpack_32be_stereo_sse2;
+}
+
+#endif // __SSE2__
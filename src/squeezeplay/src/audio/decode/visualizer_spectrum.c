@@ -11,7 +11,7 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
-#include "audio/kiss_fft.h"
+#include "audio/kiss_fftr.h"
 
 #include <math.h>
 
@@ -93,6 +93,10 @@ static int sample_window;
 // The number of sample windows that we will average across.
 static int num_windows;
 
+// The shift that scales the power of the fixed point FFT output
+// to that of an unscaled FFT of the 16-bit input samples.
+static int power_shift;
+
 // Should we combine the channel histograms and only show a single
 // channel?
 static int is_mono;
@@ -107,20 +111,22 @@ static int is_mono;
 //
 /////////////////////////////////////////////////////////
 
-// A Hamming window used on the input samples. This could be
-// precalculated for a fixed window size. Right now, we're
-// computing it in the begin() method.
-double filter_window[MAX_SAMPLE_WINDOW];
+// A Hamming window used on the input samples, in Q15. This
+// is computed in the init() method for the window size.
+static s16_t filter_window[MAX_SAMPLE_WINDOW];
+
+// Samples copied from the visualizer tap
+static s16_t spectrum_buf[2 * MAX_SAMPLE_WINDOW];
 
-// Preemphasis applied to the subbands. This is precomputed
-// based on a db/KHz value.
-double preemphasis[MAX_SUBBANDS];
+// Preemphasis applied to the subbands, in Q16. This is
+// precomputed based on a db/KHz value.
+static u32_t preemphasis[MAX_SUBBANDS];
 
 // Used in power computation across multiple sample windows.
 // For a small window size, this could be stack based.
-float avg_power[2 * MAX_SUBBANDS];
+static u64_t avg_power[2 * MAX_SUBBANDS];
 
-kiss_fft_cfg cfg = NULL;
+static kiss_fftr_cfg cfg = NULL;
 
 // Parameters on the lua stack for the spectrum analyzer:
 //   2 - Channels: stereo == 0, mono == 1
@@ -251,7 +257,7 @@ int decode_spectrum_init( lua_State *L) {
 	}
 
 	if( cfg) {
-		free( cfg);
+		kiss_fftr_free( cfg);
 		cfg = NULL;
 	}
 
@@ -265,7 +271,14 @@ int decode_spectrum_init( lua_State *L) {
 		double scale_db;
 		int s;
 
-		cfg = kiss_fft_alloc( sample_window, 0, NULL, NULL);
+		cfg = kiss_fftr_alloc( sample_window, 0, NULL, NULL);
+
+		// The fixed point FFT scales its output by 1 / sample_window,
+		// and the window adds 15 bits.
+		power_shift = 30;
+		for( w = 1; w < sample_window; w <<= 1) {
+			power_shift -= 2;
+		}
 
 // Still needed?
 //		mem_addr_t lvptr = (mem_addr_t) last_values->aligned;
@@ -280,7 +293,7 @@ int decode_spectrum_init( lua_State *L) {
 		const2 = 0.46;
 		for( w = 0; w < sample_window; w++) {
 			const double twopi = 6.283185307179586476925286766;
-			filter_window[w] = const1 - ( const2 * cos( twopi * (double) w / (double) sample_window));
+			filter_window[w] = (s16_t) ( 32767 * ( const1 - ( const2 * cos( twopi * (double) w / (double) sample_window))) + 0.5);
 		}
 
 		// Compute the preemphasis
@@ -297,9 +310,9 @@ int decode_spectrum_init( lua_State *L) {
 
 			}
 			if( scale_db != 0) {
-				preemphasis[s] = pow( 10, ( scale_db / 10.0));
+				preemphasis[s] = (u32_t) ( pow( 10, ( scale_db / 10.0)) * 65536 + 0.5);
 			} else {
-				preemphasis[s] = 1;
+				preemphasis[s] = 65536;
 			}
 			freq_sum += subband_width;
 		}
@@ -320,6 +333,8 @@ int decode_spectrum( lua_State *L) {
 	int sample_bin_ch0[MAX_SUBBANDS];
 	int sample_bin_ch1[MAX_SUBBANDS];
 
+	size_t num_frames;
+
 	int i;
 	int w;
 	int ch;
@@ -346,98 +361,59 @@ int decode_spectrum( lua_State *L) {
 		avg_power[i] = 0;
 	}
 
-	for( w = 0; w < num_windows; w++) {
-		kiss_fft_cpx fin_buf[MAX_SAMPLE_WINDOW];
-		kiss_fft_cpx fout_buf[MAX_SAMPLE_WINDOW];
-
-		int avg_ptr;
-		int s;
-
-		sample_t *ptr;
-		size_t samples_until_wrap;
+	// The sample windows are consecutive, ending with the
+	// samples now being played.
+	num_frames = decode_tap_read( spectrum_buf, sample_window * num_windows);
 
-		int sample;
+	// Pad with silence if the tap is short
+	memset( spectrum_buf + ( 2 * num_frames), 0, ( ( sample_window * num_windows) - num_frames) * 2 * sizeof( s16_t));
 
-		decode_audio_lock();
+	for( w = 0; w < num_windows; w++) {
+		kiss_fft_scalar fin_buf[2][MAX_SAMPLE_WINDOW];
+		kiss_fft_cpx fout_buf[MAX_SUBBANDS + 1];
 
-		ptr = (sample_t *) (void *) ( decode_fifo_buf + decode_audio->fifo.rptr);
-		samples_until_wrap = BYTES_TO_SAMPLES( fifo_bytes_until_rptr_wrap( &decode_audio->fifo));
+		s16_t *ptr;
 
+		ptr = spectrum_buf + ( 2 * w * sample_window);
 		for( i = 0; i < sample_window; i++) {
-			sample = (*ptr++) >> 16;
-			fin_buf[i].r = (float) ( filter_window[i] * sample);
-
-			sample = (*ptr++) >> 16;
-			fin_buf[i].i = (float) ( filter_window[i] * sample);
-
-			samples_until_wrap -= 2;
-			if( samples_until_wrap <= 0) {
-				ptr = (sample_t *) (void *) decode_fifo_buf;
-			}
-		}
-
-		decode_audio_unlock();
-
-#if 0
-// Test case
-		{
-			double freq = ( M_PI * 16) / 256;
-			float ampl = ( (int) pow( 2, 16)) / 2;
-			int i;
-
-			for( i = 0; i < sample_window; i++) {
-				fin_buf[i].r = ( ampl * (float) sin( i * freq)) + ( ampl * (float) cos( i * freq));
-				fin_buf[i].i = ( ampl * (float) sin( i * freq)) + ( ampl * (float) cos( i * freq));
-			}
+			fin_buf[0][i] = filter_window[i] * (*ptr++);
+			fin_buf[1][i] = filter_window[i] * (*ptr++);
 		}
-#endif
 
-		kiss_fft( cfg, fin_buf, fout_buf);
+		// Real FFT of each channel, keeping track of the power
+		// per bin.
+		for( ch = 0; ch < 2; ch++) {
+			int avg_ptr = ch;
+			int s;
 
-		// Extract the two separate frequency domain signals
-		// and keep track of the power per bin.
-		avg_ptr = 0;
-		for( s = 1; s <= num_subbands; s++) {
-			kiss_fft_cpx ck, cnk;
+			kiss_fftr( cfg, fin_buf[ch], fout_buf);
 
-			float r, i;
+			for( s = 1; s <= num_subbands; s++) {
+				s64_t r = fout_buf[s].r;
+				s64_t im = fout_buf[s].i;
 
-			ck = fout_buf[s];
-			cnk = fout_buf[sample_window - s];
-
-			r = ( ck.r + cnk.r) / 2;
-			i = ( ck.i - cnk.i) / 2;
-
-			avg_power[avg_ptr++] += ( r * r + i * i) / num_windows;
-
-			r = ( cnk.i + ck.i) / 2;
-			i = ( cnk.r - ck.r) / 2;
-
-			avg_power[avg_ptr++] += ( r * r + i * i) / num_windows;
+				avg_power[avg_ptr] += (u64_t) ( r * r + im * im) >> power_shift;
+				avg_ptr += 2;
+			}
 		}
 	}
 
 
 	{
-		int pre_ptr = 0;
 		int avg_ptr = 0;
 		int p;
 
 		for( p = 0; p < num_subbands; p++) {
-			long product = (long) ( avg_power[avg_ptr] * preemphasis[pre_ptr]);
-			product >>= 16;
-			avg_power[avg_ptr++] = (int) product;
-
-			product = (long) ( avg_power[avg_ptr] * preemphasis[pre_ptr]);
-			product >>= 16;
-			avg_power[avg_ptr++] = (int) product;
+			avg_power[avg_ptr] = ( ( ( avg_power[avg_ptr] / num_windows) >> 16) * preemphasis[p]) >> 16;
+			avg_ptr++;
 
-			pre_ptr++;
+			avg_power[avg_ptr] = ( ( ( avg_power[avg_ptr] / num_windows) >> 16) * preemphasis[p]) >> 16;
+			avg_ptr++;
 		}
 	}
 
 	for( ch = 0; ch < (( is_mono) ? 1 : 2); ch++) {
-		int power_sum = 0;
+		u64_t power_sum = 0;
 		int in_bar = 0;
 		int curr_bar = 0;
 
@@ -466,7 +442,7 @@ int decode_spectrum( lua_State *L) {
 
 				val = 0;
 				for( i = 31; i > 0; i--) {
-					if( power_sum >= power_map[i]) {
+					if( power_sum >= (u64_t) power_map[i]) {
 						val = i;
 						break;
 					}
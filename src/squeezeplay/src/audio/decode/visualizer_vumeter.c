@@ -14,44 +14,40 @@
 
 
 #define VUMETER_DEFAULT_SAMPLE_WINDOW 8 * 1024
+#define VUMETER_MAX_SAMPLE_WINDOW 8 * 1024
+
+static s16_t vumeter_buf[2 * VUMETER_MAX_SAMPLE_WINDOW];
 
 int decode_vumeter(lua_State *L) {
 	u32_t sample_accumulator[2];
-	sample_t *ptr;
-	size_t samples_until_wrap;
+	s16_t *ptr;
 	s16_t sample;
 	s32_t sample_sq;
-	size_t i, num_samples;
+	size_t i, num_samples, num_frames = 0;
 
 	num_samples = luaL_optinteger(L, 2, VUMETER_DEFAULT_SAMPLE_WINDOW);
+	if (num_samples > VUMETER_MAX_SAMPLE_WINDOW) {
+		num_samples = VUMETER_MAX_SAMPLE_WINDOW;
+	}
 
 	sample_accumulator[0] = 0;
 	sample_accumulator[1] = 0;
 
-	decode_audio_lock();
-
 	if (decode_audio->state & DECODE_STATE_RUNNING) {
-		ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-		samples_until_wrap = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
-
-		for (i=0; i<num_samples; i++) {
-			sample = (*ptr++) >> 24;
-			sample_sq = sample * sample;
-			sample_accumulator[0] += sample_sq;
+		num_frames = decode_tap_read(vumeter_buf, num_samples);
+	}
 
-			sample = (*ptr++) >> 24;
-			sample_sq = sample * sample;
-			sample_accumulator[1] += sample_sq;
+	ptr = vumeter_buf;
+	for (i=0; i<num_frames; i++) {
+		sample = (*ptr++) >> 8;
+		sample_sq = sample * sample;
+		sample_accumulator[0] += sample_sq;
 
-			samples_until_wrap -= 2;
-			if (samples_until_wrap <= 0) {
-				ptr = (sample_t *)(void *)decode_fifo_buf;
-			}
-		}
+		sample = (*ptr++) >> 8;
+		sample_sq = sample * sample;
+		sample_accumulator[1] += sample_sq;
 	}
 
-	decode_audio_unlock();
-
 	sample_accumulator[0] /= num_samples;
 	sample_accumulator[1] /= num_samples;
 
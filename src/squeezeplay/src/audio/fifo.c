@@ -179,6 +179,25 @@ void fifo_wptr_incby(struct fifo *fifo, size_t incby) {
 	}	
 }
 
+static inline void fifo_store_release(volatile size_t *ptr, size_t val) {
+	fifo_barrier();
+	*ptr = val;
+}
+
+void fifo_spsc_rptr_incby(struct fifo *fifo, size_t incby) {
+	size_t rptr = fifo->rptr + incby;
+
+	/* the data must be read before the space is released */
+	fifo_store_release(&fifo->rptr, (rptr == fifo->size) ? 0 : rptr);
+}
+
+void fifo_spsc_wptr_incby(struct fifo *fifo, size_t incby) {
+	size_t wptr = fifo->wptr + incby;
+
+	/* the data must be written before it is published */
+	fifo_store_release(&fifo->wptr, (wptr == fifo->size) ? 0 : wptr);
+}
+
 int fifo_lock(struct fifo *fifo) {
 	int r;
 
@@ -256,11 +275,18 @@ int fifo_wait_timeout(struct fifo *fifo, Uint32 ms) {
 	do {
 		r = pthread_cond_timedwait(&fifo->cond, &fifo->mutex, &abstime);
 	} while (r == EINTR);
+
+	if (r == ETIMEDOUT) {
+		r = SDL_MUTEX_TIMEDOUT;
+	}
+	else if (r != 0) {
+		r = -1;
+	}
 #else
 	/* cross platform locking */
 	r = SDL_CondWaitTimeout(fifo->cond, fifo->mutex, ms);
 #endif
 
 	fifo->lock++;
-	return 1;
+	return r;
 }
@@ -30,6 +30,15 @@ struct fifo {
 
 #define ASSERT_FIFO_LOCKED(fifo) assert((fifo)->lock)
 
+/* memory barrier, used to publish the fifo pointers without the lock */
+#if defined(__GNUC__)
+#define fifo_barrier() __sync_synchronize()
+#elif defined(_MSC_VER)
+#define fifo_barrier() MemoryBarrier()
+#else
+#error "no memory barrier"
+#endif
+
 extern int fifo_init(struct fifo *fifo, size_t size, bool_t prio_inherit);
 extern void fifo_free(struct fifo *fifo);
 extern bool_t fifo_empty(struct fifo *fifo);
@@ -40,10 +49,20 @@ extern size_t fifo_bytes_until_wptr_wrap(struct fifo *fifo);
 extern void fifo_rptr_incby(struct fifo *fifo, size_t incby);
 extern void fifo_wptr_incby(struct fifo *fifo, size_t incby);
 
+/* Single producer, single consumer access. The producer only moves wptr
+ * and the consumer only moves rptr, so the producer can fill the free
+ * region and the consumer can read the used region without holding the
+ * lock. The pointers are published with a barrier after the data.
+ * Anything else that changes the pointers must hold the lock.
+ */
+extern void fifo_spsc_rptr_incby(struct fifo *fifo, size_t incby);
+extern void fifo_spsc_wptr_incby(struct fifo *fifo, size_t incby);
+
 /* fifo thread support */
 extern int fifo_lock(struct fifo *fifo);
 extern int fifo_unlock(struct fifo *fifo);
 extern int fifo_signal(struct fifo *fifo);
+/* Returns 0 when signalled, SDL_MUTEX_TIMEDOUT or -1 on error */
 extern int fifo_wait_timeout(struct fifo *fifo, Uint32 ms);
 
 
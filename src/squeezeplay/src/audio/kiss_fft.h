@@ -35,8 +35,21 @@ extern "C" {
 #endif	
 
 
+/* SqueezePlay: use 32-bit fixed point, the visualizers run on cpus
+ * without an fpu.
+ */
+#ifndef FIXED_POINT
+#define FIXED_POINT 32
+#endif
+
 #ifdef FIXED_POINT
+#ifdef _MSC_VER
+typedef __int16 int16_t;
+typedef __int32 int32_t;
+typedef __int64 int64_t;
+#else
 #include <sys/types.h>	
+#endif
 # if (FIXED_POINT == 32)
 #  define kiss_fft_scalar int32_t
 # else	
@@ -811,6 +811,45 @@ u8_t *mp4_read(struct decode_mp4 *mp4, int track_idx, size_t *rlen, bool_t *stre
 }
 
 
+/* Move the track forward to sample, using the chunk offsets and sample
+ * sizes. Fails unless the sample is in the data already received.
+ */
+bool_t mp4_seek(struct decode_mp4 *mp4, int track_idx, u32_t sample)
+{
+	struct mp4_track *track = &mp4->track[track_idx];
+	struct mp4_track saved = *track;
+	size_t pos, len, buf_end;
+
+	if (sample <= track->sample_num || sample >= track->sample_count) {
+		return FALSE;
+	}
+
+	while (track->sample_num < sample) {
+		next_packet(track);
+	}
+
+	packet_size(track, &pos, &len);
+
+	/* stream offset at the end of the parser buffer */
+	buf_end = mp4->off + (mp4->end - mp4->ptr);
+
+	if (pos > buf_end) {
+		if (!streambuf_skip(pos - buf_end)) {
+			*track = saved;
+			return FALSE;
+		}
+
+		mp4->ptr = mp4->end;
+		mp4->off = pos;
+	}
+
+	/* mp4_read() skips to the packet within the buffer */
+	mp4->box_size = len;
+
+	return TRUE;
+}
+
+
 void mp4_track_conf(struct decode_mp4 *mp4, int track, u8_t **conf, size_t *size)
 {
 	if (track >= mp4->track_count) {
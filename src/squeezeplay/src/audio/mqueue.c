@@ -69,6 +69,11 @@ mqueue_func_t mqueue_read_request(struct mqueue *mqueue, Uint32 timeout) {
 		fifo_unlock(&mqueue->fifo);
 		return NULL;
 	}
+	else if (!fifo_bytes_used(&mqueue->fifo)) {
+		/* spurious wakeup */
+		fifo_unlock(&mqueue->fifo);
+		return NULL;
+	}
 	else {
 		mqueue_func_t func;
 		mqueue_read_buf(mqueue, (Uint8 *)&func, sizeof(func));
@@ -20,6 +20,7 @@ typedef SOCKET socket_t;
 #define CLOSESOCKET(s) closesocket(s)
 #define SHUT_WR SD_SEND
 #define SOCKETERROR WSAGetLastError()
+#define SOCKETWOULDBLOCK WSAEWOULDBLOCK
 
 #else
 
@@ -27,19 +28,34 @@ typedef int socket_t;
 #define CLOSESOCKET(s) close(s)
 #define INVALID_SOCKET (-1)
 #define SOCKETERROR errno
+#define SOCKETWOULDBLOCK EAGAIN
 
 #endif
 
 
+/* default size, the platform settings may change this */
 #define STREAMBUF_SIZE (3 * 1024 * 1024)
+#define STREAMBUF_MIN_SIZE (64 * 1024)
 
-static u8_t streambuf_buf[STREAMBUF_SIZE];
+/* minimum free space before reading from the stream socket */
+#define STREAMBUF_MIN_FEED 4096
+
+/* stream reader thread poll interval, in ms */
+#define STREAM_READER_INTERVAL 100
+
+static u8_t *streambuf_buf;
+static u8_t *streambuf_old_buf = NULL;
+static size_t streambuf_next_size = 0;
 static struct fifo streambuf_fifo;
 static size_t streambuf_lptr = 0;
 static bool_t streambuf_loop = FALSE;
 static bool_t streambuf_streaming = FALSE;
+static size_t streambuf_wakeup_bytes = 0;
 static u64_t streambuf_bytes_received = 0;
 
+/* use a native thread to read the stream socket */
+static bool_t streambuf_reader_enabled = FALSE;
+
 /* streambuf filter, used to parse metadata */
 static streambuf_filter_t streambuf_filter;
 static streambuf_filter_t streambuf_next_filter;
@@ -83,7 +99,20 @@ static void proxy_chunk (u8_t *buf, size_t size, lua_State *L)
 }
 
 size_t streambuf_get_size(void) {
-	return STREAMBUF_SIZE;
+	return streambuf_fifo.size;
+}
+
+
+/* the streambuf is resized when it is next flushed */
+void streambuf_set_size(size_t size) {
+	fifo_lock(&streambuf_fifo);
+
+	if (size < STREAMBUF_MIN_SIZE) {
+		size = STREAMBUF_MIN_SIZE;
+	}
+	streambuf_next_size = size;
+
+	fifo_unlock(&streambuf_fifo);
 }
 
 
@@ -135,11 +164,46 @@ bool_t streambuf_would_wait_for(size_t bytes) {
 	return n < bytes;
 }
 
+/* As streambuf_would_wait_for, but when the decoder would wait it is woken
+ * up once the bytes have been received or the stream has ended.
+ */
+bool_t streambuf_wait_for(size_t bytes) {
+	bool_t wait;
+
+	fifo_lock(&streambuf_fifo);
+
+	wait = streambuf_streaming && fifo_bytes_used(&streambuf_fifo) < bytes;
+	streambuf_wakeup_bytes = wait ? bytes : 0;
+
+	fifo_unlock(&streambuf_fifo);
+
+	return wait;
+}
+
+/* Called with the fifo locked after the streambuf is written, returns
+ * true if the decoder should be woken up. decode_wakeup() must be called
+ * after the fifo is unlocked.
+ */
+static bool_t streambuf_wakeup_due(void) {
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	if (!streambuf_wakeup_bytes) {
+		return FALSE;
+	}
+
+	if (streambuf_streaming && fifo_bytes_used(&streambuf_fifo) < streambuf_wakeup_bytes) {
+		return FALSE;
+	}
+
+	streambuf_wakeup_bytes = 0;
+	return TRUE;
+}
+
 void streambuf_get_status(size_t *size, size_t *usedbytes, u32_t *bytesL, u32_t *bytesH) {
 
 	fifo_lock(&streambuf_fifo);
 
-	*size = STREAMBUF_SIZE;
+	*size = streambuf_fifo.size;
 	*usedbytes = fifo_bytes_used(&streambuf_fifo);
 	*bytesL = streambuf_bytes_received & 0xFFFFFFFF;
 	*bytesH = streambuf_bytes_received >> 32;
@@ -149,17 +213,59 @@ void streambuf_get_status(size_t *size, size_t *usedbytes, u32_t *bytesL, u32_t
 
 
 void streambuf_flush(void) {
+	u8_t *buf;
+
 	fifo_lock(&streambuf_fifo);
 
 	streambuf_fifo.rptr = 0;
 	streambuf_fifo.wptr = 0;
+	streambuf_wakeup_bytes = 0;
+
+	/* the decoder may still be using the old buffer, it is freed by
+	 * streambuf_release. if the last old buffer has not been released
+	 * yet the resize waits for the next flush.
+	 */
+	if (streambuf_next_size && !streambuf_old_buf) {
+		if (streambuf_next_size != streambuf_fifo.size) {
+			buf = malloc(streambuf_next_size);
+			if (buf) {
+				LOG_DEBUG(log_audio_decode, "streambuf resized %d bytes", (int)streambuf_next_size);
+
+				streambuf_old_buf = streambuf_buf;
+				streambuf_buf = buf;
+				streambuf_fifo.size = streambuf_next_size;
+			}
+			else {
+				LOG_ERROR(log_audio_decode, "streambuf resize failed %d bytes", (int)streambuf_next_size);
+			}
+		}
+		streambuf_next_size = 0;
+	}
+
+	fifo_unlock(&streambuf_fifo);
+}
+
+
+/* Frees the buffer replaced when the streambuf was resized. Called from
+ * the decoder thread when no decoder is running.
+ */
+void streambuf_release(void) {
+	u8_t *buf;
+
+	fifo_lock(&streambuf_fifo);
+
+	buf = streambuf_old_buf;
+	streambuf_old_buf = NULL;
 
 	fifo_unlock(&streambuf_fifo);
+
+	free(buf);
 }
 
 
 static void streambuf_feedL(u8_t *buf, size_t size, lua_State *L) {
 	size_t n;
+	bool_t wakeup;
 
 	fifo_lock(&streambuf_fifo);
 
@@ -183,22 +289,30 @@ static void streambuf_feedL(u8_t *buf, size_t size, lua_State *L) {
 		size -= n;
 	}
 
+	wakeup = streambuf_wakeup_due();
+
 	fifo_unlock(&streambuf_fifo);
+
+	if (wakeup) {
+		decode_wakeup();
+	}
 }
 
 void streambuf_feed(u8_t *buf, size_t size) {
 	streambuf_feedL(buf, size, 0);
 }
 
-ssize_t streambuf_feed_fd(int fd, lua_State *L) {
+static ssize_t streambuf_recv_fd(socket_t fd, lua_State *L, bool_t can_retry) {
 	ssize_t n, size;
+	int err;
+	bool_t wakeup;
 
 	fifo_lock(&streambuf_fifo);
 
 	streambuf_streaming = TRUE;
 
 	size = fifo_bytes_free(&streambuf_fifo);
-	if (size < 4096) {
+	if (size < STREAMBUF_MIN_FEED) {
 		fifo_unlock(&streambuf_fifo);
 		return -ENOSPC; /* no space */
 	}
@@ -210,10 +324,14 @@ ssize_t streambuf_feed_fd(int fd, lua_State *L) {
 
 	n = recv(fd, streambuf_buf + streambuf_fifo.wptr, n, 0);
 	if (n < 0) {
-		streambuf_streaming = FALSE;
+		err = SOCKETERROR;
 
-		fifo_unlock(&streambuf_fifo);
-		return -SOCKETERROR;
+		/* the reader thread retries interrupted reads, keep streaming */
+		if (!can_retry || (err != SOCKETWOULDBLOCK && err != EINTR)) {
+			streambuf_streaming = FALSE;
+		}
+
+		n = -err;
 	}
 	else if (n == 0) {
 		streambuf_streaming = FALSE;
@@ -226,11 +344,22 @@ ssize_t streambuf_feed_fd(int fd, lua_State *L) {
 		streambuf_bytes_received += n;
 	}
 
+	wakeup = streambuf_wakeup_due();
+
 	fifo_unlock(&streambuf_fifo);
+
+	if (wakeup) {
+		decode_wakeup();
+	}
 	return n;
 }
 
 
+ssize_t streambuf_feed_fd(int fd, lua_State *L) {
+	return streambuf_recv_fd(fd, L, FALSE);
+}
+
+
 size_t streambuf_fast_read(u8_t *buf, size_t min, size_t max, bool_t *streaming) {
 	size_t sz, w;
 
@@ -255,18 +384,128 @@ size_t streambuf_fast_read(u8_t *buf, size_t min, size_t max, bool_t *streaming)
 	}
 
 	memcpy(buf, streambuf_buf + streambuf_fifo.rptr, sz);
-	fifo_rptr_incby(&streambuf_fifo, sz);
+	streambuf_fast_consume(sz);
+
+	return sz;
+}
+
+
+size_t streambuf_fast_peek(u8_t **buf, size_t *used, bool_t *streaming) {
+	size_t sz;
+
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	if (streaming) {
+		*streaming = streambuf_streaming;
+	}
+
+	sz = fifo_bytes_used(&streambuf_fifo);
+	if (used) {
+		*used = sz;
+	}
+
+	if (sz > fifo_bytes_until_rptr_wrap(&streambuf_fifo)) {
+		sz = fifo_bytes_until_rptr_wrap(&streambuf_fifo);
+	}
+
+	*buf = streambuf_buf + streambuf_fifo.rptr;
+
+	return sz;
+}
+
+
+void streambuf_fast_consume(size_t len) {
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	assert(len <= fifo_bytes_used(&streambuf_fifo));
+
+	fifo_rptr_incby(&streambuf_fifo, len);
 
 	fifo_signal(&streambuf_fifo);
 
 	if ((streambuf_fifo.rptr == streambuf_fifo.wptr) && streambuf_loop) {
 		streambuf_fifo.rptr = streambuf_lptr;
 	}
+}
+
+
+size_t streambuf_peek(u8_t **buf, size_t *used, bool_t *streaming) {
+	size_t sz;
+
+	fifo_lock(&streambuf_fifo);
+
+	sz = streambuf_fast_peek(buf, used, streaming);
+
+	fifo_unlock(&streambuf_fifo);
 
 	return sz;
 }
 
 
+size_t streambuf_peek_copy(u8_t *buf, size_t max) {
+	size_t sz, w;
+
+	fifo_lock(&streambuf_fifo);
+
+	sz = fifo_bytes_used(&streambuf_fifo);
+	if (sz > max) {
+		sz = max;
+	}
+
+	/* copy across the fifo wrap, without moving the read pointer */
+	w = fifo_bytes_until_rptr_wrap(&streambuf_fifo);
+	if (w > sz) {
+		w = sz;
+	}
+
+	memcpy(buf, streambuf_buf + streambuf_fifo.rptr, w);
+	memcpy(buf + w, streambuf_buf, sz - w);
+
+	fifo_unlock(&streambuf_fifo);
+
+	return sz;
+}
+
+
+void streambuf_consume(size_t len) {
+	fifo_lock(&streambuf_fifo);
+
+	streambuf_fast_consume(len);
+
+	fifo_unlock(&streambuf_fifo);
+}
+
+
+bool_t streambuf_skip(size_t len) {
+	bool_t skip;
+
+	fifo_lock(&streambuf_fifo);
+
+	/* a filter must see all of the stream */
+	skip = !streambuf_filter && len <= fifo_bytes_used(&streambuf_fifo);
+	if (skip) {
+		streambuf_fast_consume(len);
+	}
+
+	fifo_unlock(&streambuf_fifo);
+
+	return skip;
+}
+
+
+bool_t streambuf_has_filter(void) {
+	bool_t filter;
+
+	fifo_lock(&streambuf_fifo);
+
+	filter = (streambuf_filter != NULL);
+
+	fifo_unlock(&streambuf_fifo);
+
+	return filter;
+}
+
+
 size_t streambuf_read(u8_t *buf, size_t min, size_t max, bool_t *streaming) {
 	ssize_t n;
 
@@ -315,7 +554,18 @@ void streambuf_set_copyright() {
 
 
 void streambuf_set_streaming(bool_t is_streaming) {
+	bool_t wakeup;
+
+	fifo_lock(&streambuf_fifo);
+
 	streambuf_streaming = is_streaming;
+	wakeup = streambuf_wakeup_due();
+
+	fifo_unlock(&streambuf_fifo);
+
+	if (wakeup) {
+		decode_wakeup();
+	}
 }
 
 
@@ -400,6 +650,18 @@ bool_t streambuf_is_icy()
 }
 
 
+void streambuf_set_reader_thread(bool_t enabled)
+{
+	streambuf_reader_enabled = enabled;
+}
+
+
+enum stream_reader_state {
+	STREAM_READER_RUNNING = 0,
+	STREAM_READER_EOF,
+	STREAM_READER_ERROR,
+};
+
 struct stream {
 	socket_t fd;
 	int num_crlf;
@@ -407,13 +669,112 @@ struct stream {
 	/* save http headers or body */
 	u8_t *body;
 	int body_len;
+
+	/* native reader thread, the state is protected by the streambuf lock */
+	bool_t use_reader;
+	SDL_Thread *reader_thread;
+	volatile bool_t reader_stop;
+	enum stream_reader_state reader_state;
+	int reader_error;
+	size_t reader_bytes;
 };
 
 
+/* Read the stream socket into the streambuf without going through the lua
+ * network loop. Lua collects the reader state using stream:read().
+ */
+static int stream_reader_execute(void *data) {
+	struct stream *stream = (struct stream *)data;
+	struct timeval tv;
+	fd_set fds;
+	ssize_t n;
+	int r;
+
+	LOG_DEBUG(log_audio_decode, "stream reader started");
+
+	while (!stream->reader_stop) {
+		/* wait for the decoder to make space in the streambuf */
+		fifo_lock(&streambuf_fifo);
+		if (fifo_bytes_free(&streambuf_fifo) < STREAMBUF_MIN_FEED) {
+			fifo_wait_timeout(&streambuf_fifo, STREAM_READER_INTERVAL);
+			fifo_unlock(&streambuf_fifo);
+			continue;
+		}
+		fifo_unlock(&streambuf_fifo);
+
+		FD_ZERO(&fds);
+		FD_SET(stream->fd, &fds);
+
+		tv.tv_sec = 0;
+		tv.tv_usec = STREAM_READER_INTERVAL * 1000;
+
+		r = select(stream->fd + 1, &fds, NULL, NULL, &tv);
+		if (r == 0) {
+			continue;
+		}
+
+		if (r < 0) {
+			if (SOCKETERROR == EINTR) {
+				continue;
+			}
+			n = -SOCKETERROR;
+		}
+		else {
+			n = streambuf_recv_fd(stream->fd, NULL, TRUE);
+
+			if (n == -ENOSPC || n == -SOCKETWOULDBLOCK || n == -EINTR) {
+				continue;
+			}
+		}
+
+		fifo_lock(&streambuf_fifo);
+
+		if (n > 0) {
+			stream->reader_bytes += n;
+			fifo_unlock(&streambuf_fifo);
+			continue;
+		}
+
+		if (n == 0) {
+			stream->reader_state = STREAM_READER_EOF;
+		}
+		else {
+			stream->reader_state = STREAM_READER_ERROR;
+			stream->reader_error = -n;
+		}
+
+		fifo_unlock(&streambuf_fifo);
+		break;
+	}
+
+	LOG_DEBUG(log_audio_decode, "stream reader stopped");
+
+	return 0;
+}
+
+
+static void stream_reader_stop(struct stream *stream) {
+	if (!stream->reader_thread) {
+		return;
+	}
+
+	stream->reader_stop = TRUE;
+
+	/* wake the reader if it is waiting for space */
+	fifo_lock(&streambuf_fifo);
+	fifo_signal(&streambuf_fifo);
+	fifo_unlock(&streambuf_fifo);
+
+	SDL_WaitThread(stream->reader_thread, NULL);
+	stream->reader_thread = NULL;
+}
+
+
 static int stream_load_loopL(lua_State *L) {
 	int fd;
 	ssize_t n, len;
 	char *filename;
+	bool_t wakeup;
 
 	/*
 	 * 1: self
@@ -457,9 +818,15 @@ static int stream_load_loopL(lua_State *L) {
 	streambuf_filter = streambuf_next_filter;
 	streambuf_next_filter = NULL;
 
+	wakeup = streambuf_wakeup_due();
+
 	fifo_unlock(&streambuf_fifo);
 	close(fd);
 
+	if (wakeup) {
+		decode_wakeup();
+	}
+
 	return 0;
 
  read_err:
@@ -564,6 +931,9 @@ static int stream_disconnectL(lua_State *L) {
 
 	stream = lua_touserdata(L, 1);
 
+	/* the reader thread must not use the socket once it is closed */
+	stream_reader_stop(stream);
+
 	if (stream->body) {
 		free(stream->body);
 		stream->body = NULL;
@@ -619,6 +989,34 @@ static int stream_readL(lua_State *L) {
 	stream = lua_touserdata(L, 1);
 
 
+	/* the reader thread owns the socket, report its progress */
+	if (stream->reader_thread) {
+		fifo_lock(&streambuf_fifo);
+
+		n = stream->reader_bytes;
+		stream->reader_bytes = 0;
+
+		if (n == 0 && stream->reader_state == STREAM_READER_EOF) {
+			fifo_unlock(&streambuf_fifo);
+
+			lua_pushboolean(L, FALSE);
+			return 1;
+		}
+
+		if (n == 0 && stream->reader_state == STREAM_READER_ERROR) {
+			fifo_unlock(&streambuf_fifo);
+
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(stream->reader_error));
+			return 2;
+		}
+
+		fifo_unlock(&streambuf_fifo);
+
+		lua_pushinteger(L, n);
+		return 1;
+	}
+
 	/* shortcut, just read to streambuf */
 	if (stream->num_crlf == 4) {
 		n = streambuf_feed_fd(stream->fd, L);
@@ -721,11 +1119,52 @@ static int stream_readL(lua_State *L) {
 	/* feed remaining buffer */
 	streambuf_feedL(buf_ptr, n, L);
 
+	/* headers are done, hand the socket over to the reader thread */
+	if (stream->num_crlf == 4 && stream->use_reader) {
+		stream->reader_thread = SDL_CreateThread(stream_reader_execute, stream);
+		if (!stream->reader_thread) {
+			LOG_WARN(log_audio_decode, "failed to start stream reader");
+		}
+	}
+
 	lua_pushboolean(L, TRUE);
 	return 1;
 }
 
 
+static int stream_use_reader_threadL(lua_State *L) {
+	struct stream *stream;
+
+	/*
+	 * 1: Stream (self)
+	 *
+	 * Request the native reader thread once the http headers have been
+	 * read. Returns true if the platform has it enabled.
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	stream->use_reader = streambuf_reader_enabled;
+
+	lua_pushboolean(L, stream->use_reader);
+	return 1;
+}
+
+
+static int stream_is_threadedL(lua_State *L) {
+	struct stream *stream;
+
+	/*
+	 * 1: Stream (self)
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	lua_pushboolean(L, stream->reader_thread != NULL);
+	return 1;
+}
+
+
 static int stream_writeL(lua_State *L) {
 	struct stream *stream;
 	const char *header;
@@ -909,7 +1348,7 @@ static int stream_setstreamingL(lua_State *L) {
 	 * 1: Stream (self)
 	 * 1: Boolean steaming state, used by lua protocol handlers to set streaming state
 	 */
-	streambuf_streaming = lua_toboolean(L, 2);
+	streambuf_set_streaming(lua_toboolean(L, 2));
 
 	return 0;
 }
@@ -965,11 +1404,14 @@ static const struct luaL_Reg stream_m[] = {
 	{ "readToLua", stream_readtoL },
 	{ "readToNull", stream_readtonullL },
 	{ "setStreaming", stream_setstreamingL },
+	{ "useReaderThread", stream_use_reader_threadL },
+	{ "isThreaded", stream_is_threadedL },
 	{ NULL, NULL }
 };
 
 
 int luaopen_streambuf(lua_State *L) {
+	streambuf_buf = malloc(STREAMBUF_SIZE);
 	fifo_init(&streambuf_fifo, STREAMBUF_SIZE, false);
 
 	/* stream methods */
@@ -21,10 +21,15 @@ extern void decode_queue_metadata(enum metadata_type type, u8_t *metadata, size_
 
 extern void decode_queue_packet(void *data, size_t len);
 
+/* wake the decoder thread, used when data it is waiting for arrives */
+extern void decode_wakeup(void);
+
 /* Stream buffer */
 
 extern size_t streambuf_get_size(void);
 
+extern void streambuf_set_size(size_t size);
+
 extern size_t streambuf_get_freebytes(void);
 
 extern size_t streambuf_get_usedbytes(void);
@@ -33,10 +38,14 @@ extern size_t streambuf_fast_usedbytes(void);
 
 extern bool_t streambuf_would_wait_for(size_t bytes);
 
+extern bool_t streambuf_wait_for(size_t bytes);
+
 extern void streambuf_get_status(size_t *size, size_t *usedbytes, u32_t *bytesL, u32_t *bytesH);
 
 extern void streambuf_flush(void);
 
+extern void streambuf_release(void);
+
 extern void streambuf_feed(u8_t *buf, size_t size);
 
 /* the mutex should be locked when using fast read */
@@ -44,6 +53,28 @@ extern size_t streambuf_fast_read(u8_t *buf, size_t min, size_t max, bool_t *str
 
 extern size_t streambuf_read(u8_t *buf, size_t min, size_t max, bool_t *streaming);
 
+/* zero-copy reads, these return a pointer into the streambuf and the number
+ * of contiguous bytes up to the fifo wrap. the data remains valid until it is
+ * consumed. must not be used when a filter is installed.
+ */
+extern size_t streambuf_fast_peek(u8_t **buf, size_t *used, bool_t *streaming);
+
+extern void streambuf_fast_consume(size_t len);
+
+extern size_t streambuf_peek(u8_t **buf, size_t *used, bool_t *streaming);
+
+/* copy up to max bytes across the fifo wrap, without consuming them */
+extern size_t streambuf_peek_copy(u8_t *buf, size_t max);
+
+extern void streambuf_consume(size_t len);
+
+/* discard len bytes, used by the decoders to seek forward. returns false
+ * without consuming anything unless all the bytes are in the streambuf.
+ */
+extern bool_t streambuf_skip(size_t len);
+
+extern bool_t streambuf_has_filter(void);
+
 extern ssize_t streambuf_feed_fd(int fd, lua_State *L);
 
 extern bool_t streambuf_is_copyright();
@@ -54,4 +85,6 @@ extern void streambuf_set_filter(streambuf_filter_t filter);
 
 extern bool_t streambuf_is_icy();
 
+extern void streambuf_set_reader_thread(bool_t enabled);
+
 extern int luaopen_streambuf(lua_State *L);
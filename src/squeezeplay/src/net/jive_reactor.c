@@ -0,0 +1,607 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "ui/timer_queue.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+
+typedef SOCKET socket_t;
+#define REACTOR_SELECT
+
+#elif defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+
+typedef int socket_t;
+#define REACTOR_EPOLL
+
+#else
+#include <poll.h>
+
+typedef int socket_t;
+#define REACTOR_POLL
+
+#endif
+
+
+/* The network thread reactor. Sockets stay registered between calls to
+ * wait, so the cost of a wait is proportional to the number of ready
+ * sockets and not the number of open sockets. Uses epoll on linux, and
+ * poll or select on other platforms.
+ *
+ * Each socket may have an inactivity timeout for reading and writing,
+ * these are kept in a timer queue and restarted whenever the socket is
+ * ready. An expired timeout is reported by wait and restarted.
+ *
+ * Sockets are identified by their file descriptor. A socket that is
+ * closed while registered is dropped by the kernel (epoll) or when poll
+ * reports it as invalid, its timeouts still run until it is removed.
+ */
+
+#define REACTOR_READ  0
+#define REACTOR_WRITE 1
+
+static LOG_CATEGORY *log_net_thread;
+
+/* maximum events returned by one epoll_wait */
+#define REACTOR_MAX_EVENTS 64
+
+
+#if defined(REACTOR_SELECT)
+/* select is used like poll */
+struct reactor_pollfd {
+	socket_t fd;
+	short events;
+	short revents;
+};
+
+#define POLLIN   0x0001
+#define POLLOUT  0x0004
+#define POLLERR  0x0008
+#define POLLHUP  0x0010
+#define POLLNVAL 0x0020
+
+#elif defined(REACTOR_POLL)
+#define reactor_pollfd pollfd
+#endif
+
+
+struct reactor_fd {
+	/* registered for reading and writing */
+	bool registered[2];
+
+	/* inactivity timeout, read and write, 0 for none */
+	Uint32 timeout[2];
+
+#if !defined(REACTOR_EPOLL)
+	/* index in pollfds, -1 if not polled */
+	int index;
+#endif
+};
+
+
+struct reactor {
+#if defined(REACTOR_EPOLL)
+	int epfd;
+#else
+	struct reactor_pollfd *pollfds;
+	size_t num_pollfds, size_pollfds;
+#endif
+
+	/* state by file descriptor */
+	struct reactor_fd *fds;
+	size_t num_fds;
+
+	/* inactivity timeouts, the id is fd * 2 + direction */
+	struct timer_queue timeouts;
+};
+
+
+static struct reactor_fd *get_fd(struct reactor *r, socket_t fd, bool create) {
+	if ((size_t)fd >= r->num_fds) {
+		size_t num_fds = r->num_fds ? r->num_fds : 64;
+		struct reactor_fd *fds;
+
+		if (!create) {
+			return NULL;
+		}
+
+		while ((size_t)fd >= num_fds) {
+			num_fds <<= 1;
+		}
+
+		fds = realloc(r->fds, num_fds * sizeof(struct reactor_fd));
+		if (!fds) {
+			return NULL;
+		}
+
+		memset(fds + r->num_fds, 0, (num_fds - r->num_fds) * sizeof(struct reactor_fd));
+#if !defined(REACTOR_EPOLL)
+		{
+			size_t i;
+
+			for (i = r->num_fds; i < num_fds; i++) {
+				fds[i].index = -1;
+			}
+		}
+#endif
+
+		r->fds = fds;
+		r->num_fds = num_fds;
+	}
+
+	return &r->fds[fd];
+}
+
+
+#if defined(REACTOR_EPOLL)
+
+static int update_fd(struct reactor *r, socket_t fd, struct reactor_fd *f) {
+	struct epoll_event ev;
+	int op;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	ev.events = (f->registered[REACTOR_READ] ? EPOLLIN : 0) | (f->registered[REACTOR_WRITE] ? EPOLLOUT : 0);
+
+	op = ev.events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+	if (epoll_ctl(r->epfd, op, fd, &ev) == 0) {
+		return 0;
+	}
+
+	/* the fd may have been closed and reused */
+	if (errno == ENOENT && ev.events) {
+		if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+			return 0;
+		}
+	}
+	else if (errno == ENOENT || errno == EBADF) {
+		return 0;
+	}
+
+	return -1;
+}
+
+#else
+
+static void pollfd_delete(struct reactor *r, struct reactor_fd *f) {
+	struct reactor_pollfd *last;
+
+	r->num_pollfds--;
+	last = &r->pollfds[r->num_pollfds];
+
+	if (f->index != (int)r->num_pollfds) {
+		r->pollfds[f->index] = *last;
+		r->fds[last->fd].index = f->index;
+	}
+	f->index = -1;
+}
+
+
+static int update_fd(struct reactor *r, socket_t fd, struct reactor_fd *f) {
+	short events;
+
+	events = (f->registered[REACTOR_READ] ? POLLIN : 0) | (f->registered[REACTOR_WRITE] ? POLLOUT : 0);
+
+	if (!events) {
+		if (f->index >= 0) {
+			pollfd_delete(r, f);
+		}
+		return 0;
+	}
+
+	if (f->index < 0) {
+		if (r->num_pollfds == r->size_pollfds) {
+			size_t size = r->size_pollfds ? r->size_pollfds << 1 : 32;
+			struct reactor_pollfd *pollfds;
+
+			pollfds = realloc(r->pollfds, size * sizeof(struct reactor_pollfd));
+			if (!pollfds) {
+				return -1;
+			}
+
+			r->pollfds = pollfds;
+			r->size_pollfds = size;
+		}
+
+		f->index = r->num_pollfds++;
+		r->pollfds[f->index].fd = fd;
+	}
+
+	r->pollfds[f->index].events = events;
+	r->pollfds[f->index].revents = 0;
+
+	return 0;
+}
+
+#endif
+
+
+#if defined(REACTOR_SELECT)
+
+static int reactor_poll(struct reactor_pollfd *pollfds, size_t num, int timeout) {
+	fd_set rset, wset, eset;
+	struct timeval tv;
+	size_t i;
+	int n;
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	FD_ZERO(&eset);
+
+	for (i = 0; i < num; i++) {
+		if (pollfds[i].events & POLLIN) {
+			FD_SET(pollfds[i].fd, &rset);
+		}
+		if (pollfds[i].events & POLLOUT) {
+			FD_SET(pollfds[i].fd, &wset);
+		}
+		FD_SET(pollfds[i].fd, &eset);
+	}
+
+	if (num == 0) {
+		/* select fails with no sockets on windows */
+		Sleep(timeout);
+		return 0;
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	n = select(0, &rset, &wset, &eset, &tv);
+	if (n <= 0) {
+		return n;
+	}
+
+	for (i = 0; i < num; i++) {
+		pollfds[i].revents =
+			(FD_ISSET(pollfds[i].fd, &rset) ? POLLIN : 0) |
+			(FD_ISSET(pollfds[i].fd, &wset) ? POLLOUT : 0) |
+			(FD_ISSET(pollfds[i].fd, &eset) ? POLLERR : 0);
+	}
+
+	return n;
+}
+
+#elif defined(REACTOR_POLL)
+
+#define reactor_poll(pollfds, num, timeout) poll(pollfds, num, timeout)
+
+#endif
+
+
+/* add the fd to the result table at index idx, created if needed */
+static void push_fd(lua_State *L, int idx, int *n, socket_t fd) {
+	if (lua_isnil(L, idx)) {
+		lua_newtable(L);
+		lua_replace(L, idx);
+	}
+
+	lua_pushinteger(L, fd);
+	lua_rawseti(L, idx, ++(*n));
+}
+
+
+/* the socket is ready, report it and restart its timeout */
+static void ready_fd(lua_State *L, struct reactor *r, socket_t fd, int dir, Uint32 now, int *n) {
+	struct reactor_fd *f = get_fd(r, fd, false);
+
+	if (!f || !f->registered[dir]) {
+		return;
+	}
+
+	push_fd(L, 3 + dir, &n[dir], fd);
+
+	if (f->timeout[dir]) {
+		timer_queue_insert(&r->timeouts, fd * 2 + dir, now + f->timeout[dir]);
+	}
+}
+
+
+static int jiveL_reactor_open(lua_State *L) {
+	struct reactor *r;
+
+	r = lua_newuserdata(L, sizeof(struct reactor));
+	memset(r, 0, sizeof(struct reactor));
+	timer_queue_init(&r->timeouts);
+
+#if defined(REACTOR_EPOLL)
+	r->epfd = epoll_create(64);
+	if (r->epfd < 0) {
+		return luaL_error(L, "epoll_create failed: %s", strerror(errno));
+	}
+#endif
+
+	luaL_getmetatable(L, "jive.reactor");
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+
+static int jiveL_reactor_gc(lua_State *L) {
+	struct reactor *r = lua_touserdata(L, 1);
+
+#if defined(REACTOR_EPOLL)
+	if (r->epfd >= 0) {
+		close(r->epfd);
+		r->epfd = -1;
+	}
+#else
+	free(r->pollfds);
+	r->pollfds = NULL;
+#endif
+
+	free(r->fds);
+	r->fds = NULL;
+	r->num_fds = 0;
+
+	timer_queue_free(&r->timeouts);
+
+	return 0;
+}
+
+
+static int reactor_add(lua_State *L, int dir) {
+	struct reactor *r;
+	struct reactor_fd *f;
+	lua_Number n;
+	socket_t fd;
+	Uint32 timeout;
+
+	/* stack is:
+	 * 1: reactor
+	 * 2: fd
+	 * 3: timeout ms, 0 for no timeout
+	 */
+
+	r = luaL_checkudata(L, 1, "jive.reactor");
+	n = luaL_checknumber(L, 2);
+	timeout = luaL_optinteger(L, 3, 0);
+
+	/* closed sockets have an invalid fd, like select they are ignored */
+	if (n < 0) {
+		return 0;
+	}
+	fd = (socket_t) n;
+#if defined(_WIN32)
+	if (fd == INVALID_SOCKET) {
+		return 0;
+	}
+#endif
+
+	f = get_fd(r, fd, true);
+	if (!f) {
+		return luaL_error(L, "out of memory");
+	}
+
+	/* the timeout restarts if the socket is new or the timeout changed */
+	if (!f->registered[dir] || f->timeout[dir] != timeout) {
+		if (timeout) {
+			timer_queue_insert(&r->timeouts, fd * 2 + dir, jive_jiffies() + timeout);
+		}
+		else {
+			timer_queue_remove(&r->timeouts, fd * 2 + dir);
+		}
+	}
+	f->timeout[dir] = timeout;
+
+	if (!f->registered[dir]) {
+		f->registered[dir] = true;
+
+		if (update_fd(r, fd, f) < 0) {
+			f->registered[dir] = false;
+			timer_queue_remove(&r->timeouts, fd * 2 + dir);
+
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(errno));
+			return 2;
+		}
+	}
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+static int reactor_remove(lua_State *L, int dir) {
+	struct reactor *r;
+	struct reactor_fd *f;
+	lua_Number n;
+	socket_t fd;
+
+	/* stack is:
+	 * 1: reactor
+	 * 2: fd
+	 */
+
+	r = luaL_checkudata(L, 1, "jive.reactor");
+	n = luaL_checknumber(L, 2);
+
+	if (n < 0) {
+		return 0;
+	}
+	fd = (socket_t) n;
+
+	f = get_fd(r, fd, false);
+	if (!f || !f->registered[dir]) {
+		return 0;
+	}
+
+	f->registered[dir] = false;
+	f->timeout[dir] = 0;
+	timer_queue_remove(&r->timeouts, fd * 2 + dir);
+
+	update_fd(r, fd, f);
+
+	return 0;
+}
+
+
+static int jiveL_reactor_add_read(lua_State *L) {
+	return reactor_add(L, REACTOR_READ);
+}
+
+
+static int jiveL_reactor_add_write(lua_State *L) {
+	return reactor_add(L, REACTOR_WRITE);
+}
+
+
+static int jiveL_reactor_remove_read(lua_State *L) {
+	return reactor_remove(L, REACTOR_READ);
+}
+
+
+static int jiveL_reactor_remove_write(lua_State *L) {
+	return reactor_remove(L, REACTOR_WRITE);
+}
+
+
+static int jiveL_reactor_wait(lua_State *L) {
+	struct reactor *r;
+	Uint32 now, expires;
+	int timeout, i, id, num;
+	int n[2] = { 0, 0 }, nt[2] = { 0, 0 };
+
+	/* stack is:
+	 * 1: reactor
+	 * 2: timeout ms
+	 *
+	 * returns tables of the fds ready for reading and writing, and the
+	 * fds whose read and write timeouts expired, or nil for none.
+	 */
+
+	r = luaL_checkudata(L, 1, "jive.reactor");
+	timeout = luaL_checkinteger(L, 2);
+	if (timeout < 0) {
+		timeout = 0;
+	}
+
+	lua_settop(L, 2);
+	lua_pushnil(L); // 3: read
+	lua_pushnil(L); // 4: write
+	lua_pushnil(L); // 5: read timeouts
+	lua_pushnil(L); // 6: write timeouts
+
+	/* wake for the next inactivity timeout */
+	now = jive_jiffies();
+	if (timer_queue_peek(&r->timeouts, &expires) >= 0) {
+		Sint32 d = (Sint32)(expires - now);
+
+		if (d < timeout) {
+			timeout = (d > 0) ? d : 0;
+		}
+	}
+
+#if defined(REACTOR_EPOLL)
+	{
+		struct epoll_event events[REACTOR_MAX_EVENTS];
+
+		num = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, timeout);
+		now = jive_jiffies();
+
+		for (i = 0; i < num; i++) {
+			socket_t fd = events[i].data.fd;
+
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				ready_fd(L, r, fd, REACTOR_READ, now, n);
+			}
+			if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				ready_fd(L, r, fd, REACTOR_WRITE, now, n);
+			}
+		}
+	}
+#else
+	num = reactor_poll(r->pollfds, r->num_pollfds, timeout);
+	now = jive_jiffies();
+
+	if (num > 0) {
+		size_t j = 0;
+
+		while (j < r->num_pollfds) {
+			struct reactor_pollfd *p = &r->pollfds[j];
+			socket_t fd = p->fd;
+			short revents = p->revents;
+
+			p->revents = 0;
+
+			if (revents & POLLNVAL) {
+				/* closed while registered, stop polling it */
+				pollfd_delete(r, &r->fds[fd]);
+				continue;
+			}
+
+			if (revents & (POLLIN | POLLERR | POLLHUP)) {
+				ready_fd(L, r, fd, REACTOR_READ, now, n);
+			}
+			if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+				ready_fd(L, r, fd, REACTOR_WRITE, now, n);
+			}
+			j++;
+		}
+	}
+#endif
+
+	if (num < 0 && errno != EINTR) {
+		LOG_ERROR(log_net_thread, "wait failed: %s", strerror(errno));
+	}
+
+	/* inactivity timeouts, restarted until the socket is removed */
+	while ((id = timer_queue_pop(&r->timeouts, now)) >= 0) {
+		socket_t fd = id >> 1;
+		int dir = id & 1;
+		struct reactor_fd *f = get_fd(r, fd, false);
+
+		push_fd(L, 5 + dir, &nt[dir], fd);
+
+		if (f && f->timeout[dir]) {
+			timer_queue_insert(&r->timeouts, id, now + f->timeout[dir]);
+		}
+	}
+
+	return 4;
+}
+
+
+static const struct luaL_Reg reactor_lib[] = {
+	{ "open", jiveL_reactor_open },
+	{ NULL, NULL }
+};
+
+
+int luaopen_jive_net_reactor(lua_State *L) {
+	log_net_thread = LOG_CATEGORY_GET("net.thread");
+
+	luaL_newmetatable(L, "jive.reactor");
+
+	lua_pushcfunction(L, jiveL_reactor_gc);
+	lua_setfield(L, -2, "__gc");
+
+	lua_pushcfunction(L, jiveL_reactor_add_read);
+	lua_setfield(L, -2, "addRead");
+
+	lua_pushcfunction(L, jiveL_reactor_add_write);
+	lua_setfield(L, -2, "addWrite");
+
+	lua_pushcfunction(L, jiveL_reactor_remove_read);
+	lua_setfield(L, -2, "removeRead");
+
+	lua_pushcfunction(L, jiveL_reactor_remove_write);
+	lua_setfield(L, -2, "removeWrite");
+
+	lua_pushcfunction(L, jiveL_reactor_wait);
+	lua_setfield(L, -2, "wait");
+
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+
+	luaL_register(L, "jive.reactor", reactor_lib);
+
+	return 0;
+}
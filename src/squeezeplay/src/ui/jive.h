@@ -172,6 +172,7 @@ enum {
 	/* reserved: 0x00000002 */
 	/* reserved: 0x00000003 */
 	JIVE_USER_EVENT_EVENT		= 0x00000004,
+	JIVE_USER_EVENT_IMAGE_DECODE	= 0x00000005,
 };
 
 
@@ -283,12 +284,13 @@ struct jive_font {
 	Uint16 size;
 
 	// Specific font functions
-	SDL_Surface *(*draw)(struct jive_font *, Uint32, const char *);
-	int (*width)(struct jive_font *, const char *);
+	SDL_Surface *(*draw)(struct jive_font *, Uint32, const char *, size_t);
+	int (*width)(struct jive_font *, const char *, size_t);
 	void (*destroy)(struct jive_font *);
 
 	// Data for specifc font types
 	TTF_Font *ttf;
+	struct jive_glyph_cache *glyphs;
 	int height;
 	int capheight;
 	int ascend;
@@ -305,6 +307,7 @@ struct jive_perfwarn {
 	Uint32 event;
 	int queue;
 	Uint32 garbage;
+	Uint32 pixels;
 };
 
 
@@ -350,7 +353,7 @@ JiveSurface *jive_surface_newRGBA(Uint16 w, Uint16 h);
 JiveSurface *jive_surface_new_SDLSurface(SDL_Surface *sdl_surface);
 JiveSurface *jive_surface_ref(JiveSurface *srf);
 JiveSurface *jive_surface_load_image(const char *path);
-JiveSurface *jive_surface_load_image_data(const char *data, size_t len);
+JiveSurface *jive_surface_load_image_data(const char *data, size_t len, Uint16 max_w, Uint16 max_h);
 int jive_surface_set_wm_icon(JiveSurface *srf);
 int jive_surface_save_bmp(JiveSurface *srf, const char *file);
 int jive_surface_cmp(JiveSurface *a, JiveSurface *b, Uint32 key);
@@ -362,6 +365,8 @@ void jive_surface_push_clip(JiveSurface *srf, SDL_Rect *r, SDL_Rect *pop);
 void jive_surface_set_clip_arg(JiveSurface *srf, Uint16 x, Uint16 y, Uint16 w, Uint16 h);
 void jive_surface_get_clip_arg(JiveSurface *srf, Uint16 *x, Uint16 *y, Uint16 *w, Uint16 *h);
 void jive_surface_flip(JiveSurface *srf);
+void jive_surface_update_rects(JiveSurface *srf, SDL_Rect *rects, int num_rects);
+bool jive_surface_is_double_buffered(JiveSurface *srf);
 void jive_surface_blit(JiveSurface *src, JiveSurface *dst, Uint16 dx, Uint16 dy);
 void jive_surface_blit_clip(JiveSurface *src, Uint16 sx, Uint16 sy, Uint16 sw, Uint16 sh,
 			    JiveSurface* dst, Uint16 dx, Uint16 dy);
@@ -405,6 +410,7 @@ JiveTile *jive_tile_ref(JiveTile *tile);
 void jive_tile_get_min_size(JiveTile *tile, Uint16 *w, Uint16 *h);
 void jive_tile_set_alpha(JiveTile *tile, Uint32 flags);
 void jive_tile_free(JiveTile *tile);
+bool jive_tile_prefetch(JiveTile *tile);
 void jive_tile_blit(JiveTile *tile, JiveSurface *dst, Uint16 dx, Uint16 dy, Uint16 dw, Uint16 dh);
 void jive_tile_blit_centered(JiveTile *tile, JiveSurface *dst, Uint16 dx, Uint16 dy, Uint16 dw, Uint16 dh);
 SDL_Surface *jive_tile_get_image_surface(JiveTile *tile);
@@ -424,9 +430,17 @@ int jive_font_ascend(JiveFont *font);
 int jive_font_offset(JiveFont *font);
 JiveSurface *jive_font_draw_text(JiveFont *font, Uint32 color, const char *str);
 JiveSurface *jive_font_ndraw_text(JiveFont *font, Uint32 color, const char *str, size_t len);
+JiveSurface *jive_font_draw_text_uncached(JiveFont *font, Uint32 color, const char *str);
+void jive_font_text_cache_flush(void);
 Uint32 utf8_get_char(const char *ptr, const char **nptr);
 
 
+/* Background image decoder */
+SDL_Surface *jive_image_load_scaled(const char *data, size_t len, Uint16 max_w, Uint16 max_h);
+void jive_image_decode_done(lua_State *L, void *data);
+void jive_image_decode_quit(void);
+
+
 /* C helper functions */
 void jive_redraw(SDL_Rect *r);
 void jive_pushevent(lua_State *L, JiveEvent *event);
@@ -453,6 +467,15 @@ int jiveL_get_background(lua_State *L);
 int jiveL_set_background(lua_State *L);
 int jiveL_dispatch_event(lua_State *L);
 int jiveL_dirty(lua_State *L);
+int jiveL_text_cache(lua_State *L);
+int jiveL_image_cache(lua_State *L);
+int jiveL_decode_image(lua_State *L);
+int jiveL_cancel_decode(lua_State *L);
+
+int jiveL_timer_queue_insert(lua_State *L);
+int jiveL_timer_queue_remove(lua_State *L);
+int jiveL_timer_queue_pop(lua_State *L);
+int jiveL_timer_queue_next(lua_State *L);
 
 int jiveL_event_new(lua_State *L);
 int jiveL_event_tostring(lua_State* L);
@@ -528,6 +551,7 @@ int jiveL_textarea_gc(lua_State *L);
 
 int jiveL_window_skin(lua_State *L);
 int jiveL_window_check_layout(lua_State *L);
+int jiveL_window_prefetch(lua_State *L);
 int jiveL_window_iterate(lua_State *L);
 int jiveL_window_draw_or_transition(lua_State *L);
 int jiveL_window_draw(lua_State *L);
@@ -14,13 +14,60 @@ static const char *JIVE_FONT_MAGIC = "Font";
 static JiveFont *fonts = NULL;
 
 
+/* Glyph cache. The metrics and coverage of each glyph are cached per font,
+ * the coverage in an 8-bit atlas, and text is measured and drawn from the
+ * cache without calling SDL_ttf. The widths and pixels are the same as
+ * TTF_SizeUTF8 and TTF_RenderUTF8_Blended.
+ */
+
+/* atlas row length, glyphs are packed in shelves */
+#define GLYPH_ATLAS_WIDTH 512
+
+/* the cache is flushed when the atlas would grow past this */
+#define GLYPH_ATLAS_MAX_BYTES (512 * 1024)
+
+/* initial glyph table size, a power of two */
+#define GLYPH_TABLE_SIZE 128
+
+/* kerning pair cache size, a power of two */
+#define GLYPH_KERN_BITS 9
+#define GLYPH_KERN_SIZE (1 << GLYPH_KERN_BITS)
+
+struct jive_glyph {
+	bool valid;
+	Uint16 ch;
+	Sint16 minx, maxx, advance, yoffset;
+	Uint16 w, h;
+	Uint32 offset; /* into the atlas */
+};
+
+struct jive_glyph_cache {
+	/* open addressed by character */
+	struct jive_glyph *table;
+	int table_size, table_used;
+
+	Uint8 *atlas;
+	int atlas_h;
+	int shelf_x, shelf_y, shelf_h;
+
+	/* SDL_ttf font height, the height of the rendered text */
+	int height;
+
+	bool kerning;
+	Uint32 kern_pair[GLYPH_KERN_SIZE];
+	Sint8 kern[GLYPH_KERN_SIZE];
+};
+
+
 static int load_ttf_font(JiveFont *font, const char *name, Uint16 size);
 
 static void destroy_ttf_font(JiveFont *font);
 
-static int width_ttf_font(JiveFont *font, const char *str);
+static int width_ttf_font(JiveFont *font, const char *str, size_t len);
+
+static SDL_Surface *draw_ttf_font(JiveFont *font, Uint32 color, const char *str, size_t len);
 
-static SDL_Surface *draw_ttf_font(JiveFont *font, Uint32 color, const char *str);
+static void text_cache_purge_font(JiveFont *font);
 
 
 
@@ -76,6 +123,8 @@ void jive_font_free(JiveFont *font) {
 		return;
 	}
 
+	text_cache_purge_font(font);
+
 	if (font == fonts) {
 		fonts = font->next;
 	}
@@ -104,24 +153,21 @@ void jive_font_free(JiveFont *font) {
 int jive_font_width(JiveFont *font, const char *str) {
 	assert(font && font->magic == JIVE_FONT_MAGIC);
 
-	return font->width(font, str);
+	if (!str) {
+		return 0;
+	}
+
+	return font->width(font, str, strlen(str));
 }
 
 int jive_font_nwidth(JiveFont *font, const char *str, size_t len) {
-	char *tmp;
-
 	assert(font && font->magic == JIVE_FONT_MAGIC);
 
 	if (len <= 0) {
 		return 0;
 	}
 
-	// FIXME use utf8 len
-	tmp = alloca(len + 1);
-	strncpy(tmp, str, len);
-	*(tmp + len) = '\0';
-
-	return font->width(font, tmp);
+	return font->width(font, str, len);
 }
 
 int jive_font_miny_char(JiveFont *font, Uint16 ch) {
@@ -168,6 +214,240 @@ int jive_font_offset(JiveFont *font) {
 	return font->ascend - font->capheight;
 }
 
+static void glyph_cache_flush(struct jive_glyph_cache *cache) {
+	memset(cache->table, 0, sizeof(struct jive_glyph) * cache->table_size);
+	cache->table_used = 0;
+
+	cache->shelf_x = 0;
+	cache->shelf_y = 0;
+	cache->shelf_h = 0;
+}
+
+static struct jive_glyph *glyph_slot(struct jive_glyph_cache *cache, Uint16 ch) {
+	int mask = cache->table_size - 1;
+	int i = ch & mask;
+
+	while (cache->table[i].valid && cache->table[i].ch != ch) {
+		i = (i + 1) & mask;
+	}
+
+	return &cache->table[i];
+}
+
+/* Returns false, keeping the old table, if there is no memory */
+static bool glyph_table_grow(struct jive_glyph_cache *cache) {
+	struct jive_glyph *old = cache->table, *table;
+	int i, old_size = cache->table_size;
+
+	table = calloc(old_size * 2, sizeof(struct jive_glyph));
+	if (!table) {
+		return false;
+	}
+
+	cache->table = table;
+	cache->table_size = old_size * 2;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].valid) {
+			*glyph_slot(cache, old[i].ch) = old[i];
+		}
+	}
+
+	free(old);
+
+	return true;
+}
+
+/* Find room for a w x h glyph in the atlas, returns false if it is full */
+static bool glyph_atlas_alloc(struct jive_glyph_cache *cache, int w, int h, Uint32 *offset) {
+	if (cache->shelf_x + w > GLYPH_ATLAS_WIDTH) {
+		cache->shelf_y += cache->shelf_h;
+		cache->shelf_x = 0;
+		cache->shelf_h = 0;
+	}
+
+	if (cache->shelf_y + h > cache->atlas_h) {
+		int atlas_h = MAX(cache->atlas_h * 2, cache->shelf_y + h);
+		Uint8 *atlas;
+
+		if (atlas_h * GLYPH_ATLAS_WIDTH > GLYPH_ATLAS_MAX_BYTES) {
+			return false;
+		}
+
+		/* out of memory is handled as a full atlas */
+		atlas = realloc(cache->atlas, atlas_h * GLYPH_ATLAS_WIDTH);
+		if (!atlas) {
+			return false;
+		}
+
+		cache->atlas = atlas;
+		cache->atlas_h = atlas_h;
+	}
+
+	*offset = cache->shelf_y * GLYPH_ATLAS_WIDTH + cache->shelf_x;
+
+	cache->shelf_x += w;
+	cache->shelf_h = MAX(cache->shelf_h, h);
+
+	return true;
+}
+
+/* Returns false if the atlas is full */
+static bool glyph_load(JiveFont *font, struct jive_glyph *glyph, Uint16 ch) {
+	struct jive_glyph_cache *cache = font->glyphs;
+	int minx, maxx, miny, maxy, advance;
+	SDL_Color white = { 0xFF, 0xFF, 0xFF, 0 };
+	SDL_Surface *srf;
+	int row, col;
+
+	memset(glyph, 0, sizeof(struct jive_glyph));
+	glyph->valid = true;
+	glyph->ch = ch;
+
+	if (TTF_GlyphMetrics(font->ttf, ch, &minx, &maxx, &miny, &maxy, &advance) != 0) {
+		return true;
+	}
+
+	glyph->minx = minx;
+	glyph->maxx = maxx;
+	glyph->advance = advance;
+	glyph->yoffset = font->ascend - maxy;
+
+	srf = TTF_RenderGlyph_Blended(font->ttf, ch, white);
+	if (!srf) {
+		return true;
+	}
+
+	/* as SDL_ttf, the pixmap may be wider than the glyph */
+	glyph->w = MIN(MIN(srf->w, maxx - minx), GLYPH_ATLAS_WIDTH);
+	glyph->h = srf->h;
+
+	if (!glyph_atlas_alloc(cache, glyph->w, glyph->h, &glyph->offset)) {
+		SDL_FreeSurface(srf);
+		return false;
+	}
+
+	for (row = 0; row < glyph->h; row++) {
+		Uint32 *src = (Uint32 *)((Uint8 *)srf->pixels + row * srf->pitch);
+		Uint8 *dst = cache->atlas + glyph->offset + row * GLYPH_ATLAS_WIDTH;
+
+		for (col = 0; col < glyph->w; col++) {
+			*dst++ = *src++ >> 24;
+		}
+	}
+
+	SDL_FreeSurface(srf);
+
+	return true;
+}
+
+/* The glyph is only valid until the next call */
+static struct jive_glyph *glyph_get(JiveFont *font, Uint16 ch) {
+	struct jive_glyph_cache *cache = font->glyphs;
+	struct jive_glyph *glyph;
+
+	glyph = glyph_slot(cache, ch);
+	if (glyph->valid) {
+		return glyph;
+	}
+
+	if ((cache->table_used + 1) * 4 > cache->table_size * 3) {
+		if (!glyph_table_grow(cache)) {
+			/* the table must not fill up, start again */
+			glyph_cache_flush(cache);
+		}
+		glyph = glyph_slot(cache, ch);
+	}
+
+	if (!glyph_load(font, glyph, ch)) {
+		/* the atlas is full, start again */
+		LOG_DEBUG(log_ui_draw, "glyph cache flush %s %d", font->name, font->size);
+
+		glyph_cache_flush(cache);
+
+		glyph = glyph_slot(cache, ch);
+		if (!glyph_load(font, glyph, ch)) {
+			glyph->w = glyph->h = 0;
+		}
+	}
+	cache->table_used++;
+
+	return glyph;
+}
+
+/* The width of a pair of glyphs, as TTF_SizeUNICODE */
+static int glyph_pair_width(struct jive_glyph *a, struct jive_glyph *b, int kern) {
+	int minx, maxx;
+
+	minx = MIN(0, a->minx);
+	maxx = MAX(a->advance, a->maxx);
+
+	minx = MIN(minx, a->advance + kern + b->minx);
+	maxx = MAX(maxx, a->advance + kern + MAX(b->advance, b->maxx));
+
+	return maxx - minx;
+}
+
+/* SDL_ttf does not give the kerning, find it from the width of the pair */
+static int glyph_kern(JiveFont *font, Uint16 a, Uint16 b) {
+	struct jive_glyph_cache *cache = font->glyphs;
+	struct jive_glyph ga, gb;
+	Uint32 pair = ((Uint32)a << 16) | b;
+	Uint16 text[3];
+	int i, w, kern;
+
+	if (!cache->kerning) {
+		return 0;
+	}
+
+	i = (pair * 2654435761U) >> (32 - GLYPH_KERN_BITS);
+	if (cache->kern_pair[i] == pair) {
+		return cache->kern[i];
+	}
+
+	text[0] = a;
+	text[1] = b;
+	text[2] = 0;
+
+	kern = 0;
+	if (TTF_SizeUNICODE(font->ttf, text, &w, NULL) == 0) {
+		ga = *glyph_get(font, a);
+		gb = *glyph_get(font, b);
+
+		kern = w - glyph_pair_width(&ga, &gb, 0);
+		kern = MAX(-128, MIN(kern, 127));
+	}
+
+	cache->kern_pair[i] = pair;
+	cache->kern[i] = kern;
+
+	return kern;
+}
+
+static void glyph_cache_init(JiveFont *font) {
+	struct jive_glyph_cache *cache;
+	const char *probe = "AVATToVaWaYoLTP.";
+	int i;
+
+	cache = calloc(1, sizeof(struct jive_glyph_cache));
+	cache->table_size = GLYPH_TABLE_SIZE;
+	cache->table = calloc(cache->table_size, sizeof(struct jive_glyph));
+	cache->height = TTF_FontHeight(font->ttf);
+
+	font->glyphs = cache;
+
+	/* only look up kerning pairs if the font has some */
+	cache->kerning = true;
+	for (i = 0; probe[i]; i += 2) {
+		if (glyph_kern(font, probe[i], probe[i + 1])) {
+			break;
+		}
+	}
+	cache->kerning = (probe[i] != '\0');
+
+	memset(cache->kern_pair, 0, sizeof(cache->kern_pair));
+}
+
 static int load_ttf_font(JiveFont *font, const char *name, Uint16 size) {
 	int miny, maxy, descent;
 	char *fullpath = malloc(PATH_MAX);
@@ -211,47 +491,154 @@ static int load_ttf_font(JiveFont *font, const char *name, Uint16 size) {
 	font->draw = draw_ttf_font;
 	font->destroy = destroy_ttf_font;
 
+	glyph_cache_init(font);
+
 	return 1;
 }
 
 static void destroy_ttf_font(JiveFont *font) {
+	if (font->glyphs) {
+		free(font->glyphs->table);
+		free(font->glyphs->atlas);
+		free(font->glyphs);
+		font->glyphs = NULL;
+	}
+
 	if (font->ttf) {
 		TTF_CloseFont(font->ttf);
 		font->ttf = NULL;
 	}
 }
 
-static int width_ttf_font(JiveFont *font, const char *str) {
-	int w, h;
+/* As utf8_get_char, but a sequence cut short by end is not read past
+ * end, it is replaced and ends the string.
+ */
+static Uint32 utf8_get_char_end(const char *ptr, const char *end, const char **nptr) {
+	Uint8 c = *(const Uint8 *)ptr;
+	int n = 1;
 
-	if (!str) {
-		return 0;
+	if (c >= 0xC0 && c <= 0xDF) {
+		n = 2;
+	}
+	else if (c >= 0xE0 && c <= 0xEF) {
+		n = 3;
+	}
+	else if (c >= 0xF0 && c <= 0xF4) {
+		n = 4;
+	}
+
+	if (end - ptr < n) {
+		*nptr = end;
+		return 0xFFFD;
+	}
+
+	return utf8_get_char(ptr, nptr);
+}
+
+static int width_ttf_font(JiveFont *font, const char *str, size_t len) {
+	const char *ptr = str, *end = str + len;
+	struct jive_glyph *glyph;
+	Uint16 ch, prev = 0;
+	int x = 0, minx = 0, maxx = 0;
+
+	while (ptr < end && *ptr) {
+		ch = utf8_get_char_end(ptr, end, &ptr);
+
+		if (prev) {
+			x += glyph_kern(font, prev, ch);
+		}
+
+		glyph = glyph_get(font, ch);
+
+		minx = MIN(minx, x + glyph->minx);
+		maxx = MAX(maxx, x + MAX(glyph->advance, glyph->maxx));
+
+		x += glyph->advance;
+		prev = ch;
 	}
 
-	TTF_SizeUTF8(font->ttf, str, &w, &h);
-	return w;
+	return maxx - minx;
 }
 
-static SDL_Surface *draw_ttf_font(JiveFont *font, Uint32 color, const char *str) {
+static SDL_Surface *draw_ttf_font(JiveFont *font, Uint32 color, const char *str, size_t len) {
 #ifdef JIVE_PROFILE_BLIT
 	Uint32 t0 = jive_jiffies(), t1;
 #endif //JIVE_PROFILE_BLIT
-	SDL_Color clr;
+	const SDL_VideoInfo *video_info;
+	const char *ptr = str, *end = str + len;
+	struct jive_glyph *glyph;
+	Uint32 pixel, *pixels;
 	SDL_Surface *srf;
+	Uint16 ch, prev = 0;
+	int width, xstart = 0;
+	int row, col, col0, col1, x, y;
 
-	// don't call render for null strings as it produces an error which we want to hide
-	if (*str == '\0') {
+	// don't render strings without any pixels
+	width = width_ttf_font(font, str, len);
+	if (width == 0) {
 		return NULL;
 	}
 
-	clr.r = (color >> 24) & 0xFF;
-	clr.g = (color >> 16) & 0xFF;
-	clr.b = (color >> 8) & 0xFF;
-
-	srf = TTF_RenderUTF8_Blended(font->ttf, str, clr);
+	/* the same format as SDL_ttf */
+	video_info = SDL_GetVideoInfo();
+	if (video_info->vfmt->Rmask < video_info->vfmt->Bmask) {
+		srf = SDL_CreateRGBSurface(SDL_SWSURFACE, width, font->glyphs->height, 32,
+					   0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+	}
+	else {
+		srf = SDL_CreateRGBSurface(SDL_SWSURFACE, width, font->glyphs->height, 32,
+					   0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	}
 
 	if (!srf) {
-		LOG_ERROR(log_ui_draw, "render returned error: %s\n", TTF_GetError());
+		LOG_ERROR(log_ui_draw, "render returned error: %s\n", SDL_GetError());
+		return NULL;
+	}
+
+	pixel = SDL_MapRGBA(srf->format, (color >> 24) & 0xFF, (color >> 16) & 0xFF, (color >> 8) & 0xFF, 0x00);
+	SDL_FillRect(srf, NULL, pixel);
+
+	pixels = (Uint32 *)srf->pixels;
+
+	while (ptr < end && *ptr) {
+		ch = utf8_get_char_end(ptr, end, &ptr);
+
+		if (prev) {
+			xstart += glyph_kern(font, prev, ch);
+		}
+
+		glyph = glyph_get(font, ch);
+
+		/* compensate for a negative minx on the first glyph */
+		if (!prev && glyph->minx < 0) {
+			xstart -= glyph->minx;
+		}
+
+		/* clip the glyph to the surface */
+		x = xstart + glyph->minx;
+		col0 = MAX(0, -x);
+		col1 = MIN(glyph->w, srf->w - x);
+
+		for (row = 0; row < glyph->h; row++) {
+			Uint8 *src;
+			Uint32 *dst;
+
+			y = row + glyph->yoffset;
+			if (y < 0 || y >= srf->h) {
+				continue;
+			}
+
+			src = font->glyphs->atlas + glyph->offset + row * GLYPH_ATLAS_WIDTH;
+			dst = pixels + y * (srf->pitch / 4) + x;
+
+			/* the coverage is or'd, as SDL_ttf */
+			for (col = col0; col < col1; col++) {
+				dst[col] |= src[col] << 24;
+			}
+		}
+
+		xstart += glyph->advance;
+		prev = ch;
 	}
 
 #if 0
@@ -273,26 +660,261 @@ static SDL_Surface *draw_ttf_font(JiveFont *font, Uint32 color, const char *str)
 	return srf;
 }
 
+/* Text cache. Rendered text is shared by font, color and string, so the
+ * labels and menu items showing the same strings reuse the surfaces rather
+ * than drawing them again. The cache holds a reference to each surface,
+ * and the least recently used are released when the cache grows past its
+ * byte limit. The surfaces returned by jive_font_draw_text must not be
+ * drawn on.
+ */
+
+/* default limit of the surface bytes held by the cache */
+#define TEXT_CACHE_MAX_BYTES (1024 * 1024)
+
+/* hash buckets, a power of two */
+#define TEXT_CACHE_BUCKETS 256
+
+struct jive_text_entry {
+	struct jive_text_entry *hash_next;
+
+	/* lru list, most recently used first */
+	struct jive_text_entry *prev, *next;
+
+	JiveFont *font;
+	Uint32 color;
+	Uint32 hash;
+	JiveSurface *srf;
+	size_t bytes;
+	size_t len;
+	char str[1];
+};
+
+static struct jive_text_entry *text_bucket[TEXT_CACHE_BUCKETS];
+static struct jive_text_entry *text_lru_head = NULL;
+static struct jive_text_entry *text_lru_tail = NULL;
+
+static struct {
+	size_t bytes;
+	size_t max_bytes;
+	Uint32 entries;
+	Uint32 hits;
+	Uint32 misses;
+	Uint32 evictions;
+} text_cache = { 0, TEXT_CACHE_MAX_BYTES, 0, 0, 0, 0 };
+
+
+static Uint32 text_hash(JiveFont *font, Uint32 color, const char *str, size_t len) {
+	Uint32 h = 2166136261u;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		h = (h ^ (Uint8)str[i]) * 16777619u;
+	}
+	h = (h ^ color) * 16777619u;
+	h = (h ^ (Uint32)(size_t)font) * 16777619u;
+
+	return h ^ (h >> 16);
+}
+
+
+static void text_lru_unlink(struct jive_text_entry *entry) {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	}
+	else {
+		text_lru_head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	}
+	else {
+		text_lru_tail = entry->prev;
+	}
+}
+
+
+static void text_lru_push(struct jive_text_entry *entry) {
+	entry->prev = NULL;
+	entry->next = text_lru_head;
+
+	if (text_lru_head) {
+		text_lru_head->prev = entry;
+	}
+	else {
+		text_lru_tail = entry;
+	}
+	text_lru_head = entry;
+}
+
+
+static void text_cache_remove(struct jive_text_entry *entry) {
+	struct jive_text_entry **ptr;
+
+	ptr = &text_bucket[entry->hash & (TEXT_CACHE_BUCKETS - 1)];
+	while (*ptr != entry) {
+		ptr = &(*ptr)->hash_next;
+	}
+	*ptr = entry->hash_next;
+
+	text_lru_unlink(entry);
+
+	text_cache.bytes -= entry->bytes;
+	text_cache.entries--;
+
+	/* the surface stays valid for any widget still using it */
+	jive_surface_free(entry->srf);
+	free(entry);
+}
+
+
+static void text_cache_trim(size_t max_bytes) {
+	while (text_lru_tail && text_cache.bytes > max_bytes) {
+		text_cache_remove(text_lru_tail);
+		text_cache.evictions++;
+	}
+}
+
+
+static void text_cache_purge_font(JiveFont *font) {
+	struct jive_text_entry *entry, *next;
+
+	for (entry = text_lru_head; entry; entry = next) {
+		next = entry->next;
+
+		if (entry->font == font) {
+			text_cache_remove(entry);
+		}
+	}
+}
+
+
+void jive_font_text_cache_flush(void) {
+	text_cache_trim(0);
+}
+
+
+static JiveSurface *text_cache_draw(JiveFont *font, Uint32 color, const char *str, size_t len) {
+	struct jive_text_entry *entry;
+	JiveSurface *srf;
+	Uint32 hash;
+	size_t bytes;
+
+	hash = text_hash(font, color, str, len);
+
+	for (entry = text_bucket[hash & (TEXT_CACHE_BUCKETS - 1)]; entry; entry = entry->hash_next) {
+		if (entry->hash == hash &&
+		    entry->font == font &&
+		    entry->color == color &&
+		    entry->len == len &&
+		    memcmp(entry->str, str, len) == 0) {
+
+			if (entry != text_lru_head) {
+				text_lru_unlink(entry);
+				text_lru_push(entry);
+			}
+
+			text_cache.hits++;
+			return jive_surface_ref(entry->srf);
+		}
+	}
+
+	text_cache.misses++;
+
+	srf = jive_surface_new_SDLSurface(font->draw(font, color, str, len));
+
+	/* large surfaces would flush the cache, and are rarely drawn again */
+	bytes = jive_surface_get_bytes(srf);
+	if (bytes == 0 || bytes > text_cache.max_bytes / 4) {
+		return srf;
+	}
+
+	text_cache_trim(text_cache.max_bytes - bytes);
+
+	entry = malloc(sizeof(struct jive_text_entry) + len);
+	if (!entry) {
+		return srf;
+	}
+
+	entry->font = font;
+	entry->color = color;
+	entry->hash = hash;
+	entry->srf = jive_surface_ref(srf);
+	entry->bytes = bytes;
+	entry->len = len;
+	memcpy(entry->str, str, len);
+	entry->str[len] = '\0';
+
+	entry->hash_next = text_bucket[hash & (TEXT_CACHE_BUCKETS - 1)];
+	text_bucket[hash & (TEXT_CACHE_BUCKETS - 1)] = entry;
+	text_lru_push(entry);
+
+	text_cache.bytes += bytes;
+	text_cache.entries++;
+
+	return srf;
+}
+
+
+int jiveL_text_cache(lua_State *L) {
+	/* stack is:
+	 * 1: framework
+	 * 2: cache limit in bytes, optional, 0 disables the cache
+	 */
+
+	if (lua_isnumber(L, 2)) {
+		text_cache.max_bytes = lua_tointeger(L, 2);
+		text_cache_trim(text_cache.max_bytes);
+	}
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, text_cache.hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, text_cache.misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushinteger(L, text_cache.evictions);
+	lua_setfield(L, -2, "evictions");
+	lua_pushinteger(L, text_cache.entries);
+	lua_setfield(L, -2, "entries");
+	lua_pushinteger(L, text_cache.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, text_cache.max_bytes);
+	lua_setfield(L, -2, "maxBytes");
+
+	return 1;
+}
+
+
 JiveSurface *jive_font_draw_text(JiveFont *font, Uint32 color, const char *str) {
 	assert(font && font->magic == JIVE_FONT_MAGIC);
 
 #ifdef JIVE_NO_DISPLAY
 	return (JiveSurface *)1;
 #else
-	return jive_surface_new_SDLSurface(str ? font->draw(font, color, str) : NULL);
+	return str ? text_cache_draw(font, color, str, strlen(str)) : jive_surface_new_SDLSurface(NULL);
 #endif
 }
 
 JiveSurface *jive_font_ndraw_text(JiveFont *font, Uint32 color, const char *str, size_t len) {
-	char *tmp;
+	assert(font && font->magic == JIVE_FONT_MAGIC);
 
-	// FIXME use utf8 len
+#ifdef JIVE_NO_DISPLAY
+	return (JiveSurface *)1;
+#else
+	return text_cache_draw(font, color, str, len);
+#endif
+}
 
-	tmp = alloca(len + 1);
-	strncpy(tmp, str, len);
-	*(tmp + len) = '\0';
-	
-	return jive_font_draw_text(font, color, tmp);
+JiveSurface *jive_font_draw_text_uncached(JiveFont *font, Uint32 color, const char *str) {
+	assert(font && font->magic == JIVE_FONT_MAGIC);
+
+#ifdef JIVE_NO_DISPLAY
+	return (JiveSurface *)1;
+#else
+	return jive_surface_new_SDLSurface(str ? font->draw(font, color, str, strlen(str)) : NULL);
+#endif
 }
 
 
@@ -313,6 +935,7 @@ binary 			hex 	decimal 	notes
 Uint32 utf8_get_char(const char *ptr, const char **nptr)
 {
 	Uint32 c, v;
+	int n = 0;
 	const unsigned char *uptr = (const unsigned char *)ptr;
 
 	c = *uptr++;
@@ -327,33 +950,37 @@ Uint32 utf8_get_char(const char *ptr, const char **nptr)
 	}
 	else if (c <= 223) {
 		/* 2-bytes */
-		v = (c & 0x1F) << 6;
-		c = *uptr++;
-		v |= (c & 0x3F);
+		v = c & 0x1F;
+		n = 1;
 	}
 	else if (c <= 239) {
 		/* 3-byte */
-		v = (c & 0x0F) << 12;
-		c = *uptr++;
-		v |= (c & 0x3F) << 6;
-		c = *uptr++;
-		v |= (c & 0x3F);
+		v = c & 0x0F;
+		n = 2;
 	}
 	else if (c <= 244) {
 		/* 4-byte */
-		v = (c & 0x07) << 18;
-		c = *uptr++;
-		v |= (c & 0x3F) << 12;
-		c = *uptr++;
-		v |= (c & 0x3F) << 6;
-		c = *uptr++;
-		v |= (c & 0x3F);
+		v = c & 0x07;
+		n = 3;
 	}
 	else {
 		/* error */
 		v = 0xFFFD;
 	}
 
+	while (n--) {
+		c = *uptr;
+		if ((c & 0xC0) != 0x80) {
+			/* truncated sequence, this includes the terminating
+			 * nul, so leave the byte for the next call
+			 */
+			v = 0xFFFD;
+			break;
+		}
+		v = (v << 6) | (c & 0x3F);
+		uptr++;
+	}
+
 	if (nptr) {
 		*nptr = (const char *)uptr;
 	}
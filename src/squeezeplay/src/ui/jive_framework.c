@@ -17,7 +17,25 @@ int (*jive_sdlfilter_pump)(const SDL_Event *event);
 LOG_CATEGORY *log_ui_draw;
 LOG_CATEGORY *log_ui;
 
-SDL_Rect jive_dirty_region, last_dirty_region;
+/* Dirty regions. Invalidated areas are kept as a short list of rects, and
+ * each rect is redrawn with the screen clipped to it. Redrawing a rect
+ * walks the whole widget tree, so rects are merged when that costs fewer
+ * than DIRTY_MERGE_SLACK extra pixels, and when the list is full.
+ */
+#define JIVE_MAX_DIRTY_RECTS 8
+
+#define DIRTY_MERGE_SLACK (128 * 64)
+
+static SDL_Rect dirty_rects[JIVE_MAX_DIRTY_RECTS];
+static int num_dirty_rects = 0;
+
+/* rects drawn in the last frame, for page flipped screens */
+static SDL_Rect last_dirty_rects[JIVE_MAX_DIRTY_RECTS];
+static int num_last_dirty_rects = 0;
+
+/* rects of the screen updated by the next flip */
+static SDL_Rect update_rects[JIVE_MAX_DIRTY_RECTS];
+static int num_update_rects = 0;
 
 /* global counter used to invalidate widget skin and layout */
 Uint32 jive_origin = 0;
@@ -25,7 +43,22 @@ static Uint32 next_jive_origin = 0;
 
 
 /* performance warning thresholds, 0 = disabled */
-struct jive_perfwarn perfwarn = { 0, 0, 0, 0, 0, 0 };
+struct jive_perfwarn perfwarn = { 0, 0, 0, 0, 0, 0, 0 };
+
+
+/* garbage collector counters, see jive.gcstats() */
+static struct {
+	Uint32 calls;     /* calls to Framework:_gcStep() */
+	Uint32 steps;     /* incremental gc steps */
+	Uint32 cycles;    /* completed collection cycles */
+	Uint32 time;      /* ms in gc steps */
+	Uint32 max_time;  /* longest single call, ms */
+	Uint32 skipped;   /* calls with no time budget */
+} gc_stats;
+
+/* a new collection cycle starts when the heap reaches this size */
+static int gc_pause_kb = 0;
+static bool gc_in_cycle = false;
 
 
 /* button hold threshold 1 seconds */
@@ -130,6 +163,7 @@ static struct jive_keyir irmap[] = {
 static int process_event(lua_State *L, SDL_Event *event);
 static void process_timers(lua_State *L);
 static int filter_events(const SDL_Event *event);
+static void dirty_rect_add(SDL_Rect *rects, int *num_rects, SDL_Rect *r);
 int jiveL_update_screen(lua_State *L);
 
 
@@ -333,6 +367,8 @@ static int jiveL_quit(lua_State *L) {
 	/* force lua GC */
 	lua_gc(L, LUA_GCCOLLECT, 0);
 
+	jive_image_decode_quit();
+
 	/* quit SDL */
 	SDL_Quit();
 
@@ -425,6 +461,7 @@ int jiveL_set_update_screen(lua_State *L) {
 static int _draw_screen(lua_State *L) {
 	JiveSurface *srf;
 	Uint32 t0 = 0, t1 = 0, t2 = 0, t3 = 0, t4 = 0;
+	Uint32 pixels = 0;
 	clock_t c0 = 0, c1 = 0;
 	bool_t standalone_draw, drawn = false;
 
@@ -472,35 +509,50 @@ static int _draw_screen(lua_State *L) {
  
 	/* Widget animations - don't update in a standalone draw as its not the main screen update */
 	if (!standalone_draw) {
+		Uint32 now = jive_jiffies();
+
 		lua_getfield(L, 1, "animations");
 		lua_pushnil(L);
 		while (lua_next(L, -2) != 0) {
 			lua_getfield(L, -1, "animations");
 			lua_pushnil(L);
 			while (lua_next(L, -2) != 0) {
-				int frame;
-				
+				Uint32 interval, due;
+
 				/* stack is:
 				 * -2: key
-				 * -1: table
+				 * -1: table { function, interval, due }
+				 *
+				 * animations are stepped by time, not by frame, so
+				 * they run at the same speed at any frame rate. they
+				 * are called if due within a quarter interval, as
+				 * frames may not land exactly on the due time.
 				 */
 				lua_rawgeti(L, -1, 2);
-				frame = lua_tointeger(L, -1) - 1;
-				
-				if (frame == 0) {
-					lua_rawgeti(L, -2, 1); // function
-					lua_pushvalue(L, -6); // widget
+				interval = lua_tointeger(L, -1);
+				lua_rawgeti(L, -2, 3);
+				due = lua_tointeger(L, -1);
+				lua_pop(L, 2);
+
+				if (due == 0) {
+					due = now + interval;
+				}
+				else if ((Sint32)(now - due) >= -(Sint32)(interval >> 2)) {
+					lua_rawgeti(L, -1, 1); // function
+					lua_pushvalue(L, -5); // widget
 					lua_call(L, 1, 0);
 					// function is poped by lua_call
-					
-					lua_rawgeti(L, -2, 3);
-					lua_rawseti(L, -3, 2);
-				}
-				else {
-				  lua_pushinteger(L, frame);
-				  lua_rawseti(L, -3, 2);
+
+					due += interval;
+					if ((Sint32)(now - due) >= 0) {
+						/* fallen behind, don't try to catch up */
+						due = now + interval;
+					}
 				}
-				lua_pop(L, 2);
+
+				lua_pushinteger(L, due);
+				lua_rawseti(L, -2, 3);
+				lua_pop(L, 1);
 			}
 			lua_pop(L, 2);
 		}
@@ -525,45 +577,85 @@ static int _draw_screen(lua_State *L) {
 		lua_pushvalue(L, 2);	// surface
 		lua_call(L, 2, 0);
 
+		if (!standalone_draw) {
+			update_rects[0].x = 0;
+			update_rects[0].y = 0;
+			update_rects[0].w = screen_w;
+			update_rects[0].h = screen_h;
+			num_update_rects = 1;
+		}
+		pixels = screen_w * screen_h;
+
 		drawn = true;
 	}
-	else if (jive_dirty_region.w || standalone_draw) {
-		SDL_Rect dirty;
+	else if (num_dirty_rects || standalone_draw) {
+		SDL_Rect rects[JIVE_MAX_DIRTY_RECTS];
+		int i, num_rects;
 
-		/* only redraw dirty region for non standalone draws */
-		if (!standalone_draw) {
-			jive_rect_union(&jive_dirty_region, &last_dirty_region, &dirty);
-			jive_surface_set_clip(srf, &dirty);
+		if (standalone_draw) {
+			/* one draw of the complete screen */
+			num_rects = 1;
+		}
+		else {
+			/* a page flipped screen shows the frame before last, so
+			 * the rects drawn in the last frame are redrawn too
+			 */
+			num_rects = 0;
+			for (i = 0; i < num_dirty_rects; i++) {
+				dirty_rect_add(rects, &num_rects, &dirty_rects[i]);
+			}
+			if (jive_surface_is_double_buffered(srf)) {
+				for (i = 0; i < num_last_dirty_rects; i++) {
+					dirty_rect_add(rects, &num_rects, &last_dirty_rects[i]);
+				}
+			}
 		}
 
+		for (i = 0; i < num_rects; i++) {
+			Uint32 tb = 0;
+
+			/* only redraw dirty region for non standalone draws */
+			if (!standalone_draw) {
+				jive_surface_set_clip(srf, &rects[i]);
+				pixels += rects[i].w * rects[i].h;
+			}
+
 #if 0
-		printf("REDRAW: %d,%d %dx%d\n", jive_dirty_region.x, jive_dirty_region.y, jive_dirty_region.w, jive_dirty_region.h);
-		printf("--> %d,%d %dx%d\n", dirty.x, dirty.y, dirty.w, dirty.h);
+			printf("REDRAW: %d,%d %dx%d\n", rects[i].x, rects[i].y, rects[i].w, rects[i].h);
 #endif
 
-		/* Draw background */
-		jive_tile_blit(jive_background, srf, 0, 0, screen_w, screen_h);
+			if (perfwarn.screen) tb = jive_jiffies();
 
-		if (perfwarn.screen) t3 = jive_jiffies();
+			/* Draw background */
+			jive_tile_blit(jive_background, srf, 0, 0, screen_w, screen_h);
 
-		/* Draw screen */
-		if (jive_getmethod(L, -2, "draw")) {
-			lua_pushvalue(L, -3);	// widget
-			lua_pushvalue(L, 2);	// surface
-			lua_pushinteger(L, JIVE_LAYER_ALL); // layer
-			lua_call(L, 3, 0);
-		}
+			if (perfwarn.screen) t3 += jive_jiffies() - tb;
+
+			/* Draw screen */
+			if (jive_getmethod(L, -2, "draw")) {
+				lua_pushvalue(L, -3);	// widget
+				lua_pushvalue(L, 2);	// surface
+				lua_pushinteger(L, JIVE_LAYER_ALL); // layer
+				lua_call(L, 3, 0);
+			}
 
 #if 0
-		// show the dirty region for debug purposes:
-		jive_surface_rectangleColor(srf, jive_dirty_region.x, jive_dirty_region.y,
-			jive_dirty_region.x + jive_dirty_region.w, jive_dirty_region.y + jive_dirty_region.h, 0xFFFFFFFF);
-#endif	
+			// show the dirty region for debug purposes:
+			jive_surface_rectangleColor(srf, rects[i].x, rects[i].y,
+				rects[i].x + rects[i].w, rects[i].y + rects[i].h, 0xFFFFFFFF);
+#endif
+		}
+
+		if (perfwarn.screen) t3 += t2;
 
 		/* clear the dirty region for non standalone draws */
 		if (!standalone_draw) {
-			memcpy(&last_dirty_region, &jive_dirty_region, sizeof(last_dirty_region));
-			jive_dirty_region.w = 0;
+			memcpy(last_dirty_rects, dirty_rects, sizeof(SDL_Rect) * num_dirty_rects);
+			num_last_dirty_rects = num_dirty_rects;
+			num_dirty_rects = 0;
+
+			memcpy(update_rects, rects, sizeof(SDL_Rect) * num_rects);
+			num_update_rects = num_rects;
 		}
 
 		drawn = true;
@@ -576,10 +668,14 @@ static int _draw_screen(lua_State *L) {
 			if (!t3) {
 				t3 = t2;
 			}
-			printf("update_screen > %dms: %4dms (%dms) [layout:%dms animate:%dms background:%dms draw:%dms]\n",
-				   perfwarn.screen, t4-t0, (int)((c1-c0) * 1000 / CLOCKS_PER_SEC), t1-t0, t2-t1, t3-t2, t4-t3);
+			printf("update_screen > %dms: %4dms (%dms) [layout:%dms animate:%dms background:%dms draw:%dms pixels:%d]\n",
+				   perfwarn.screen, t4-t0, (int)((c1-c0) * 1000 / CLOCKS_PER_SEC), t1-t0, t2-t1, t3-t2, t4-t3, pixels);
 		}
 	}
+
+	if (perfwarn.pixels && pixels > perfwarn.pixels) {
+		printf("update_screen > %d pixels: %7d pixels\n", perfwarn.pixels, pixels);
+	}
 	
 	lua_pop(L, 3);
 
@@ -616,6 +712,7 @@ int jiveL_draw(lua_State *L) {
 
 int jiveL_update_screen(lua_State *L) {
 	JiveSurface *screen;
+	bool drawn;
 
 	/* stack is:
 	 * 1: framework
@@ -647,25 +744,152 @@ int jiveL_update_screen(lua_State *L) {
 	}
 
 	/* flip screen */
-	if (lua_toboolean(L, -1)) {
-		jive_surface_flip(screen);
+	drawn = lua_toboolean(L, -1);
+	if (drawn) {
+		jive_surface_update_rects(screen, update_rects, num_update_rects);
 	}
 
 	lua_pop(L, 2);
 
-	return 0;
+	lua_pushboolean(L, drawn);
+	return 1;
 }
 
 
-void jive_redraw(SDL_Rect *r) {
-	if (jive_dirty_region.w) {
-		jive_rect_union(&jive_dirty_region, r, &jive_dirty_region);
+static int jiveL_needs_frame(lua_State *L) {
+	JiveWidget *peer = NULL;
+	Uint32 deadline = 0;
+	bool busy;
+
+	/* stack is:
+	 * 1: framework
+	 *
+	 * returns true if the next frame is needed at the frame rate, that
+	 * is the screen is dirty, a window needs layout, an animation or
+	 * transition is running or input is pending. the second result is
+	 * when the next key or mouse hold event is due, or nil.
+	 */
+
+	busy = (num_dirty_rects > 0)
+		|| (jive_origin != next_jive_origin)
+		|| (SDL_EventQueueLength() > 0);
+
+	if (!busy) {
+		lua_getfield(L, 1, "transition");
+		lua_getfield(L, 1, "animations");
+		busy = !lua_isnil(L, -2) || lua_objlen(L, -1) > 0;
+		lua_pop(L, 2);
+	}
+
+	if (!busy) {
+		/* layout pending in the top window */
+		lua_getfield(L, 1, "windowStack");
+		lua_rawgeti(L, -1, 1);
+		if (!lua_isnil(L, -1)) {
+			lua_getfield(L, -1, "peer");
+			peer = lua_touserdata(L, -1);
+			lua_pop(L, 1);
+
+			busy = !peer || peer->child_origin != jive_origin;
+		}
+		lua_pop(L, 2);
+	}
+
+	/* key and mouse hold timers */
+	if (key_timeout) {
+		deadline = key_timeout;
+	}
+	if (mouse_timeout && (!deadline || mouse_timeout < deadline)) {
+		deadline = mouse_timeout;
+	}
+	if (mouse_long_timeout && (!deadline || mouse_long_timeout < deadline)) {
+		deadline = mouse_long_timeout;
+	}
+	if (pointer_timeout && (!deadline || pointer_timeout < deadline)) {
+		deadline = pointer_timeout;
+	}
+
+	lua_pushboolean(L, busy);
+	if (deadline) {
+		lua_pushinteger(L, deadline);
 	}
 	else {
-		memcpy(&jive_dirty_region, r, sizeof(jive_dirty_region));
+		lua_pushnil(L);
 	}
+	return 2;
+}
 
-	//printf("DIRTY: %d,%d %dx%d\n", jive_dirty_region.x, jive_dirty_region.y, jive_dirty_region.w, jive_dirty_region.h);
+
+static Uint32 rect_area(SDL_Rect *r) {
+	return (Uint32)r->w * r->h;
+}
+
+
+static void dirty_rect_add(SDL_Rect *rects, int *num_rects, SDL_Rect *r) {
+	SDL_Rect add, u;
+	int i, best;
+	Uint32 cost, best_cost;
+
+	if (r->w == 0 || r->h == 0) {
+		return;
+	}
+
+	memcpy(&add, r, sizeof(add));
+
+ again:
+	/* merge with an overlapping or nearby rect */
+	for (i = 0; i < *num_rects; i++) {
+		jive_rect_union(&rects[i], &add, &u);
+
+		if (rect_area(&u) <= rect_area(&rects[i]) + rect_area(&add) + DIRTY_MERGE_SLACK) {
+			memcpy(&add, &u, sizeof(add));
+			rects[i] = rects[--(*num_rects)];
+			goto again;
+		}
+	}
+
+	/* list is full, merge with the rect that grows least */
+	if (*num_rects == JIVE_MAX_DIRTY_RECTS) {
+		best = 0;
+		best_cost = ~0;
+
+		for (i = 0; i < *num_rects; i++) {
+			jive_rect_union(&rects[i], &add, &u);
+
+			cost = rect_area(&u) - rect_area(&rects[i]);
+			if (cost < best_cost) {
+				best = i;
+				best_cost = cost;
+			}
+		}
+
+		jive_rect_union(&rects[best], &add, &add);
+		rects[best] = rects[--(*num_rects)];
+		goto again;
+	}
+
+	memcpy(&rects[(*num_rects)++], &add, sizeof(add));
+}
+
+
+void jive_redraw(SDL_Rect *r) {
+	SDL_Rect clip;
+
+	memcpy(&clip, r, sizeof(clip));
+
+	if (screen_w && screen_h) {
+		SDL_Rect screen;
+
+		screen.x = 0;
+		screen.y = 0;
+		screen.w = screen_w;
+		screen.h = screen_h;
+		jive_rect_intersection(r, &screen, &clip);
+	}
+
+	dirty_rect_add(dirty_rects, &num_dirty_rects, &clip);
+
+	//printf("DIRTY: %d,%d %dx%d (%d rects)\n", clip.x, clip.y, clip.w, clip.h, num_dirty_rects);
 }
 
 
@@ -854,6 +1078,9 @@ int jiveL_set_video_mode(lua_State *L) {
 	/* update video mode */
 	srf = jive_surface_set_video_mode(w, h, bpp, isfull);
 
+	/* cached text is in the format of the old screen */
+	jive_font_text_cache_flush();
+
 	/* store new screen surface */
 	lua_getfield(L, 1, "screen");
 	tolua_pushusertype(L, srf, "Surface");
@@ -1248,6 +1475,11 @@ static int process_event(lua_State *L, SDL_Event *event) {
 	}
 
 	case SDL_USEREVENT:
+		if (event->user.code == JIVE_USER_EVENT_IMAGE_DECODE) {
+			jive_image_decode_done(L, event->user.data1);
+			return 0;
+		}
+
 		assert(event->user.code == JIVE_USER_EVENT_EVENT);
 
 		memcpy(&jevent, event->user.data1, sizeof(JiveEvent));
@@ -1362,13 +1594,120 @@ int jiveL_perfwarn(lua_State *L) {
 		perfwarn.queue = lua_tointeger(L, -1);
 		lua_getfield(L, 2, "garbage");
 		perfwarn.garbage = lua_tointeger(L, -1);
-		lua_pop(L, 6);
+		lua_getfield(L, 2, "pixels");
+		perfwarn.pixels = lua_tointeger(L, -1);
+		lua_pop(L, 7);
 	}
 	
 	return 0;
 }
 
 
+/*
+ * Run incremental garbage collection steps for up to budget ms, the time
+ * left before the next frame is due. The collector is stopped outside of
+ * these calls, so gc never runs while a frame is processed. A new cycle
+ * only starts once the heap has doubled since the last one. With no
+ * budget (a late frame) no steps are run, unless the heap has grown to
+ * twice that size.
+ */
+static int jiveL_gc_step(lua_State *L) {
+	Uint32 t0, t1, t2;
+	int budget, kbytes, steps = 0;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: budget ms
+	 */
+
+	budget = luaL_checkinteger(L, 2);
+	kbytes = lua_gc(L, LUA_GCCOUNT, 0);
+
+	gc_stats.calls++;
+
+	if (!gc_in_cycle && kbytes < gc_pause_kb) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	if (budget <= 0 && kbytes < gc_pause_kb * 2) {
+		gc_stats.skipped++;
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	t0 = t2 = jive_jiffies();
+	do {
+		t1 = t2;
+		steps++;
+
+		if (lua_gc(L, LUA_GCSTEP, 0)) {
+			/* end of cycle */
+			gc_stats.cycles++;
+			gc_in_cycle = false;
+			gc_pause_kb = lua_gc(L, LUA_GCCOUNT, 0) * 2;
+			t2 = jive_jiffies();
+			break;
+		}
+		gc_in_cycle = true;
+
+		t2 = jive_jiffies();
+		if (perfwarn.garbage && t2 - t1 > perfwarn.garbage) {
+			printf("gc_step       > %dms: %4dms [%dKB]\n", perfwarn.garbage, t2 - t1, lua_gc(L, LUA_GCCOUNT, 0));
+		}
+	} while ((int)(t2 - t0) < budget);
+
+	/* a gc step resets the threshold, stop the collector again */
+	lua_gc(L, LUA_GCSTOP, 0);
+
+	gc_stats.steps += steps;
+	gc_stats.time += t2 - t0;
+	if (t2 - t0 > gc_stats.max_time) {
+		gc_stats.max_time = t2 - t0;
+	}
+
+	lua_pushinteger(L, steps);
+	return 1;
+}
+
+
+/*
+ * Returns a table of garbage collector counters: calls, steps, cycles,
+ * time (ms), maxTime (ms), skipped and the heap size in kbytes. If the
+ * optional argument is true the counters are reset.
+ */
+static int jiveL_gcstats(lua_State *L) {
+	lua_newtable(L);
+
+	lua_pushinteger(L, gc_stats.calls);
+	lua_setfield(L, -2, "calls");
+
+	lua_pushinteger(L, gc_stats.steps);
+	lua_setfield(L, -2, "steps");
+
+	lua_pushinteger(L, gc_stats.cycles);
+	lua_setfield(L, -2, "cycles");
+
+	lua_pushinteger(L, gc_stats.time);
+	lua_setfield(L, -2, "time");
+
+	lua_pushinteger(L, gc_stats.max_time);
+	lua_setfield(L, -2, "maxTime");
+
+	lua_pushinteger(L, gc_stats.skipped);
+	lua_setfield(L, -2, "skipped");
+
+	lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT, 0));
+	lua_setfield(L, -2, "kbytes");
+
+	if (lua_toboolean(L, 1)) {
+		memset(&gc_stats, 0, sizeof(gc_stats));
+	}
+
+	return 1;
+}
+
+
 static const struct luaL_Reg icon_methods[] = {
 	{ "getPreferredBounds", jiveL_icon_get_preferred_bounds },
 	{ "setValue", jiveL_icon_set_value },
@@ -1460,6 +1799,7 @@ static const struct luaL_Reg widget_methods[] = {
 static const struct luaL_Reg window_methods[] = {
 	{ "_skin", jiveL_window_skin },
 	{ "checkLayout", jiveL_window_check_layout },
+	{ "prefetch", jiveL_window_prefetch },
 	{ "iterate", jiveL_window_iterate },
 	{ "draw", jiveL_window_draw },
 	{ "_eventHandler", jiveL_window_event_handler },
@@ -1483,6 +1823,14 @@ static const struct luaL_Reg event_methods[] = {
 	{ NULL, NULL }
 };
 
+static const struct luaL_Reg timer_methods[] = {
+	{ "_queueInsert", jiveL_timer_queue_insert },
+	{ "_queueRemove", jiveL_timer_queue_remove },
+	{ "_queuePop", jiveL_timer_queue_pop },
+	{ "_queueNext", jiveL_timer_queue_next },
+	{ NULL, NULL }
+};
+
 static const struct luaL_Reg core_methods[] = {
 	{ "initSDL", jiveL_initSDL },
 	{ "quit", jiveL_quit },
@@ -1490,6 +1838,8 @@ static const struct luaL_Reg core_methods[] = {
 	{ "setUpdateScreen", jiveL_set_update_screen },
 	{ "draw", jiveL_draw },
 	{ "updateScreen", jiveL_update_screen },
+	{ "_needsFrame", jiveL_needs_frame },
+	{ "_gcStep", jiveL_gc_step },
 	{ "reDraw", jiveL_redraw },
 	{ "pushEvent", jiveL_push_event },
 	{ "dispatchEvent", jiveL_dispatch_event },
@@ -1500,6 +1850,10 @@ static const struct luaL_Reg core_methods[] = {
 	{ "setBackground", jiveL_set_background },
 	{ "styleChanged", jiveL_style_changed },
 	{ "perfwarn", jiveL_perfwarn },
+	{ "textCache", jiveL_text_cache },
+	{ "imageCache", jiveL_image_cache },
+	{ "decodeImage", jiveL_decode_image },
+	{ "cancelDecode", jiveL_cancel_decode },
 	{ "_event", jiveL_event },
 	{ NULL, NULL }
 };
@@ -1557,6 +1911,10 @@ static int jiveL_core_init(lua_State *L) {
 	luaL_register(L, NULL, event_methods);
 	lua_pop(L, 1);
 
+	lua_getfield(L, 2, "Timer");
+	luaL_register(L, NULL, timer_methods);
+	lua_pop(L, 1);
+
 	lua_getfield(L, 2, "Framework");
 	luaL_register(L, NULL, core_methods);
 	lua_pop(L, 1);
@@ -1566,6 +1924,7 @@ static int jiveL_core_init(lua_State *L) {
 
 static const struct luaL_Reg core_funcs[] = {
 	{ "frameworkOpen", jiveL_core_init },
+	{ "gcstats", jiveL_gcstats },
 	{ NULL, NULL }
 };
 
@@ -0,0 +1,685 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+#include "jive.h"
+
+#if defined(HAVE_LIBJPEG) && !defined(JIVE_NO_DISPLAY)
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+
+/* Background image decoder. Compressed images, such as artwork, are
+ * decoded, scaled and converted to the screen format on a worker thread,
+ * so large images do not block the ui. The surface is returned to the main
+ * thread through the SDL event queue, and passed to the Lua callback of
+ * the request. The queue is bounded, when it is full the caller should
+ * decode the image itself, using jive_image_load_scaled.
+ */
+
+#ifndef JIVE_NO_DISPLAY
+
+/* maximum number of requests waiting to be decoded */
+#define DECODE_MAX_QUEUED 16
+
+struct decode_request {
+	struct decode_request *next;
+	Uint32 id;
+	bool cancelled;
+
+	/* compressed image */
+	char *data;
+	size_t len;
+
+	/* bounding box, 0 for no scaling */
+	Uint16 max_w, max_h;
+
+	/* screen format when the request was made */
+	Uint8 bpp;
+	Uint32 rmask, gmask, bmask;
+
+	/* decoded image, or NULL on error */
+	SDL_Surface *srf;
+};
+
+static SDL_Thread *decode_thread = NULL;
+static SDL_mutex *decode_mutex = NULL;
+static SDL_cond *decode_cond = NULL;
+static bool decode_quit = false;
+
+/* requests waiting to be decoded, and the request being decoded */
+static struct decode_request *decode_head = NULL;
+static struct decode_request *decode_tail = NULL;
+static struct decode_request *decode_current = NULL;
+static int decode_queued = 0;
+
+static Uint32 decode_next_id = 1;
+
+
+#ifdef HAVE_LIBJPEG
+
+/* JPEG images are decoded directly with libjpeg, so the image can be
+ * scaled by 1/2, 1/4 or 1/8 in the DCT domain while it is decoded. This
+ * is much faster and uses less memory than decoding the full image
+ * and scaling it afterwards.
+ */
+
+struct jpeg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf escape;
+};
+
+static JOCTET jpeg_eoi[2] = { 0xFF, JPEG_EOI };
+
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+	struct jpeg_error *err = (struct jpeg_error *) cinfo->err;
+
+	longjmp(err->escape, 1);
+}
+
+
+static void jpeg_output_message(j_common_ptr cinfo) {
+	char buf[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, buf);
+	LOG_DEBUG(log_ui_draw, "jpeg: %s\n", buf);
+}
+
+
+static void jpeg_mem_init_source(j_decompress_ptr cinfo) {
+}
+
+
+static boolean jpeg_mem_fill_input_buffer(j_decompress_ptr cinfo) {
+	/* truncated image, insert an EOI marker as the stdio source does */
+	cinfo->src->next_input_byte = jpeg_eoi;
+	cinfo->src->bytes_in_buffer = 2;
+
+	return TRUE;
+}
+
+
+static void jpeg_mem_skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+	struct jpeg_source_mgr *src = cinfo->src;
+
+	if (num_bytes <= 0) {
+		return;
+	}
+
+	if ((size_t) num_bytes > src->bytes_in_buffer) {
+		jpeg_mem_fill_input_buffer(cinfo);
+		return;
+	}
+
+	src->next_input_byte += num_bytes;
+	src->bytes_in_buffer -= num_bytes;
+}
+
+
+static void jpeg_mem_term_source(j_decompress_ptr cinfo) {
+}
+
+
+static SDL_Surface *load_jpeg(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_source_mgr src;
+	struct jpeg_error jerr;
+	SDL_Surface *volatile srf = NULL;
+	JSAMPROW row;
+	double zoom;
+	int denom;
+
+	cinfo.err = jpeg_std_error(&jerr.mgr);
+	jerr.mgr.error_exit = jpeg_error_exit;
+	jerr.mgr.output_message = jpeg_output_message;
+
+	if (setjmp(jerr.escape)) {
+		jpeg_destroy_decompress(&cinfo);
+		if (srf) {
+			SDL_FreeSurface(srf);
+		}
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+
+	src.next_input_byte = (const JOCTET *) data;
+	src.bytes_in_buffer = len;
+	src.init_source = jpeg_mem_init_source;
+	src.fill_input_buffer = jpeg_mem_fill_input_buffer;
+	src.skip_input_data = jpeg_mem_skip_input_data;
+	src.resync_to_restart = jpeg_resync_to_restart;
+	src.term_source = jpeg_mem_term_source;
+	cinfo.src = &src;
+
+	jpeg_read_header(&cinfo, TRUE);
+
+	if (cinfo.jpeg_color_space != JCS_YCbCr
+	    && cinfo.jpeg_color_space != JCS_GRAYSCALE
+	    && cinfo.jpeg_color_space != JCS_RGB) {
+		/* cmyk images are left to SDL_image */
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.quantize_colors = FALSE;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+
+	if (cinfo.image_width != max_w && cinfo.image_height != max_h) {
+		/* the largest scaling that still covers the width image_fit
+		 * scales to
+		 */
+		zoom = (double) max_w / cinfo.image_width;
+
+		for (denom = 8; denom > 1; denom >>= 1) {
+			if (zoom * denom <= 1.0) {
+				break;
+			}
+		}
+		cinfo.scale_denom = denom;
+	}
+
+	jpeg_calc_output_dimensions(&cinfo);
+
+	srf = SDL_CreateRGBSurface(SDL_SWSURFACE, cinfo.output_width, cinfo.output_height, 24,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+				   0x0000FF, 0x00FF00, 0xFF0000,
+#else
+				   0xFF0000, 0x00FF00, 0x0000FF,
+#endif
+				   0);
+	if (!srf) {
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+
+	jpeg_start_decompress(&cinfo);
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		row = (JSAMPROW) ((Uint8 *) srf->pixels + cinfo.output_scanline * srf->pitch);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	LOG_DEBUG(log_ui_draw, "jpeg %dx%d decoded at 1/%d for %dx%d\n", cinfo.image_width, cinfo.image_height, cinfo.scale_denom, max_w, max_h);
+
+	return srf;
+}
+
+#endif /* HAVE_LIBJPEG */
+
+
+static SDL_Surface *image_load(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {
+	SDL_Surface *srf;
+
+#ifdef HAVE_LIBJPEG
+	if (max_w && max_h && len > 2
+	    && (Uint8) data[0] == 0xFF && (Uint8) data[1] == 0xD8) {
+		srf = load_jpeg(data, len, max_w, max_h);
+		if (srf) {
+			return srf;
+		}
+	}
+#endif
+
+	srf = IMG_Load_RW(SDL_RWFromConstMem(data, (int) len), 1);
+	if (!srf) {
+		LOG_WARN(log_ui_draw, "Error decoding image: %s\n", IMG_GetError());
+	}
+
+	return srf;
+}
+
+
+/* scale to the width of the bounding box, keeping the aspect ratio, as
+ * the artwork has always been resized. smaller images are enlarged to
+ * fill the space. images already matching one side are not scaled.
+ */
+static SDL_Surface *image_fit(SDL_Surface *tmp, Uint16 max_w, Uint16 max_h) {
+	SDL_Surface *srf;
+	double zoom;
+
+	if (!max_w || !max_h || !tmp->w || !tmp->h
+	    || tmp->w == max_w || tmp->h == max_h) {
+		return tmp;
+	}
+
+	zoom = (double) max_w / tmp->w;
+
+	srf = zoomSurface(tmp, zoom, zoom, SMOOTHING_ON);
+	if (!srf) {
+		return tmp;
+	}
+
+	SDL_FreeSurface(tmp);
+	return srf;
+}
+
+
+SDL_Surface *jive_image_load_scaled(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {
+	SDL_Surface *srf;
+
+	srf = image_load(data, len, max_w, max_h);
+	if (!srf) {
+		return NULL;
+	}
+
+	return image_fit(srf, max_w, max_h);
+}
+
+
+static SDL_Surface *decode_convert(struct decode_request *req, SDL_Surface *tmp) {
+	SDL_Surface *fmt, *srf;
+	Uint32 rmask, gmask, bmask, amask;
+
+	if (req->bpp <= 8) {
+		/* palette screens, the blit converts the image */
+		return tmp;
+	}
+
+	if (tmp->format->Amask) {
+		/* as SDL_DisplayFormatAlpha, ARGB8888 unless the screen
+		 * has red and blue swapped
+		 */
+		amask = 0xff000000;
+		rmask = 0x00ff0000;
+		gmask = 0x0000ff00;
+		bmask = 0x000000ff;
+
+		if ((req->bpp <= 16 && req->rmask == 0x1f && (req->bmask == 0xf800 || req->bmask == 0x7c00))
+		    || (req->bpp > 16 && req->rmask == 0xff && req->bmask == 0xff0000)) {
+			rmask = 0x000000ff;
+			bmask = 0x00ff0000;
+		}
+
+		fmt = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 32, rmask, gmask, bmask, amask);
+	}
+	else {
+		fmt = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, req->bpp, req->rmask, req->gmask, req->bmask, 0);
+	}
+
+	if (!fmt) {
+		return tmp;
+	}
+
+	srf = SDL_ConvertSurface(tmp, fmt->format, SDL_SWSURFACE | (tmp->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA | SDL_RLEACCELOK)));
+	SDL_FreeSurface(fmt);
+
+	if (!srf) {
+		return tmp;
+	}
+
+	SDL_FreeSurface(tmp);
+	return srf;
+}
+
+
+static SDL_Surface *decode_image(struct decode_request *req) {
+	SDL_Surface *tmp;
+	bool cancelled;
+
+	tmp = image_load(req->data, req->len, req->max_w, req->max_h);
+	if (!tmp) {
+		return NULL;
+	}
+
+	SDL_LockMutex(decode_mutex);
+	cancelled = req->cancelled;
+	SDL_UnlockMutex(decode_mutex);
+
+	if (cancelled) {
+		return tmp;
+	}
+
+	tmp = image_fit(tmp, req->max_w, req->max_h);
+	if (!tmp) {
+		return NULL;
+	}
+
+	return decode_convert(req, tmp);
+}
+
+
+static int decode_thread_execute(void *unused) {
+	struct decode_request *req;
+	SDL_Event user_event;
+
+	SDL_LockMutex(decode_mutex);
+
+	while (!decode_quit) {
+		req = decode_head;
+		if (!req) {
+			SDL_CondWait(decode_cond, decode_mutex);
+			continue;
+		}
+
+		decode_head = req->next;
+		if (!decode_head) {
+			decode_tail = NULL;
+		}
+		decode_queued--;
+		decode_current = req;
+
+		SDL_UnlockMutex(decode_mutex);
+
+		req->srf = decode_image(req);
+
+		/* the request is freed on the main thread, also if cancelled */
+		memset(&user_event, 0, sizeof(user_event));
+		user_event.type = SDL_USEREVENT;
+		user_event.user.code = JIVE_USER_EVENT_IMAGE_DECODE;
+		user_event.user.data1 = req;
+
+		while (SDL_PushEvent(&user_event) < 0 && !decode_quit) {
+			/* event queue is full */
+			SDL_Delay(10);
+		}
+
+		SDL_LockMutex(decode_mutex);
+		decode_current = NULL;
+	}
+
+	SDL_UnlockMutex(decode_mutex);
+
+	return 0;
+}
+
+
+static void decode_request_free(struct decode_request *req) {
+	if (req->srf) {
+		SDL_FreeSurface(req->srf);
+	}
+	free(req->data);
+	free(req);
+}
+
+
+static void decode_free_lock(void) {
+	if (decode_cond) {
+		SDL_DestroyCond(decode_cond);
+		decode_cond = NULL;
+	}
+	if (decode_mutex) {
+		SDL_DestroyMutex(decode_mutex);
+		decode_mutex = NULL;
+	}
+}
+
+
+void jive_image_decode_done(lua_State *L, void *data) {
+	struct decode_request *req = data;
+
+	JIVEL_STACK_CHECK_BEGIN(L);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "jiveImageDecode");
+	if (lua_istable(L, -1)) {
+		lua_rawgeti(L, -1, req->id);
+
+		if (lua_isfunction(L, -1)) {
+			lua_pushnil(L);
+			lua_rawseti(L, -3, req->id);
+
+			lua_pushcfunction(L, jive_traceback);  /* push traceback function */
+			lua_insert(L, -2);
+
+			if (req->srf) {
+				tolua_pushusertype_and_takeownership(L, jive_surface_new_SDLSurface(req->srf), "Surface");
+				req->srf = NULL;
+			}
+			else {
+				lua_pushnil(L);
+			}
+
+			if (lua_pcall(L, 1, 0, -3) != 0) {
+				LOG_WARN(log_ui, "error in image decode callback:\n\t%s\n", lua_tostring(L, -1));
+				lua_pop(L, 1);
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	decode_request_free(req);
+
+	JIVEL_STACK_CHECK_END(L);
+}
+
+
+int jiveL_decode_image(lua_State *L) {
+	struct decode_request *req;
+	SDL_Surface *screen;
+	const char *data;
+	size_t len;
+	bool full;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: compressed image data
+	 * 3: maximum width, 0 for no scaling
+	 * 4: maximum height, 0 for no scaling
+	 * 5: callback, called with the surface or nil on error
+	 */
+
+	data = luaL_checklstring(L, 2, &len);
+	luaL_checktype(L, 5, LUA_TFUNCTION);
+
+	if (!decode_mutex) {
+		decode_mutex = SDL_CreateMutex();
+		decode_cond = SDL_CreateCond();
+
+		if (!decode_mutex || !decode_cond) {
+			LOG_WARN(log_ui_draw, "Cannot create image decode lock: %s\n", SDL_GetError());
+			decode_free_lock();
+			lua_pushnil(L);
+			return 1;
+		}
+	}
+
+	if (!decode_thread) {
+		decode_quit = false;
+		decode_thread = SDL_CreateThread(decode_thread_execute, NULL);
+
+		if (!decode_thread) {
+			LOG_WARN(log_ui_draw, "Cannot create image decode thread: %s\n", SDL_GetError());
+			lua_pushnil(L);
+			return 1;
+		}
+	}
+
+	/* only this thread adds requests, so the queue can't fill up
+	 * before the request is added
+	 */
+	SDL_LockMutex(decode_mutex);
+	full = (decode_queued >= DECODE_MAX_QUEUED);
+	SDL_UnlockMutex(decode_mutex);
+
+	if (full) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	req = calloc(sizeof(struct decode_request), 1);
+	if (!req) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	req->data = malloc(len);
+	if (!req->data) {
+		free(req);
+		lua_pushnil(L);
+		return 1;
+	}
+
+	memcpy(req->data, data, len);
+	req->len = len;
+	req->max_w = luaL_optinteger(L, 3, 0);
+	req->max_h = luaL_optinteger(L, 4, 0);
+
+	screen = SDL_GetVideoSurface();
+	if (screen) {
+		req->bpp = screen->format->BitsPerPixel;
+		req->rmask = screen->format->Rmask;
+		req->gmask = screen->format->Gmask;
+		req->bmask = screen->format->Bmask;
+	}
+
+	req->id = decode_next_id++;
+	if (decode_next_id == 0) {
+		decode_next_id = 1;
+	}
+
+	/* store the callback */
+	lua_getfield(L, LUA_REGISTRYINDEX, "jiveImageDecode");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, "jiveImageDecode");
+	}
+	lua_pushvalue(L, 5);
+	lua_rawseti(L, -2, req->id);
+	lua_pop(L, 1);
+
+	SDL_LockMutex(decode_mutex);
+
+	if (decode_tail) {
+		decode_tail->next = req;
+	}
+	else {
+		decode_head = req;
+	}
+	decode_tail = req;
+	decode_queued++;
+
+	SDL_CondSignal(decode_cond);
+	SDL_UnlockMutex(decode_mutex);
+
+	lua_pushinteger(L, req->id);
+	return 1;
+}
+
+
+int jiveL_cancel_decode(lua_State *L) {
+	struct decode_request *req, *prev;
+	Uint32 id;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: request id
+	 */
+
+	id = luaL_checkinteger(L, 2);
+
+	/* the callback is not called */
+	lua_getfield(L, LUA_REGISTRYINDEX, "jiveImageDecode");
+	if (lua_istable(L, -1)) {
+		lua_pushnil(L);
+		lua_rawseti(L, -2, id);
+	}
+	lua_pop(L, 1);
+
+	if (!decode_thread) {
+		return 0;
+	}
+
+	SDL_LockMutex(decode_mutex);
+
+	if (decode_current && decode_current->id == id) {
+		/* scaling is skipped, the result is freed when delivered */
+		decode_current->cancelled = true;
+	}
+	else {
+		prev = NULL;
+		for (req = decode_head; req; prev = req, req = req->next) {
+			if (req->id == id) {
+				if (prev) {
+					prev->next = req->next;
+				}
+				else {
+					decode_head = req->next;
+				}
+				if (decode_tail == req) {
+					decode_tail = prev;
+				}
+				decode_queued--;
+
+				decode_request_free(req);
+				break;
+			}
+		}
+	}
+
+	SDL_UnlockMutex(decode_mutex);
+
+	return 0;
+}
+
+
+void jive_image_decode_quit(void) {
+	struct decode_request *req;
+	SDL_Event event;
+
+	if (decode_thread) {
+		SDL_LockMutex(decode_mutex);
+		decode_quit = true;
+		SDL_CondSignal(decode_cond);
+		SDL_UnlockMutex(decode_mutex);
+
+		SDL_WaitThread(decode_thread, NULL);
+		decode_thread = NULL;
+	}
+
+	/* free the requests that were never decoded */
+	while (decode_head) {
+		req = decode_head;
+		decode_head = req->next;
+		decode_request_free(req);
+	}
+	decode_tail = NULL;
+	decode_queued = 0;
+
+	/* and the decoded requests not yet delivered, the user events are
+	 * not dispatched after quit
+	 */
+	while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_EVENTMASK(SDL_USEREVENT)) > 0) {
+		if (event.user.code == JIVE_USER_EVENT_IMAGE_DECODE) {
+			decode_request_free(event.user.data1);
+		}
+		else {
+			free(event.user.data1);
+		}
+	}
+
+	decode_free_lock();
+}
+
+#else
+
+SDL_Surface *jive_image_load_scaled(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {
+	return NULL;
+}
+
+void jive_image_decode_done(lua_State *L, void *data) {}
+
+int jiveL_decode_image(lua_State *L) {
+	lua_pushnil(L);
+	return 1;
+}
+
+int jiveL_cancel_decode(lua_State *L) {
+	return 0;
+}
+
+void jive_image_decode_quit(void) {}
+
+#endif /* JIVE_NO_DISPLAY */
@@ -8,8 +8,9 @@
 #include "jive.h"
 
 
-/* actual FPS will only run as a fraction of JIVE_FRAME_RATE */
-#define SCROLL_FPS	JIVE_FRAME_RATE / 2
+/* animations are stepped by time, so the scroll speed does not change
+ * with the framework frame rate */
+#define SCROLL_FPS	(JIVE_FRAME_RATE / 2)
 #define SCROLL_OFFSET_STEP_MINIMUM	5
 #define FONT_SCROLL_FACTOR	5
 
@@ -9,6 +9,16 @@
 
 #ifndef JIVE_NO_DISPLAY
 
+#ifdef SCREEN_ROTATION_ENABLED
+#if defined(__SSE2__)
+#define SURFACE_ROTATE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define SURFACE_ROTATE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 /*
  * This file combines both JiveSurface and JiveTile into a single implementation.
  * The separate typdefs, JiveSurface and JiveTile, are still kept so that the
@@ -26,11 +36,30 @@ struct loaded_image_surface {
 	struct loaded_image_surface *prev, *next;	/* LRU cache double-linked list */
 };
 
-/* locked images (no path) are not counted or kept in the LRU list */
-#define MAX_LOADED_IMAGES 75
+/* Loaded images are evicted from the LRU list when their decoded surfaces
+ * use more than this many bytes. Platforms may set the limit at build
+ * time, or at run time with Framework:imageCache(). Locked images (no
+ * path) are not counted or kept in the LRU list.
+ */
+#ifndef JIVE_IMAGE_CACHE_BYTES
+#define JIVE_IMAGE_CACHE_BYTES (4 * 1024 * 1024)
+#endif
 static struct loaded_image_surface lruHead, lruTail;
 static Uint16 nloadedImages;
 
+/* the tile whose images are being loaded, they are not evicted to make
+ * room for each other
+ */
+static JiveTile *pinned_tile;
+
+static struct {
+	Uint32 bytes;
+	Uint32 max_bytes;
+	Uint32 hits;
+	Uint32 loads;
+	Uint32 evictions;
+} image_cache = { 0, JIVE_IMAGE_CACHE_BYTES, 0, 0, 0 };
+
 struct image {
 	const char * path;
 	Uint16 w;
@@ -45,6 +74,7 @@ struct image {
 #endif
 	struct loaded_image_surface * loaded;	/* reference to loaded surface */
 	struct jive_surface *tile;				/* reference to image tile for this image, if there is one */
+	Uint16 hash_next;						/* next image in the path hash chain */
 };
 
 /* We do not use image 0 - it is just easier to let 0 mean no image */
@@ -55,6 +85,10 @@ static Uint16 image_pool_size;
 static struct image *images;
 static Uint16 n_images = 1;
 
+/* images by path, a power of two */
+#define IMAGE_HASH_SIZE		512
+static Uint16 image_hash[IMAGE_HASH_SIZE];
+
 struct jive_surface {
 	Uint32 refcount;
 
@@ -84,7 +118,19 @@ struct jive_surface {
 static SDL_Surface *real_sdl = NULL;
 #endif
 
+static Uint32 _image_hash(const char *path) {
+	Uint32 h = 2166136261u;
+
+	/* FNV-1a */
+	while (*path) {
+		h = (h ^ (Uint8)*path++) * 16777619u;
+	}
+
+	return (h ^ (h >> 16)) & (IMAGE_HASH_SIZE - 1);
+}
+
 static int _new_image(const char *path) {
+	Uint32 hash;
 	Uint16 i;
 
 	if (image_pool_size == 0) {
@@ -97,15 +143,20 @@ static int _new_image(const char *path) {
 		}
 	}
 
-	for (i = 0; i < n_images; i++) {
-		if (images[i].ref_count <= 0)
-			break;
-		if (images[i].path && strcmp(path, images[i].path) == 0) {
+	hash = _image_hash(path);
+	for (i = image_hash[hash]; i; i = images[i].hash_next) {
+		if (strcmp(path, images[i].path) == 0) {
 			images[i].ref_count++;
 			return i;
 		}
 	}
 
+	/* reuse a free entry */
+	for (i = 1; i < n_images; i++) {
+		if (images[i].ref_count <= 0)
+			break;
+	}
+
 	/* Allocate or extend image pool as necessary */
 	if (i >= image_pool_size) {
 		if (i >= MAX_IMAGES) {
@@ -128,6 +179,8 @@ static int _new_image(const char *path) {
 		n_images++;
 	images[i].path = strdup(path);
 	images[i].ref_count = 1;
+	images[i].hash_next = image_hash[hash];
+	image_hash[hash] = i;
 	return i;
 }
 
@@ -136,6 +189,7 @@ static void _unload_image(Uint16 index) {
 
 	if (loaded->next) {
 		nloadedImages--;	/* only counted if actually in LRU list */
+		image_cache.bytes -= loaded->srf->pitch * loaded->srf->h;
 		loaded->prev->next = loaded->next;
 		loaded->next->prev = loaded->prev;
 	}
@@ -149,6 +203,46 @@ static void _unload_image(Uint16 index) {
 	images[index].loaded = 0;
 }
 
+static bool _is_pinned(Uint16 index) {
+	int i, max;
+
+	if (!pinned_tile) {
+		return false;
+	}
+
+	max = (pinned_tile->flags & TILE_FLAG_IMAGE) ? 1 : 9;
+	for (i = 0; i < max; i++) {
+		if (pinned_tile->image[i] == index) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* eject the oldest images until the cache is within its limit, but not
+ * keep or the images of the pinned tile
+ */
+static void _evict_images(struct loaded_image_surface *keep) {
+	struct loaded_image_surface *loaded, *prev;
+
+	if (lruHead.next == 0) {
+		return;
+	}
+
+	loaded = lruTail.prev;
+	while (image_cache.bytes > image_cache.max_bytes && loaded != &lruHead) {
+		prev = loaded->prev;
+
+		if (loaded != keep && !_is_pinned(loaded->image)) {
+			_unload_image(loaded->image);
+			image_cache.evictions++;
+		}
+
+		loaded = prev;
+	}
+}
+
 static void _use_image(Uint16 index) {
 	struct loaded_image_surface *loaded = images[index].loaded;
 
@@ -192,12 +286,32 @@ static void _use_image(Uint16 index) {
 		loaded->prev = &lruHead;
 		lruHead.next = loaded;
 
-		if (++nloadedImages > MAX_LOADED_IMAGES) {
-			_unload_image(lruTail.prev->image);
-		}
+		nloadedImages++;
+		image_cache.bytes += loaded->srf->pitch * loaded->srf->h;
+
+		/* eject oldest, but not the image just loaded */
+		_evict_images(loaded);
 	}
 }
 
+static void _free_image(Uint16 index) {
+	struct image *image = &images[index];
+	Uint16 *ptr;
+
+	ptr = &image_hash[_image_hash(image->path)];
+	while (*ptr != index) {
+		ptr = &images[*ptr].hash_next;
+	}
+	*ptr = image->hash_next;
+
+	if (image->loaded) {
+		_unload_image(index);
+	}
+
+	free((char *) image->path);
+	memset(image, 0, sizeof *image);
+}
+
 static void _load_image (Uint16 index, bool hasAlphaFlags, Uint32 alphaFlags) {
 	struct image *image = &images[index];
 	SDL_Surface *tmp, *srf;
@@ -226,6 +340,8 @@ static void _load_image (Uint16 index, bool hasAlphaFlags, Uint32 alphaFlags) {
 	image->loaded->image = index;
 	image->loaded->srf = srf;
 
+	image_cache.loads++;
+
 #ifdef JIVE_PROFILE_IMAGE_CACHE
 	image->load_count++;
 #endif
@@ -260,10 +376,15 @@ static void _load_tile_images (JiveTile *tile) {
 		if (!image)
 			continue;
 
-		if (images[image].loaded)
+		if (images[image].loaded) {
 			_use_image(image);
+			image_cache.hits++;
+		}
 	}
 
+	/* loading the later images must not evict the earlier ones */
+	pinned_tile = tile;
+
 	for (i = 0; i < max; i++) {
 		Uint16 image = tile->image[i];
 
@@ -282,6 +403,8 @@ static void _load_tile_images (JiveTile *tile) {
 		}
 	}
 
+	pinned_tile = NULL;
+
 #ifdef JIVE_PROFILE_IMAGE_CACHE
 	if (n) {
 		int loaded = 0;
@@ -633,15 +756,62 @@ void jive_tile_free(JiveTile *tile) {
 			continue;
 		}
 
-		if (image->loaded) {
-			_unload_image(tile->image[i]);
-		}
-		memset(image, 0, sizeof *image);
+		_free_image(tile->image[i]);
 	}
 
 	free(tile);
 }
 
+bool jive_tile_prefetch(JiveTile *tile) {
+	int i, max;
+
+	if (!IS_DYNAMIC_IMAGE(tile)) {
+		return true;
+	}
+
+	_load_tile_images(tile);
+	_init_tile_sizes(tile);
+
+	max = (tile->flags & TILE_FLAG_IMAGE) ? 1 : 9;
+	for (i = 0; i < max; i++) {
+		if (tile->image[i] && !images[tile->image[i]].loaded) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int jiveL_image_cache(lua_State *L) {
+	/* stack is:
+	 * 1: framework
+	 * 2: cache limit in bytes, optional
+	 */
+
+	if (lua_isnumber(L, 2)) {
+		image_cache.max_bytes = lua_tointeger(L, 2);
+
+		_evict_images(NULL);
+	}
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, image_cache.hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, image_cache.loads);
+	lua_setfield(L, -2, "loads");
+	lua_pushinteger(L, image_cache.evictions);
+	lua_setfield(L, -2, "evictions");
+	lua_pushinteger(L, nloadedImages);
+	lua_setfield(L, -2, "images");
+	lua_pushinteger(L, image_cache.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, image_cache.max_bytes);
+	lua_setfield(L, -2, "maxBytes");
+
+	return 1;
+}
+
 static __inline__ void blit_area(SDL_Surface *src, SDL_Surface *dst, int dx, int dy, int dw, int dh) {
 	SDL_Rect sr, dr;
 	int x, y, w, h;
@@ -991,9 +1161,8 @@ JiveSurface *jive_surface_load_image(const char *path) {
 }
 
 
-JiveSurface *jive_surface_load_image_data(const char *data, size_t len) {
-	SDL_RWops *src = SDL_RWFromConstMem(data, (int) len);
-	SDL_Surface *sdl = IMG_Load_RW(src, 1);
+JiveSurface *jive_surface_load_image_data(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {
+	SDL_Surface *sdl = jive_image_load_scaled(data, len, max_w, max_h);
 
 	JiveSurface *srf = calloc(sizeof(JiveSurface), 1);
 	srf->refcount = 1;
@@ -1189,51 +1358,237 @@ void jive_surface_get_clip_arg(JiveSurface *srf, Uint16 *x, Uint16 *y, Uint16 *w
 	*h = tmp.h;
 }
 
-void jive_surface_flip(JiveSurface *srf) {
 #ifdef SCREEN_ROTATION_ENABLED
-	int x, y;
 
-	/* orientation hack */
-	SDL_LockSurface(real_sdl);
-	SDL_LockSurface(srf->sdl);
+/* Screen rotation. The ui is drawn into a back buffer of the rotated
+ * size, and the changed rects are rotated into the screen 90 degrees
+ * anticlockwise: back buffer (x, y) is screen (y, h - 1 - x). The rects
+ * are rotated in 8x8 blocks so that the column strided writes stay in
+ * the cache, using SSE2 or NEON transposes when available.
+ */
 
-	switch (real_sdl->format->BytesPerPixel) {
-	case 2: {
-		Uint16 *srcp, *dstp;
+#define ROTATE_BLOCK 8
 
-		for (y=0; y<srf->sdl->h; y++) {
-			srcp = ((Uint16 *)srf->sdl->pixels) + (y * srf->sdl->pitch/2);
-			dstp = ((Uint16 *)real_sdl->pixels) + y + ((real_sdl->h - 1) * real_sdl->pitch/2);
+/* rects of the last frame, a page flipped screen shows the frame before */
+#define ROTATE_MAX_RECTS 16
+static SDL_Rect rotate_last_rects[ROTATE_MAX_RECTS];
+static int rotate_num_last_rects = 0;
+
+
+#if defined(SURFACE_ROTATE_SSE2)
 
-			for (x=0; x<srf->sdl->w; x++) {
-				*dstp = *srcp;
-				srcp++;
-				dstp -= real_sdl->pitch/2;
-			}
+static void _rotate_block16(Uint16 *s, int sp, Uint16 *d, int dp) {
+	__m128i a0, a1, a2, a3, a4, a5, a6, a7;
+	__m128i b0, b1, b2, b3, b4, b5, b6, b7;
+
+	a0 = _mm_loadu_si128((__m128i *) (s + 0 * sp));
+	a1 = _mm_loadu_si128((__m128i *) (s + 1 * sp));
+	a2 = _mm_loadu_si128((__m128i *) (s + 2 * sp));
+	a3 = _mm_loadu_si128((__m128i *) (s + 3 * sp));
+	a4 = _mm_loadu_si128((__m128i *) (s + 4 * sp));
+	a5 = _mm_loadu_si128((__m128i *) (s + 5 * sp));
+	a6 = _mm_loadu_si128((__m128i *) (s + 6 * sp));
+	a7 = _mm_loadu_si128((__m128i *) (s + 7 * sp));
+
+	/* 8x8 transpose */
+	b0 = _mm_unpacklo_epi16(a0, a1);
+	b1 = _mm_unpackhi_epi16(a0, a1);
+	b2 = _mm_unpacklo_epi16(a2, a3);
+	b3 = _mm_unpackhi_epi16(a2, a3);
+	b4 = _mm_unpacklo_epi16(a4, a5);
+	b5 = _mm_unpackhi_epi16(a4, a5);
+	b6 = _mm_unpacklo_epi16(a6, a7);
+	b7 = _mm_unpackhi_epi16(a6, a7);
+
+	a0 = _mm_unpacklo_epi32(b0, b2);
+	a1 = _mm_unpackhi_epi32(b0, b2);
+	a2 = _mm_unpacklo_epi32(b1, b3);
+	a3 = _mm_unpackhi_epi32(b1, b3);
+	a4 = _mm_unpacklo_epi32(b4, b6);
+	a5 = _mm_unpackhi_epi32(b4, b6);
+	a6 = _mm_unpacklo_epi32(b5, b7);
+	a7 = _mm_unpackhi_epi32(b5, b7);
+
+	_mm_storeu_si128((__m128i *) (d + 0 * dp), _mm_unpacklo_epi64(a0, a4));
+	_mm_storeu_si128((__m128i *) (d + 1 * dp), _mm_unpackhi_epi64(a0, a4));
+	_mm_storeu_si128((__m128i *) (d + 2 * dp), _mm_unpacklo_epi64(a1, a5));
+	_mm_storeu_si128((__m128i *) (d + 3 * dp), _mm_unpackhi_epi64(a1, a5));
+	_mm_storeu_si128((__m128i *) (d + 4 * dp), _mm_unpacklo_epi64(a2, a6));
+	_mm_storeu_si128((__m128i *) (d + 5 * dp), _mm_unpackhi_epi64(a2, a6));
+	_mm_storeu_si128((__m128i *) (d + 6 * dp), _mm_unpacklo_epi64(a3, a7));
+	_mm_storeu_si128((__m128i *) (d + 7 * dp), _mm_unpackhi_epi64(a3, a7));
+}
+
+
+static void _rotate_block32_4x4(Uint32 *s, int sp, Uint32 *d, int dp) {
+	__m128i a0, a1, a2, a3, t0, t1, t2, t3;
+
+	a0 = _mm_loadu_si128((__m128i *) (s + 0 * sp));
+	a1 = _mm_loadu_si128((__m128i *) (s + 1 * sp));
+	a2 = _mm_loadu_si128((__m128i *) (s + 2 * sp));
+	a3 = _mm_loadu_si128((__m128i *) (s + 3 * sp));
+
+	t0 = _mm_unpacklo_epi32(a0, a1);
+	t1 = _mm_unpacklo_epi32(a2, a3);
+	t2 = _mm_unpackhi_epi32(a0, a1);
+	t3 = _mm_unpackhi_epi32(a2, a3);
+
+	_mm_storeu_si128((__m128i *) (d + 0 * dp), _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *) (d + 1 * dp), _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *) (d + 2 * dp), _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i *) (d + 3 * dp), _mm_unpackhi_epi64(t2, t3));
+}
+
+#elif defined(SURFACE_ROTATE_NEON)
+
+static void _rotate_block16(Uint16 *s, int sp, Uint16 *d, int dp) {
+	uint16x8x2_t t01, t23, t45, t67;
+	uint32x4x2_t u02, u13, v02, v13;
+
+	t01 = vtrnq_u16(vld1q_u16(s + 0 * sp), vld1q_u16(s + 1 * sp));
+	t23 = vtrnq_u16(vld1q_u16(s + 2 * sp), vld1q_u16(s + 3 * sp));
+	t45 = vtrnq_u16(vld1q_u16(s + 4 * sp), vld1q_u16(s + 5 * sp));
+	t67 = vtrnq_u16(vld1q_u16(s + 6 * sp), vld1q_u16(s + 7 * sp));
+
+	u02 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[0]), vreinterpretq_u32_u16(t23.val[0]));
+	u13 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[1]), vreinterpretq_u32_u16(t23.val[1]));
+	v02 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[0]), vreinterpretq_u32_u16(t67.val[0]));
+	v13 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[1]), vreinterpretq_u32_u16(t67.val[1]));
+
+	vst1q_u16(d + 0 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(u02.val[0]), vget_low_u32(v02.val[0]))));
+	vst1q_u16(d + 1 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(u13.val[0]), vget_low_u32(v13.val[0]))));
+	vst1q_u16(d + 2 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(u02.val[1]), vget_low_u32(v02.val[1]))));
+	vst1q_u16(d + 3 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(u13.val[1]), vget_low_u32(v13.val[1]))));
+	vst1q_u16(d + 4 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(u02.val[0]), vget_high_u32(v02.val[0]))));
+	vst1q_u16(d + 5 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(u13.val[0]), vget_high_u32(v13.val[0]))));
+	vst1q_u16(d + 6 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(u02.val[1]), vget_high_u32(v02.val[1]))));
+	vst1q_u16(d + 7 * dp, vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(u13.val[1]), vget_high_u32(v13.val[1]))));
+}
+
+
+static void _rotate_block32_4x4(Uint32 *s, int sp, Uint32 *d, int dp) {
+	uint32x4x2_t t01, t23;
+
+	t01 = vtrnq_u32(vld1q_u32(s + 0 * sp), vld1q_u32(s + 1 * sp));
+	t23 = vtrnq_u32(vld1q_u32(s + 2 * sp), vld1q_u32(s + 3 * sp));
+
+	vst1q_u32(d + 0 * dp, vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+	vst1q_u32(d + 1 * dp, vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+	vst1q_u32(d + 2 * dp, vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+	vst1q_u32(d + 3 * dp, vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+}
+
+#else
+
+static void _rotate_block16(Uint16 *s, int sp, Uint16 *d, int dp) {
+	int i, j;
+
+	for (i = 0; i < ROTATE_BLOCK; i++) {
+		for (j = 0; j < ROTATE_BLOCK; j++) {
+			d[j] = s[j * sp];
 		}
-		break;
+		s++;
+		d += dp;
 	}
+}
 
-	case 4: {
-		Uint32 *srcp, *dstp;
 
-		for (y=0; y<srf->sdl->h; y++) {
-			srcp = ((Uint32 *)srf->sdl->pixels) + (y * srf->sdl->pitch/4);
-			dstp = ((Uint32 *)real_sdl->pixels) + y + ((real_sdl->h - 1) * real_sdl->pitch/4);
+static void _rotate_block32_4x4(Uint32 *s, int sp, Uint32 *d, int dp) {
+	int i, j;
 
-			for (x=0; x<srf->sdl->w; x++) {
-				*dstp = *srcp;
-				srcp++;
-				dstp -= real_sdl->pitch/4;
-			}
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			d[j] = s[j * sp];
 		}
-		break;
+		s++;
+		d += dp;
 	}
+}
+
+#endif
+
+
+static void _rotate_block32(Uint32 *s, int sp, Uint32 *d, int dp) {
+	_rotate_block32_4x4(s, sp, d, dp);
+	_rotate_block32_4x4(s + 4, sp, d + 4 * dp, dp);
+	_rotate_block32_4x4(s + 4 * sp, sp, d + 4, dp);
+	_rotate_block32_4x4(s + 4 * sp + 4, sp, d + 4 * dp + 4, dp);
+}
+
+
+/* src and dst point to the first pixel of the rect, dp is negative */
+#define ROTATE_EDGE(type, src, sp, dst, dp, w, h) {	\
+	type *s_ = (src), *d_ = (dst);			\
+	int i_, j_;					\
+	for (i_ = 0; i_ < (w); i_++) {			\
+		for (j_ = 0; j_ < (h); j_++) {		\
+			d_[j_] = s_[j_ * (sp)];		\
+		}					\
+		s_++;					\
+		d_ += (dp);				\
+	}						\
+}
+
+#define ROTATE_RECT(type, block, src, dst, r) {					\
+	int sp_ = (src)->pitch / sizeof(type);						\
+	int dp_ = -((dst)->pitch / (int) sizeof(type));					\
+	type *s0_ = (type *) (src)->pixels + (r)->y * sp_ + (r)->x;			\
+	type *d0_ = (type *) (dst)->pixels + ((dst)->h - 1 - (r)->x) * -dp_ + (r)->y;	\
+	int bw_ = (r)->w & ~(ROTATE_BLOCK - 1);						\
+	int bh_ = (r)->h & ~(ROTATE_BLOCK - 1);						\
+	int x_, y_;									\
+	for (y_ = 0; y_ < bh_; y_ += ROTATE_BLOCK) {					\
+		for (x_ = 0; x_ < bw_; x_ += ROTATE_BLOCK) {				\
+			block(s0_ + y_ * sp_ + x_, sp_, d0_ + x_ * dp_ + y_, dp_);	\
+		}									\
+	}										\
+	/* right and bottom edges */							\
+	ROTATE_EDGE(type, s0_ + bw_, sp_, d0_ + bw_ * dp_, dp_, (r)->w - bw_, (r)->h);	\
+	ROTATE_EDGE(type, s0_ + bh_ * sp_, sp_, d0_ + bh_, dp_, bw_, (r)->h - bh_);	\
+}
+
+
+static void _rotate_rect(SDL_Surface *src, SDL_Surface *dst, SDL_Rect *r, SDL_Rect *dr) {
+	switch (dst->format->BytesPerPixel) {
+	case 2:
+		ROTATE_RECT(Uint16, _rotate_block16, src, dst, r);
+		break;
+
+	case 4:
+		ROTATE_RECT(Uint32, _rotate_block32, src, dst, r);
+		break;
 	}
 
+	dr->x = r->y;
+	dr->y = dst->h - r->x - r->w;
+	dr->w = r->h;
+	dr->h = r->w;
+}
+
+#endif /* SCREEN_ROTATION_ENABLED */
+
+
+void jive_surface_flip(JiveSurface *srf) {
+#ifdef SCREEN_ROTATION_ENABLED
+	SDL_Rect r, dr;
+
+	/* orientation hack */
+	r.x = 0;
+	r.y = 0;
+	r.w = srf->sdl->w;
+	r.h = srf->sdl->h;
+
+	SDL_LockSurface(real_sdl);
+	SDL_LockSurface(srf->sdl);
+
+	_rotate_rect(srf->sdl, real_sdl, &r, &dr);
+
 	SDL_UnlockSurface(srf->sdl);
 	SDL_UnlockSurface(real_sdl);
 
+	rotate_last_rects[0] = r;
+	rotate_num_last_rects = 1;
+
 	SDL_Flip(real_sdl);
 #else
 	SDL_Flip(srf->sdl);
@@ -1242,6 +1597,61 @@ void jive_surface_flip(JiveSurface *srf) {
 }
 
 
+bool jive_surface_is_double_buffered(JiveSurface *srf) {
+	return (srf->sdl->flags & (SDL_HWSURFACE | SDL_DOUBLEBUF)) == (SDL_HWSURFACE | SDL_DOUBLEBUF);
+}
+
+
+void jive_surface_update_rects(JiveSurface *srf, SDL_Rect *rects, int num_rects) {
+#ifdef SCREEN_ROTATION_ENABLED
+	SDL_Rect screen_rects[2 * ROTATE_MAX_RECTS];
+	int i, n = 0;
+	bool page_flip;
+
+	if (num_rects > ROTATE_MAX_RECTS) {
+		jive_surface_flip(srf);
+		return;
+	}
+
+	page_flip = (real_sdl->flags & (SDL_HWSURFACE | SDL_DOUBLEBUF)) == (SDL_HWSURFACE | SDL_DOUBLEBUF);
+
+	/* rotate only the changed rects into the screen */
+	SDL_LockSurface(real_sdl);
+	SDL_LockSurface(srf->sdl);
+
+	for (i = 0; i < num_rects; i++) {
+		_rotate_rect(srf->sdl, real_sdl, &rects[i], &screen_rects[n++]);
+	}
+	if (page_flip) {
+		for (i = 0; i < rotate_num_last_rects; i++) {
+			_rotate_rect(srf->sdl, real_sdl, &rotate_last_rects[i], &screen_rects[n++]);
+		}
+	}
+
+	SDL_UnlockSurface(srf->sdl);
+	SDL_UnlockSurface(real_sdl);
+
+	memcpy(rotate_last_rects, rects, sizeof(SDL_Rect) * num_rects);
+	rotate_num_last_rects = num_rects;
+
+	if (page_flip) {
+		SDL_Flip(real_sdl);
+	}
+	else {
+		SDL_UpdateRects(real_sdl, n, screen_rects);
+	}
+#else
+	if (jive_surface_is_double_buffered(srf)) {
+		/* page flip, the rects have been drawn in the back buffer */
+		SDL_Flip(srf->sdl);
+	}
+	else {
+		SDL_UpdateRects(srf->sdl, num_rects, rects);
+	}
+#endif
+}
+
+
 void jive_surface_blit(JiveSurface *src, JiveSurface *dst, Uint16 dx, Uint16 dy) {
 #ifdef JIVE_PROFILE_BLIT
 	Uint32 t0 = jive_jiffies(), t1;
@@ -1672,6 +2082,13 @@ void jive_tile_set_alpha(JiveTile *tile, Uint32 flags) {return;}
 
 void jive_tile_free(JiveTile *tile) {return;}
 
+bool jive_tile_prefetch(JiveTile *tile) {return true;}
+
+int jiveL_image_cache(lua_State *L) {
+	lua_newtable(L);
+	return 1;
+}
+
 /* this function must only be used for blitting tiles */
 void jive_surface_get_tile_blit(JiveSurface *srf, SDL_Surface **sdl, Sint16 *x, Sint16 *y) {*x = *y = 1;}
 
@@ -1691,7 +2108,7 @@ JiveSurface *jive_surface_ref(JiveSurface *srf) {return srf;}
 
 JiveSurface *jive_surface_load_image(const char *path) {return DUMMY_SURFACE;}
 
-JiveSurface *jive_surface_load_image_data(const char *data, size_t len) {return DUMMY_SURFACE;}
+JiveSurface *jive_surface_load_image_data(const char *data, size_t len, Uint16 max_w, Uint16 max_h) {return DUMMY_SURFACE;}
 
 int jive_surface_set_wm_icon(JiveSurface *srf) {return 1;}
 
@@ -1715,6 +2132,10 @@ void jive_surface_get_clip_arg(JiveSurface *srf, Uint16 *x, Uint16 *y, Uint16 *w
 
 void jive_surface_flip(JiveSurface *srf) {return;}
 
+bool jive_surface_is_double_buffered(JiveSurface *srf) {return false;}
+
+void jive_surface_update_rects(JiveSurface *srf, SDL_Rect *rects, int num_rects) {return;}
+
 
 void jive_surface_blit(JiveSurface *src, JiveSurface *dst, Uint16 dx, Uint16 dy) {return;}
 
@@ -0,0 +1,138 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+#include "jive.h"
+
+#include "ui/timer_queue.h"
+
+
+/* The queue of running jive.ui.Timer objects. Each queued timer holds a
+ * reference in the jiveTimerQueue registry table, the reference is the
+ * timer id in the queue and is stored in the timer as _qid.
+ */
+static struct timer_queue timers;
+
+
+static void get_timer_table(lua_State *L) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "jiveTimerQueue");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, "jiveTimerQueue");
+	}
+}
+
+
+int jiveL_timer_queue_insert(lua_State *L) {
+	Uint32 expires;
+	int id;
+
+	/* stack is:
+	 * 1: timer
+	 * 2: expires
+	 */
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	expires = (Uint32) luaL_checkinteger(L, 2);
+
+	lua_getfield(L, 1, "_qid");
+	if (lua_isnil(L, -1)) {
+		get_timer_table(L);
+		lua_pushvalue(L, 1);
+		id = luaL_ref(L, -2);
+		lua_pop(L, 1);
+
+		lua_pushinteger(L, id);
+		lua_setfield(L, 1, "_qid");
+	}
+	else {
+		id = lua_tointeger(L, -1);
+	}
+	lua_pop(L, 1);
+
+	if (timer_queue_insert(&timers, id, expires) < 0) {
+		return luaL_error(L, "out of memory");
+	}
+
+	return 0;
+}
+
+
+int jiveL_timer_queue_remove(lua_State *L) {
+	int id;
+
+	/* stack is:
+	 * 1: timer
+	 */
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	lua_getfield(L, 1, "_qid");
+	if (lua_isnil(L, -1)) {
+		return 0;
+	}
+	id = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	timer_queue_remove(&timers, id);
+
+	get_timer_table(L);
+	luaL_unref(L, -1, id);
+	lua_pop(L, 1);
+
+	lua_pushnil(L);
+	lua_setfield(L, 1, "_qid");
+
+	return 0;
+}
+
+
+int jiveL_timer_queue_pop(lua_State *L) {
+	int id;
+
+	/* stack is:
+	 * 1: class
+	 * 2: now
+	 *
+	 * returns the next expired timer, or nil
+	 */
+
+	id = timer_queue_pop(&timers, (Uint32) luaL_checkinteger(L, 2));
+	if (id < 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	get_timer_table(L);
+	lua_rawgeti(L, -1, id);
+	luaL_unref(L, -2, id);
+
+	lua_pushnil(L);
+	lua_setfield(L, -2, "_qid");
+
+	return 1;
+}
+
+
+int jiveL_timer_queue_next(lua_State *L) {
+	Uint32 expires;
+
+	/* stack is:
+	 * 1: class
+	 *
+	 * returns when the next timer expires, or nil
+	 */
+
+	if (timer_queue_peek(&timers, &expires) < 0) {
+		lua_pushnil(L);
+	}
+	else {
+		lua_pushinteger(L, expires);
+	}
+	return 1;
+}
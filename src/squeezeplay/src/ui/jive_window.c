@@ -69,6 +69,34 @@ int jiveL_window_skin(lua_State *L) {
 }
 
 
+/* Load the background and mask images of the window before it is drawn,
+ * so the first frames of a transition don't wait for them.
+ */
+int jiveL_window_prefetch(lua_State *L) {
+	WindowWidget *peer;
+
+	/* stack is:
+	 * 1: widget
+	 */
+
+	/* the tiles are set when the window is skinned */
+	lua_pushcfunction(L, jiveL_window_check_layout);
+	lua_pushvalue(L, 1);
+	lua_call(L, 1, 0);
+
+	peer = jive_getpeer(L, 1, &windowPeerMeta);
+
+	if (peer->bg_tile) {
+		jive_tile_prefetch(peer->bg_tile);
+	}
+	if (peer->mask_tile) {
+		jive_tile_prefetch(peer->mask_tile);
+	}
+
+	return 0;
+}
+
+
 int jiveL_window_check_layout(lua_State *L) {
 	/* stack is:
 	 * 1: widget
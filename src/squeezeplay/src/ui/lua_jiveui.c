@@ -281,7 +281,9 @@ static int tolua_jive_jive_ui_Surface_loadImageData00(lua_State* tolua_S)
  !tolua_isusertable(tolua_S,1,"Surface",0,&tolua_err) ||
  !tolua_isstring(tolua_S,2,0,&tolua_err) ||
  !tolua_isinteger(tolua_S,3,0,&tolua_err) ||
- !tolua_isnoobj(tolua_S,4,&tolua_err)
+ !tolua_isinteger(tolua_S,4,1,&tolua_err) ||
+ !tolua_isinteger(tolua_S,5,1,&tolua_err) ||
+ !tolua_isnoobj(tolua_S,6,&tolua_err)
  )
  goto tolua_lerror;
  else
@@ -289,8 +291,10 @@ static int tolua_jive_jive_ui_Surface_loadImageData00(lua_State* tolua_S)
  {
   const char* data = ((const char*)  tolua_tostring(tolua_S,2,0));
   unsigned int len = (( unsigned int)  tolua_tointeger(tolua_S,3,0));
+  unsigned short maxW = (( unsigned short)  tolua_tointeger(tolua_S,4,0));
+  unsigned short maxH = (( unsigned short)  tolua_tointeger(tolua_S,5,0));
  {
-  tolua_create Surface* tolua_ret = (tolua_create Surface*)  jive_surface_load_image_data(data,len);
+  tolua_create Surface* tolua_ret = (tolua_create Surface*)  jive_surface_load_image_data(data,len,maxW,maxH);
  tolua_pushusertype_and_takeownership(tolua_S,(void *)tolua_ret,"Surface");
  }
  }
@@ -303,7 +307,7 @@ static int tolua_jive_jive_ui_Surface_loadImageData00(lua_State* tolua_S)
 }
 #endif //#ifndef TOLUA_DISABLE
 
-/* method: jive_font_draw_text of class  Surface */
+/* method: jive_font_draw_text_uncached of class  Surface */
 #ifndef TOLUA_DISABLE_tolua_jive_jive_ui_Surface_drawText00
 static int tolua_jive_jive_ui_Surface_drawText00(lua_State* tolua_S)
 {
@@ -324,7 +328,7 @@ static int tolua_jive_jive_ui_Surface_drawText00(lua_State* tolua_S)
   unsigned int color = (( unsigned int)  tolua_tointeger(tolua_S,3,0));
   const char* str = ((const char*)  tolua_tostring(tolua_S,4,0));
  {
-  tolua_create Surface* tolua_ret = (tolua_create Surface*)  jive_font_draw_text(font,color,str);
+  tolua_create Surface* tolua_ret = (tolua_create Surface*)  jive_font_draw_text_uncached(font,color,str);
  tolua_pushusertype_and_takeownership(tolua_S,(void *)tolua_ret,"Surface");
  }
  }
@@ -1971,6 +1975,38 @@ static int tolua_jive_jive_ui_Tile_getMinSize00(lua_State* tolua_S)
 }
 #endif //#ifndef TOLUA_DISABLE
 
+/* method: jive_tile_prefetch of class  Tile */
+#ifndef TOLUA_DISABLE_tolua_jive_jive_ui_Tile_prefetch00
+static int tolua_jive_jive_ui_Tile_prefetch00(lua_State* tolua_S)
+{
+#ifndef TOLUA_RELEASE
+ tolua_Error tolua_err;
+ if (
+ !tolua_isusertype(tolua_S,1,"Tile",0,&tolua_err) ||
+ !tolua_isnoobj(tolua_S,2,&tolua_err)
+ )
+ goto tolua_lerror;
+ else
+#endif
+ {
+  Tile* self = (Tile*)  tolua_tousertype(tolua_S,1,0);
+#ifndef TOLUA_RELEASE
+ if (!self) tolua_error(tolua_S,"invalid 'self' in function 'jive_tile_prefetch'",NULL);
+#endif
+ {
+  bool tolua_ret = (bool)  jive_tile_prefetch(self);
+ tolua_pushboolean(tolua_S,(bool)tolua_ret);
+ }
+ }
+ return 1;
+#ifndef TOLUA_RELEASE
+ tolua_lerror:
+ tolua_error(tolua_S,"#ferror in function 'prefetch'.",&tolua_err);
+ return 0;
+#endif
+}
+#endif //#ifndef TOLUA_DISABLE
+
 /* method: jive_font_load of class  Font */
 #ifndef TOLUA_DISABLE_tolua_jive_jive_ui_Font_load00
 static int tolua_jive_jive_ui_Font_load00(lua_State* tolua_S)
@@ -2364,6 +2400,7 @@ TOLUA_API int tolua_jive_open (lua_State* tolua_S)
     tolua_function(tolua_S,"free",tolua_jive_jive_ui_Tile_free00);
     tolua_function(tolua_S,"blit",tolua_jive_jive_ui_Tile_blit00);
     tolua_function(tolua_S,"getMinSize",tolua_jive_jive_ui_Tile_getMinSize00);
+    tolua_function(tolua_S,"prefetch",tolua_jive_jive_ui_Tile_prefetch00);
    tolua_endmodule(tolua_S);
    tolua_cclass(tolua_S,"Font","Font","",tolua_jive_jive_ui_Font__free00);
    tolua_beginmodule(tolua_S,"Font");
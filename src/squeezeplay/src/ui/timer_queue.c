@@ -0,0 +1,180 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "ui/timer_queue.h"
+
+
+/* true if entry a runs before entry b, the tick counter may wrap */
+#define TIMER_BEFORE(a, b) \
+	((a)->expires != (b)->expires ? (Sint32)((a)->expires - (b)->expires) < 0 : (Sint32)((a)->seq - (b)->seq) < 0)
+
+
+void timer_queue_init(struct timer_queue *q) {
+	memset(q, 0, sizeof(struct timer_queue));
+}
+
+
+void timer_queue_free(struct timer_queue *q) {
+	free(q->heap);
+	free(q->pos);
+	memset(q, 0, sizeof(struct timer_queue));
+}
+
+
+static void heap_set(struct timer_queue *q, size_t i, struct timer_queue_entry *e) {
+	q->heap[i] = *e;
+	q->pos[e->id] = i;
+}
+
+
+static void sift_up(struct timer_queue *q, size_t i) {
+	struct timer_queue_entry e = q->heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) >> 1;
+
+		if (!TIMER_BEFORE(&e, &q->heap[parent])) {
+			break;
+		}
+		heap_set(q, i, &q->heap[parent]);
+		i = parent;
+	}
+	heap_set(q, i, &e);
+}
+
+
+static void sift_down(struct timer_queue *q, size_t i) {
+	struct timer_queue_entry e = q->heap[i];
+
+	while (1) {
+		size_t child = (i << 1) + 1;
+
+		if (child >= q->num) {
+			break;
+		}
+		if (child + 1 < q->num && TIMER_BEFORE(&q->heap[child + 1], &q->heap[child])) {
+			child++;
+		}
+		if (!TIMER_BEFORE(&q->heap[child], &e)) {
+			break;
+		}
+		heap_set(q, i, &q->heap[child]);
+		i = child;
+	}
+	heap_set(q, i, &e);
+}
+
+
+static void heap_delete(struct timer_queue *q, size_t i) {
+	q->pos[q->heap[i].id] = -1;
+
+	q->num--;
+	if (i == q->num) {
+		return;
+	}
+
+	/* move the last entry into the hole */
+	heap_set(q, i, &q->heap[q->num]);
+	if (i > 0 && TIMER_BEFORE(&q->heap[i], &q->heap[(i - 1) >> 1])) {
+		sift_up(q, i);
+	}
+	else {
+		sift_down(q, i);
+	}
+}
+
+
+int timer_queue_insert(struct timer_queue *q, int id, Uint32 expires) {
+	struct timer_queue_entry e;
+	size_t i;
+
+	assert(id >= 0);
+
+	if ((size_t)id >= q->num_pos) {
+		size_t num_pos = q->num_pos ? q->num_pos : 16;
+		int *pos;
+
+		while ((size_t)id >= num_pos) {
+			num_pos <<= 1;
+		}
+
+		pos = realloc(q->pos, num_pos * sizeof(int));
+		if (!pos) {
+			return -1;
+		}
+		for (i = q->num_pos; i < num_pos; i++) {
+			pos[i] = -1;
+		}
+
+		q->pos = pos;
+		q->num_pos = num_pos;
+	}
+
+	if (q->pos[id] >= 0) {
+		heap_delete(q, q->pos[id]);
+	}
+
+	if (q->num == q->size) {
+		size_t size = q->size ? q->size << 1 : 16;
+		struct timer_queue_entry *heap;
+
+		heap = realloc(q->heap, size * sizeof(struct timer_queue_entry));
+		if (!heap) {
+			return -1;
+		}
+
+		q->heap = heap;
+		q->size = size;
+	}
+
+	e.expires = expires;
+	e.seq = q->seq++;
+	e.id = id;
+
+	q->heap[q->num] = e;
+	q->pos[id] = q->num;
+	q->num++;
+	sift_up(q, q->num - 1);
+
+	return 0;
+}
+
+
+void timer_queue_remove(struct timer_queue *q, int id) {
+	if (id < 0 || (size_t)id >= q->num_pos || q->pos[id] < 0) {
+		return;
+	}
+
+	heap_delete(q, q->pos[id]);
+}
+
+
+int timer_queue_peek(struct timer_queue *q, Uint32 *expires) {
+	if (q->num == 0) {
+		return -1;
+	}
+
+	if (expires) {
+		*expires = q->heap[0].expires;
+	}
+	return q->heap[0].id;
+}
+
+
+int timer_queue_pop(struct timer_queue *q, Uint32 now) {
+	int id;
+
+	if (q->num == 0 || (Sint32)(now - q->heap[0].expires) < 0) {
+		return -1;
+	}
+
+	id = q->heap[0].id;
+	heap_delete(q, 0);
+
+	return id;
+}
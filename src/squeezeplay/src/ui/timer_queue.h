@@ -0,0 +1,58 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#ifndef UI_TIMER_QUEUE_H
+#define UI_TIMER_QUEUE_H
+
+
+/* Timer queue, a binary heap ordered by expiry time. Timers are
+ * identified by a small integer id chosen by the caller, the position
+ * of each id in the heap is tracked so a timer can be removed or moved
+ * in O(log n). Timers with the same expiry time run in the order they
+ * were queued.
+ */
+struct timer_queue_entry {
+	Uint32 expires;
+	Uint32 seq;
+	int id;
+};
+
+struct timer_queue {
+	struct timer_queue_entry *heap;
+	size_t num, size;
+
+	/* heap position of each id, -1 if not queued */
+	int *pos;
+	size_t num_pos;
+
+	Uint32 seq;
+};
+
+
+extern void timer_queue_init(struct timer_queue *q);
+
+extern void timer_queue_free(struct timer_queue *q);
+
+/* Queue timer id to expire at expires, moving it if already queued.
+ * Returns -1 if out of memory.
+ */
+extern int timer_queue_insert(struct timer_queue *q, int id, Uint32 expires);
+
+/* Remove timer id, if it is queued */
+extern void timer_queue_remove(struct timer_queue *q, int id);
+
+/* Returns the id of the next timer to expire, or -1 if the queue is
+ * empty. If expires is not NULL it is set to the expiry time.
+ */
+extern int timer_queue_peek(struct timer_queue *q, Uint32 *expires);
+
+/* Removes and returns the id of the next timer if it has expired by
+ * now, otherwise -1.
+ */
+extern int timer_queue_pop(struct timer_queue *q, Uint32 now);
+
+#endif // UI_TIMER_QUEUE_H
@@ -0,0 +1,227 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+/*
+ * Micro-benchmark for the timer queue. Compares the binary heap with a
+ * sorted array, which is how jive.ui.Timer previously queued timers, at
+ * 10, 100 and 1000 running timers. Both queues are driven with the same
+ * operations and must expire the timers in the same order.
+ *
+ *  insert  - start a stopped timer
+ *  restart - move a running timer to a new expiry time
+ *  expire  - run the queue for one frame, restarting each expired timer
+ *
+ * timer_queue_bench [iterations]
+ */
+
+#include "common.h"
+
+#include "ui/timer_queue.h"
+
+
+#define DEFAULT_ITERATIONS 200000
+
+/* ms per frame when expiring timers */
+#define FRAME_TICKS 45
+
+
+/* The sorted array queue, ordered by expiry, equal expiry in insertion
+ * order.
+ */
+struct sorted_queue {
+	int *ids;
+	Uint32 *expires;
+	int num;
+};
+
+
+static void sorted_remove(struct sorted_queue *q, int id) {
+	int i;
+
+	for (i = 0; i < q->num; i++) {
+		if (q->ids[i] == id) {
+			memmove(&q->ids[i], &q->ids[i + 1], (q->num - i - 1) * sizeof(int));
+			memmove(&q->expires[i], &q->expires[i + 1], (q->num - i - 1) * sizeof(Uint32));
+			q->num--;
+			return;
+		}
+	}
+}
+
+
+static void sorted_insert(struct sorted_queue *q, int id, Uint32 expires) {
+	int i;
+
+	sorted_remove(q, id);
+
+	for (i = 0; i < q->num; i++) {
+		if (expires < q->expires[i]) {
+			break;
+		}
+	}
+
+	memmove(&q->ids[i + 1], &q->ids[i], (q->num - i) * sizeof(int));
+	memmove(&q->expires[i + 1], &q->expires[i], (q->num - i) * sizeof(Uint32));
+	q->ids[i] = id;
+	q->expires[i] = expires;
+	q->num++;
+}
+
+
+static int sorted_pop(struct sorted_queue *q, Uint32 now) {
+	int id;
+
+	if (q->num == 0 || q->expires[0] > now) {
+		return -1;
+	}
+
+	id = q->ids[0];
+	sorted_remove(q, id);
+	return id;
+}
+
+
+static double now_us(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+
+/* timer intervals, like a mix of clock, scroll and network timers */
+static Uint32 interval(int id) {
+	static const Uint32 intervals[] = { 50, 100, 250, 1000, 5000, 30000 };
+
+	return intervals[id % (sizeof(intervals) / sizeof(Uint32))];
+}
+
+
+static int bench(int timers, int iterations) {
+	struct timer_queue heap;
+	struct sorted_queue sorted;
+	Uint32 *ops;
+	Uint32 now;
+	double start, t_insert[2], t_restart[2], t_expire[2];
+	int i, id, a, b, expired;
+
+	timer_queue_init(&heap);
+	sorted.ids = malloc(timers * sizeof(int));
+	sorted.expires = malloc(timers * sizeof(Uint32));
+	sorted.num = 0;
+
+	/* random operations, the same for both queues */
+	ops = malloc(iterations * sizeof(Uint32));
+	for (i = 0; i < iterations; i++) {
+		ops[i] = rand();
+	}
+
+	/* insert: fill the queue, then remove and reinsert one timer */
+	for (id = 0; id < timers; id++) {
+		timer_queue_insert(&heap, id, interval(id));
+		sorted_insert(&sorted, id, interval(id));
+	}
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		id = ops[i] % timers;
+		timer_queue_remove(&heap, id);
+		timer_queue_insert(&heap, id, ops[i] % 30000);
+	}
+	t_insert[0] = (now_us() - start) * 1000.0 / iterations;
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		id = ops[i] % timers;
+		sorted_remove(&sorted, id);
+		sorted_insert(&sorted, id, ops[i] % 30000);
+	}
+	t_insert[1] = (now_us() - start) * 1000.0 / iterations;
+
+	/* restart: move a running timer */
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		id = ops[i] % timers;
+		timer_queue_insert(&heap, id, (ops[i] >> 8) % 30000);
+	}
+	t_restart[0] = (now_us() - start) * 1000.0 / iterations;
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		id = ops[i] % timers;
+		sorted_insert(&sorted, id, (ops[i] >> 8) % 30000);
+	}
+	t_restart[1] = (now_us() - start) * 1000.0 / iterations;
+
+	/* expire: run frames, restarting expired timers. the queues must
+	 * agree on the order
+	 */
+	expired = 0;
+	start = now_us();
+	for (i = 0, now = 0; i < iterations / 10; i++, now += FRAME_TICKS) {
+		while ((id = timer_queue_pop(&heap, now)) >= 0) {
+			timer_queue_insert(&heap, id, now + interval(id));
+			expired++;
+		}
+	}
+	t_expire[0] = (now_us() - start) * 1000.0 / (expired ? expired : 1);
+
+	start = now_us();
+	for (i = 0, now = 0; i < iterations / 10; i++, now += FRAME_TICKS) {
+		while ((id = sorted_pop(&sorted, now)) >= 0) {
+			sorted_insert(&sorted, id, now + interval(id));
+		}
+	}
+	t_expire[1] = (now_us() - start) * 1000.0 / (expired ? expired : 1);
+
+	/* compare the final order */
+	a = b = 0;
+	while ((id = timer_queue_pop(&heap, (Uint32)-1 >> 1)) >= 0) {
+		if (a >= sorted.num || sorted.ids[a] != id) {
+			b++;
+		}
+		a++;
+	}
+	if (a != sorted.num) {
+		b++;
+	}
+
+	if (b) {
+		printf("%6d timers MISMATCH\n", timers);
+	}
+	else {
+		printf("%6d %12s %9.1f %9.1f %9.1f\n", timers, "heap", t_insert[0], t_restart[0], t_expire[0]);
+		printf("%6d %12s %9.1f %9.1f %9.1f\n", timers, "sorted array", t_insert[1], t_restart[1], t_expire[1]);
+	}
+
+	timer_queue_free(&heap);
+	free(sorted.ids);
+	free(sorted.expires);
+	free(ops);
+
+	return b ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[]) {
+	int iterations = DEFAULT_ITERATIONS;
+	int errors = 0;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+
+	srand(1);
+
+	printf("%d iterations, ns per operation\n", iterations);
+	printf("%6s %12s %9s %9s %9s\n", "timers", "queue", "insert", "restart", "expire");
+
+	errors += bench(10, iterations);
+	errors += bench(100, iterations);
+	errors += bench(1000, iterations);
+
+	return errors ? 1 : 0;
+}
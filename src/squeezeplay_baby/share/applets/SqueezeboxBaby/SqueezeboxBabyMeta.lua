@@ -37,6 +37,7 @@ function defaultSettings(meta)
 		alsaPlaybackBufferTime = 20000,
 		alsaPlaybackPeriodCount = 2,
 		alsaSampleSize = 16,
+		streamReaderThread = true,
 	}
 end
 
@@ -129,6 +129,8 @@ function init(self)
 
 	--account for fab4 touchpad hardware issue: the bottom pixels aren't reported correctly 
 	System:setTouchpadBottomCorrection(30)
+
+	Framework:setFrameRate(settings.frameRate)
 	
 	-- warn if uuid or mac are invalid
 	verifyMacUUID(self)
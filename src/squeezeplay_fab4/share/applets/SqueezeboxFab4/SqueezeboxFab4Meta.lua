@@ -33,6 +33,9 @@ function defaultSettings(meta)
 		alsaEffectsBufferTime = 20000,
 		alsaEffectsPeriodCount = 2,
 		alsaSampleSize = 24,
+		streamReaderThread = true,
+		outputBufferSize = 5 * 2 * 96000 * 4, -- 5 seconds at 96k, about the 10 second 44.1k default
+		frameRate = 50, -- smoother touch scrolling
 	}
 end
 